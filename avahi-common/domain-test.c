@@ -29,6 +29,60 @@
 #include "error.h"
 #include "malloc.h"
 
+static char swap_case(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'))
+        return (char) (c ^ 0x20);
+
+    return c;
+}
+
+/* Compare labels of all lengths, so that we hit every combination of
+ * whole words and remaining bytes in the comparison. With a trailing
+ * dot the names are compared label by label, without one in one go. */
+static void test_case_insensitive(void) {
+    static const char pattern[] = "aZ@[`{mQ09_-";
+    size_t l, i;
+
+    for (l = 1; l < AVAHI_LABEL_MAX; l++) {
+        char x[AVAHI_LABEL_MAX+1], y[AVAHI_LABEL_MAX+1];
+
+        for (i = 0; i < l; i++) {
+            x[i] = pattern[(i*5 + l) % (sizeof(pattern)-1)];
+            y[i] = swap_case(x[i]);
+        }
+
+        x[l] = y[l] = 0;
+
+        assert(avahi_domain_equal(x, y));
+        assert(avahi_domain_hash(x) == avahi_domain_hash(y));
+
+        x[l] = '.';
+        x[l+1] = 0;
+
+        assert(avahi_domain_equal(x, y));
+        assert(avahi_domain_hash(x) == avahi_domain_hash(y));
+
+        for (i = 0; i < l; i++) {
+            char c = y[i];
+
+            /* Characters like '[' and '{' differ in the case bit
+             * only, but they are not letters */
+            if (swap_case(c) != c)
+                y[i] = (char) (c == 'm' || c == 'M' ? 'q' : 'm');
+            else
+                y[i] = (char) (c ^ 0x20);
+
+            assert(!avahi_domain_equal(x, y));
+
+            x[l] = 0;
+            assert(!avahi_domain_equal(x, y));
+            x[l] = '.';
+
+            y[i] = c;
+        }
+    }
+}
+
 int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     char *s;
     char t[256], r[256];
@@ -68,6 +122,8 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
 
     printf("%u = %u\n", avahi_domain_hash("ccc\\065aa.aa\\.b\\\\."), avahi_domain_hash("cccAaa.aa\\.b\\\\"));
 
+    test_case_insensitive();
+
 
     avahi_service_name_join(t, sizeof(t), "foo.foo.foo \\.", "_http._tcp", "test.local");
     printf("<%s>\n", t);
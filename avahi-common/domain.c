@@ -37,6 +37,51 @@
 #include "address.h"
 #include "utf8.h"
 
+/* DNS names are only case insensitive in the ASCII range (RFC 4343),
+ * hence we don't use the locale dependent tolower() and
+ * strcasecmp() */
+static char ascii_tolower(char c) {
+    return (char) (c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+}
+
+#define ONES ((uint64_t) 0x0101010101010101ULL)
+
+/* Like ascii_tolower() but for eight characters at once */
+static uint64_t ascii_tolower8(uint64_t x) {
+    uint64_t heptets, gt_z, ge_a, upper;
+
+    /* Calculate per byte without carrying into the next one: the high
+     * bit of gt_z is set for all bytes > 'Z', the one of ge_a for all
+     * bytes >= 'A'. Bytes with the high bit set aren't ASCII. */
+    heptets = x & (0x7F * ONES);
+    gt_z = heptets + ((0x7F - 'Z') * ONES);
+    ge_a = heptets + ((0x80 - 'A') * ONES);
+    upper = (ge_a ^ gt_z) & ~x & (0x80 * ONES);
+
+    /* Set bit 5 of the upper case letters */
+    return x | (upper >> 2);
+}
+
+/* Compare l bytes, ignoring ASCII case */
+static int ascii_equal(const char *a, const char *b, size_t l) {
+
+    for (; l >= 8; l -= 8, a += 8, b += 8) {
+        uint64_t x, y;
+
+        memcpy(&x, a, 8);
+        memcpy(&y, b, 8);
+
+        if (x != y && ascii_tolower8(x) != ascii_tolower8(y))
+            return 0;
+    }
+
+    for (; l > 0; l--, a++, b++)
+        if (ascii_tolower(*a) != ascii_tolower(*b))
+            return 0;
+
+    return 1;
+}
+
 /* Read the first label from string *name, unescape "\" and write it to dest */
 char *avahi_unescape_label(const char **name, char *dest, size_t size) {
     unsigned i = 0;
@@ -94,11 +139,19 @@ char *avahi_unescape_label(const char **name, char *dest, size_t size) {
                 return NULL;
 
         } else {
+            size_t l;
+
+            /* A run of normal characters */
 
-            /* Normal character */
+            l = strcspn(*name, ".\\");
 
-            *(d++) = *((*name) ++);
-            i++;
+            if (i + l >= size)
+                return NULL;
+
+            memcpy(d, *name, l);
+            d += l;
+            *name += l;
+            i += (unsigned) l;
         }
     }
 
@@ -227,13 +280,28 @@ char *avahi_normalize_name_strdup(const char *s) {
     return avahi_strdup(t);
 }
 
+/* Without escapes and trailing dots the labels of a name are just
+ * the text between the dots, hence such names can be compared and
+ * hashed without splitting them up */
+static int is_plain_name(const char *s, size_t l) {
+    return l > 0 && s[l-1] != '.' && !memchr(s, '\\', l);
+}
+
 int avahi_domain_equal(const char *a, const char *b) {
+    size_t la, lb;
+
     assert(a);
     assert(b);
 
     if (a == b)
         return 1;
 
+    la = strlen(a);
+    lb = strlen(b);
+
+    if (is_plain_name(a, la) && is_plain_name(b, lb))
+        return la == lb && ascii_equal(a, b, la);
+
     for (;;) {
         char ca[AVAHI_LABEL_MAX], cb[AVAHI_LABEL_MAX], *r;
 
@@ -242,7 +310,7 @@ int avahi_domain_equal(const char *a, const char *b) {
         r = avahi_unescape_label(&b, cb, sizeof(cb));
         assert(r);
 
-        if (strcasecmp(ca, cb))
+        if ((la = strlen(ca)) != strlen(cb) || !ascii_equal(ca, cb, la))
             return 0;
 
         if (!*a && !*b)
@@ -429,6 +497,15 @@ int avahi_is_valid_host_name(const char *t) {
 unsigned avahi_domain_hash(const char *s) {
     unsigned hash = 0;
 
+    /* Only the characters of the labels are hashed, not the dots */
+    if (!strchr(s, '\\')) {
+        for (; *s; s++)
+            if (*s != '.')
+                hash = 31 * hash + (unsigned char) ascii_tolower(*s);
+
+        return hash;
+    }
+
     while (*s) {
         char c[AVAHI_LABEL_MAX], *p, *r;
 
@@ -436,7 +513,7 @@ unsigned avahi_domain_hash(const char *s) {
         assert(r);
 
         for (p = c; *p; p++)
-            hash = 31 * hash + tolower((unsigned char)*p);
+            hash = 31 * hash + (unsigned char) ascii_tolower(*p);
     }
 
     return hash;
@@ -0,0 +1,265 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <assert.h>
+#include <inttypes.h>
+
+#include "malloc.h"
+#include "llist.h"
+#include "pool.h"
+
+#if !defined(AVAHI_POOL_DISABLE) && defined(__SANITIZE_ADDRESS__)
+#define AVAHI_POOL_DISABLE 1
+#endif
+
+#if !defined(AVAHI_POOL_DISABLE) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define AVAHI_POOL_DISABLE 1
+#endif
+#endif
+
+#define AVAHI_POOL_SLAB_SIZE 4096
+
+typedef struct AvahiPoolSlab AvahiPoolSlab;
+
+/* Used to align slab headers and objects for any kind of data */
+typedef union AvahiPoolAlign {
+    void *p;
+    long l;
+    double d;
+    int64_t i;
+} AvahiPoolAlign;
+
+struct AvahiPoolSlab {
+    AvahiPool *pool;
+    void *free_objects;
+    unsigned n_used;
+
+    /* Only slabs with free objects are linked into the pool */
+    int linked;
+    AVAHI_LLIST_FIELDS(AvahiPoolSlab, slabs);
+};
+
+/* Every object is prefixed by a pointer to its slab */
+typedef union AvahiPoolObject {
+    AvahiPoolSlab *slab;
+    AvahiPoolAlign align;
+} AvahiPoolObject;
+
+#define SLAB_HEADER_SIZE ((sizeof(AvahiPoolSlab) + sizeof(AvahiPoolAlign) - 1) / sizeof(AvahiPoolAlign) * sizeof(AvahiPoolAlign))
+
+struct AvahiPool {
+    char *name;
+    size_t object_size, chunk_size;
+    unsigned n_per_slab;
+
+    AVAHI_LLIST_HEAD(AvahiPoolSlab, slabs);
+    unsigned n_slabs, n_live, n_live_max;
+};
+
+AvahiPool *avahi_pool_new(const char *name, size_t object_size, unsigned n_per_slab) {
+    AvahiPool *p;
+
+    assert(name);
+    assert(object_size > 0);
+
+    if (!(p = avahi_new(AvahiPool, 1)))
+        return NULL;
+
+    if (!(p->name = avahi_strdup(name))) {
+        avahi_free(p);
+        return NULL;
+    }
+
+    p->object_size = object_size;
+
+    /* Round up so that there's space for the free list pointer and
+     * the next object is properly aligned */
+    if (object_size < sizeof(void*))
+        object_size = sizeof(void*);
+
+    p->chunk_size = sizeof(AvahiPoolObject) + (object_size + sizeof(AvahiPoolAlign) - 1) / sizeof(AvahiPoolAlign) * sizeof(AvahiPoolAlign);
+
+    if (n_per_slab <= 0) {
+        n_per_slab = (AVAHI_POOL_SLAB_SIZE - SLAB_HEADER_SIZE) / p->chunk_size;
+        if (n_per_slab < 8)
+            n_per_slab = 8;
+    }
+
+    p->n_per_slab = n_per_slab;
+
+    AVAHI_LLIST_HEAD_INIT(AvahiPoolSlab, p->slabs);
+    p->n_slabs = p->n_live = p->n_live_max = 0;
+
+    return p;
+}
+
+void avahi_pool_free(AvahiPool *p) {
+    assert(p);
+    assert(p->n_live == 0);
+
+    /* All slabs are empty now, hence all of them are linked in */
+    while (p->slabs) {
+        AvahiPoolSlab *s = p->slabs;
+
+        AVAHI_LLIST_REMOVE(AvahiPoolSlab, slabs, p->slabs, s);
+        avahi_free(s);
+    }
+
+    avahi_free(p->name);
+    avahi_free(p);
+}
+
+#ifndef AVAHI_POOL_DISABLE
+
+static AvahiPoolSlab *slab_new(AvahiPool *p) {
+    AvahiPoolSlab *s;
+    uint8_t *o;
+    unsigned i;
+
+    if (!(s = avahi_malloc(SLAB_HEADER_SIZE + p->n_per_slab * p->chunk_size)))
+        return NULL;
+
+    s->pool = p;
+    s->free_objects = NULL;
+    s->n_used = 0;
+
+    /* Thread all objects onto the free list, last one first so that
+     * they are handed out in address order */
+    o = (uint8_t*) s + SLAB_HEADER_SIZE + p->n_per_slab * p->chunk_size;
+    for (i = 0; i < p->n_per_slab; i++) {
+        AvahiPoolObject *h;
+
+        o -= p->chunk_size;
+        h = (AvahiPoolObject*) o;
+        h->slab = s;
+
+        *(void**) (h + 1) = s->free_objects;
+        s->free_objects = h + 1;
+    }
+
+    AVAHI_LLIST_PREPEND(AvahiPoolSlab, slabs, p->slabs, s);
+    s->linked = 1;
+    p->n_slabs++;
+
+    return s;
+}
+
+#endif
+
+void *avahi_pool_alloc(AvahiPool *p) {
+    void *o;
+#ifndef AVAHI_POOL_DISABLE
+    AvahiPoolSlab *s;
+#endif
+
+    assert(p);
+
+#ifdef AVAHI_POOL_DISABLE
+    if (!(o = avahi_malloc(p->object_size)))
+        return NULL;
+#else
+    if (!(s = p->slabs))
+        if (!(s = slab_new(p)))
+            return NULL;
+
+    assert(s->free_objects);
+
+    o = s->free_objects;
+    s->free_objects = *(void**) o;
+    s->n_used++;
+
+    /* Full slabs are no longer of interest to us */
+    if (!s->free_objects) {
+        AVAHI_LLIST_REMOVE(AvahiPoolSlab, slabs, p->slabs, s);
+        s->linked = 0;
+    }
+#endif
+
+    p->n_live++;
+    if (p->n_live > p->n_live_max)
+        p->n_live_max = p->n_live;
+
+    return o;
+}
+
+void *avahi_pool_alloc0(AvahiPool *p) {
+    void *o;
+
+    if ((o = avahi_pool_alloc(p)))
+        memset(o, 0, p->object_size);
+
+    return o;
+}
+
+void avahi_pool_release(AvahiPool *p, void *o) {
+#ifndef AVAHI_POOL_DISABLE
+    AvahiPoolSlab *s;
+#endif
+
+    assert(p);
+
+    if (!o)
+        return;
+
+    assert(p->n_live > 0);
+    p->n_live--;
+
+#ifdef AVAHI_POOL_DISABLE
+    avahi_free(o);
+#else
+    s = ((AvahiPoolObject*) o - 1)->slab;
+    assert(s->pool == p);
+    assert(s->n_used > 0);
+
+    *(void**) o = s->free_objects;
+    s->free_objects = o;
+    s->n_used--;
+
+    if (!s->linked) {
+        AVAHI_LLIST_PREPEND(AvahiPoolSlab, slabs, p->slabs, s);
+        s->linked = 1;
+    }
+
+    /* Give empty slabs back, unless this is the only one with free
+     * objects left, so that we don't thrash if a single object is
+     * allocated and released all the time */
+    if (s->n_used <= 0 && (s->slabs_next || s->slabs_prev)) {
+        AVAHI_LLIST_REMOVE(AvahiPoolSlab, slabs, p->slabs, s);
+        avahi_free(s);
+        p->n_slabs--;
+    }
+#endif
+}
+
+void avahi_pool_get_stats(AvahiPool *p, AvahiPoolStats *stats) {
+    assert(p);
+    assert(stats);
+
+    stats->name = p->name;
+    stats->object_size = p->object_size;
+    stats->n_live = p->n_live;
+    stats->n_live_max = p->n_live_max;
+    stats->n_slabs = p->n_slabs;
+}
@@ -0,0 +1,65 @@
+#ifndef foopoolhfoo
+#define foopoolhfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <sys/types.h>
+
+#include <avahi-common/cdecl.h>
+
+AVAHI_C_DECL_BEGIN
+
+/* A pool of fixed size objects, allocated in slabs. Not thread-safe,
+ * every pool should be owned by a single object or thread. */
+typedef struct AvahiPool AvahiPool;
+
+/* Statistics of an AvahiPool */
+typedef struct AvahiPoolStats {
+    const char *name;      /* The name passed to avahi_pool_new() */
+    size_t object_size;    /* Size of the objects in the pool */
+    unsigned n_live;       /* Number of objects currently allocated */
+    unsigned n_live_max;   /* Highest number of objects allocated at the same time */
+    unsigned n_slabs;      /* Number of slabs currently allocated */
+} AvahiPoolStats;
+
+/* Create a new pool for objects of the specified size. If
+ * n_per_slab is 0 a reasonable default is chosen. If avahi has been
+ * built with --disable-object-pools or with AddressSanitizer the
+ * pool hands out every object with avahi_malloc() instead. */
+AvahiPool *avahi_pool_new(const char *name, size_t object_size, unsigned n_per_slab);
+
+/* Free a pool. All objects must have been released before. */
+void avahi_pool_free(AvahiPool *p);
+
+/* Allocate an object from the pool */
+void *avahi_pool_alloc(AvahiPool *p);
+
+/* Same as avahi_pool_alloc() but set the memory to zero */
+void *avahi_pool_alloc0(AvahiPool *p);
+
+/* Return an object to the pool */
+void avahi_pool_release(AvahiPool *p, void *o);
+
+/* Fill in the statistics of a pool */
+void avahi_pool_get_stats(AvahiPool *p, AvahiPoolStats *stats);
+
+AVAHI_C_DECL_END
+
+#endif
@@ -34,6 +34,16 @@
 #define AVAHI_PROBE_JITTER_MSEC 250
 #define AVAHI_PROBE_INTERVAL_MSEC 250
 
+static void set_state(AvahiAnnouncer *a, AvahiAnnouncerState state) {
+    assert(a);
+
+    a->state = state;
+
+    /* Whether the entry is registered on the interface depends on
+     * this, so replies we may have kept are stale now */
+    a->server->response_generation++;
+}
+
 static void remove_announcer(AvahiServer *s, AvahiAnnouncer *a) {
     assert(s);
     assert(a);
@@ -44,6 +54,8 @@ static void remove_announcer(AvahiServer *s, AvahiAnnouncer *a) {
     AVAHI_LLIST_REMOVE(AvahiAnnouncer, by_interface, a->interface->announcers, a);
     AVAHI_LLIST_REMOVE(AvahiAnnouncer, by_entry, a->entry->announcers, a);
 
+    s->response_generation++;
+
     if (a->state == AVAHI_PROBING && a->entry->group) {
 	assert(a->entry->group->n_probing);
 	a->entry->group->n_probing--;
@@ -97,7 +109,7 @@ void avahi_s_entry_group_check_probed(AvahiSEntryGroup *g, int immediately) {
             if (a->state != AVAHI_WAITING)
                 continue;
 
-            a->state = AVAHI_ANNOUNCING;
+            set_state(a, AVAHI_ANNOUNCING);
 
             if (immediately) {
                 /* Shortcut */
@@ -134,9 +146,9 @@ static void next_state(AvahiAnnouncer *a) {
             }
 
             if (a->entry->group && a->entry->group->state == AVAHI_ENTRY_GROUP_REGISTERING)
-                a->state = AVAHI_WAITING;
+                set_state(a, AVAHI_WAITING);
             else {
-                a->state = AVAHI_ANNOUNCING;
+                set_state(a, AVAHI_ANNOUNCING);
                 a->n_iteration = 1;
             }
 
@@ -166,7 +178,7 @@ static void next_state(AvahiAnnouncer *a) {
         if (++a->n_iteration >= 4) {
             /* Announcing done */
 
-            a->state = AVAHI_ESTABLISHED;
+            set_state(a, AVAHI_ESTABLISHED);
 
             set_timeout(a, NULL);
         } else {
@@ -209,16 +221,16 @@ static void go_to_initial_state(AvahiAnnouncer *a) {
     e = a->entry;
 
     if ((e->flags & AVAHI_PUBLISH_UNIQUE) && !(e->flags & AVAHI_PUBLISH_NO_PROBE))
-        a->state = AVAHI_PROBING;
+        set_state(a, AVAHI_PROBING);
     else if (!(e->flags & AVAHI_PUBLISH_NO_ANNOUNCE)) {
 
         if (!e->group || e->group->state == AVAHI_ENTRY_GROUP_ESTABLISHED)
-            a->state = AVAHI_ANNOUNCING;
+            set_state(a, AVAHI_ANNOUNCING);
         else
-            a->state = AVAHI_WAITING;
+            set_state(a, AVAHI_WAITING);
 
     } else
-        a->state = AVAHI_ESTABLISHED;
+        set_state(a, AVAHI_ESTABLISHED);
 
     a->n_iteration = 1;
     a->sec_delay = 1;
@@ -440,21 +452,21 @@ static void reannounce(AvahiAnnouncer *a) {
 
         /* We were probing or waiting after probe, so we restart probing from the beginning here */
 
-        a->state = AVAHI_PROBING;
+        set_state(a, AVAHI_PROBING);
     else if (a->state == AVAHI_WAITING)
 
         /* We were waiting, but were not probing before, so we continue waiting  */
-        a->state = AVAHI_WAITING;
+        set_state(a, AVAHI_WAITING);
 
     else if (e->flags & AVAHI_PUBLISH_NO_ANNOUNCE)
 
         /* No announcer needed */
-        a->state = AVAHI_ESTABLISHED;
+        set_state(a, AVAHI_ESTABLISHED);
 
     else {
 
         /* Ok, let's restart announcing */
-        a->state = AVAHI_ANNOUNCING;
+        set_state(a, AVAHI_ANNOUNCING);
     }
 
     /* Now let's increase the probing counter again */
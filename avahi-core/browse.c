@@ -524,6 +524,7 @@ AvahiSRecordBrowser *avahi_s_record_browser_prepare(
     }
 
     b->dead = 0;
+    AVAHI_LLIST_INIT(AvahiSRecordBrowser, dead, b);
     b->defer_time_event = NULL;
     b->server = server;
     b->interface = interface;
@@ -561,7 +562,7 @@ void avahi_s_record_browser_free(AvahiSRecordBrowser *b) {
     assert(!b->dead);
 
     b->dead = 1;
-    b->server->need_browser_cleanup = 1;
+    AVAHI_LLIST_PREPEND(AvahiSRecordBrowser, dead, b->server->dead_record_browsers, b);
 
     browser_cancel(b);
 }
@@ -573,27 +574,19 @@ void avahi_s_record_browser_destroy(AvahiSRecordBrowser *b) {
 
     AVAHI_LLIST_REMOVE(AvahiSRecordBrowser, browser, b->server->record_browsers, b);
 
+    if (b->dead)
+        AVAHI_LLIST_REMOVE(AvahiSRecordBrowser, dead, b->server->dead_record_browsers, b);
+
     avahi_key_unref(b->key);
 
     avahi_free(b);
 }
 
 void avahi_browser_cleanup(AvahiServer *server) {
-    AvahiSRecordBrowser *b;
-    AvahiSRecordBrowser *n;
-
     assert(server);
 
-    while (server->need_browser_cleanup) {
-        server->need_browser_cleanup = 0;
-
-        for (b = server->record_browsers; b; b = n) {
-            n = b->browser_next;
-
-            if (b->dead)
-                avahi_s_record_browser_destroy(b);
-        }
-    }
+    while (server->dead_record_browsers)
+        avahi_s_record_browser_destroy(server->dead_record_browsers);
 
     if (server->wide_area_lookup_engine)
         avahi_wide_area_cleanup(server->wide_area_lookup_engine);
@@ -32,6 +32,7 @@ typedef struct AvahiSRBLookup AvahiSRBLookup;
 
 struct AvahiSRecordBrowser {
     AVAHI_LLIST_FIELDS(AvahiSRecordBrowser, browser);
+    AVAHI_LLIST_FIELDS(AvahiSRecordBrowser, dead);
     int dead;
     AvahiServer *server;
 
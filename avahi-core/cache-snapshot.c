@@ -0,0 +1,456 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/error.h>
+
+#include "internal.h"
+#include "iface.h"
+#include "cache.h"
+#include "dns.h"
+#include "log.h"
+#include "rr-util.h"
+#include "util.h"
+
+/* A cache snapshot starts with a header:
+ *
+ *   "AVCS", uint16 version, uint16 reserved, uint32 time of writing
+ *
+ * followed by any number of blocks of records, each belonging to one
+ * interface:
+ *
+ *   uint8 protocol, uint8 name length, name,
+ *   uint16 number of records, uint32 packet size, packet,
+ *   origin address of each record (uint8 protocol, 16 bytes address)
+ *
+ * The records are stored as answer records of a DNS packet, with
+ * their remaining TTL, so that we can make use of name
+ * compression. All integers are in network byte order. */
+
+#define SNAPSHOT_MAGIC "AVCS"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_HEADER_SIZE 12
+#define SNAPSHOT_ORIGIN_SIZE 17
+#define SNAPSHOT_SIZE_MAX (16*1024*1024)
+
+typedef struct Buffer {
+    uint8_t *data;
+    size_t size, allocated;
+} Buffer;
+
+static int buffer_append(Buffer *b, const void *d, size_t l) {
+    assert(b);
+
+    if (b->size + l > b->allocated) {
+        size_t n;
+        uint8_t *t;
+
+        n = b->allocated ? b->allocated * 2 : 4096;
+        while (n < b->size + l)
+            n *= 2;
+
+        if (!(t = avahi_realloc(b->data, n)))
+            return -1;
+
+        b->data = t;
+        b->allocated = n;
+    }
+
+    memcpy(b->data + b->size, d, l);
+    b->size += l;
+
+    return 0;
+}
+
+static int buffer_append_uint8(Buffer *b, uint8_t v) {
+    return buffer_append(b, &v, sizeof(v));
+}
+
+static int buffer_append_uint16(Buffer *b, uint16_t v) {
+    v = htons(v);
+    return buffer_append(b, &v, sizeof(v));
+}
+
+static int buffer_append_uint32(Buffer *b, uint32_t v) {
+    v = htonl(v);
+    return buffer_append(b, &v, sizeof(v));
+}
+
+static int buffer_append_origin(Buffer *b, const AvahiAddress *a) {
+    uint8_t data[16];
+
+    memset(data, 0, sizeof(data));
+    memcpy(data, a->data.data, a->proto == AVAHI_PROTO_INET ? sizeof(AvahiIPv4Address) : sizeof(AvahiIPv6Address));
+
+    if (buffer_append_uint8(b, (uint8_t) a->proto) < 0 ||
+        buffer_append(b, data, sizeof(data)) < 0)
+        return -1;
+
+    return 0;
+}
+
+static uint16_t get_uint16(const uint8_t *d) {
+    return (uint16_t) ((d[0] << 8) | d[1]);
+}
+
+static uint32_t get_uint32(const uint8_t *d) {
+    return ((uint32_t) d[0] << 24) | ((uint32_t) d[1] << 16) | ((uint32_t) d[2] << 8) | (uint32_t) d[3];
+}
+
+static int entry_is_saved(AvahiCacheEntry *e) {
+    assert(e);
+
+    return
+        e->state != AVAHI_CACHE_EXPIRY_FINAL &&
+        e->state != AVAHI_CACHE_POOF_FINAL &&
+        e->state != AVAHI_CACHE_GOODBYE_FINAL &&
+        e->state != AVAHI_CACHE_REPLACE_FINAL;
+}
+
+static int save_block(Buffer *b, AvahiInterface *i, AvahiDnsPacket *p, unsigned n, Buffer *origins) {
+    size_t l;
+
+    assert(b);
+    assert(i);
+    assert(p);
+    assert(origins);
+
+    l = strlen(i->hardware->name);
+    if (l > 0xFF)
+        return 0;
+
+    avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ANCOUNT, (uint16_t) n);
+
+    if (buffer_append_uint8(b, (uint8_t) i->protocol) < 0 ||
+        buffer_append_uint8(b, (uint8_t) l) < 0 ||
+        buffer_append(b, i->hardware->name, l) < 0 ||
+        buffer_append_uint16(b, (uint16_t) n) < 0 ||
+        buffer_append_uint32(b, (uint32_t) p->size) < 0 ||
+        buffer_append(b, AVAHI_DNS_PACKET_DATA(p), p->size) < 0 ||
+        buffer_append(b, origins->data, origins->size) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int save_interface(Buffer *b, AvahiInterface *i) {
+    AvahiCacheEntry *e;
+    Buffer origins = { NULL, 0, 0 };
+    int ret = -1;
+
+    assert(b);
+    assert(i);
+
+    /* Least recently hit first, so that loading the snapshot
+     * restores the LRU order */
+    e = i->cache->lru_tail;
+
+    while (e) {
+        AvahiDnsPacket *p;
+        unsigned n = 0;
+
+        if (!(p = avahi_dns_packet_new(0)))
+            goto finish;
+
+        origins.size = 0;
+
+        for (; e && n < 0xFFFF; e = e->lru_prev) {
+            AvahiAddress origin;
+            uint64_t age;
+            unsigned ttl;
+
+            if (!entry_is_saved(e))
+                continue;
+
+            age = (avahi_monotonic_msec() - e->timestamp) / 1000;
+            if ((uint64_t) e->record->ttl <= age)
+                continue;
+
+            ttl = e->record->ttl - (unsigned) age;
+
+            if (!avahi_dns_packet_append_record(p, e->record, e->cache_flush, ttl)) {
+
+                /* The packet is full, continue with the next one */
+                if (n > 0)
+                    break;
+
+                /* This record doesn't even fit into an empty one */
+                continue;
+            }
+
+            avahi_cache_entry_get_origin(i->cache, e, &origin);
+
+            if (buffer_append_origin(&origins, &origin) < 0) {
+                avahi_dns_packet_free(p);
+                goto finish;
+            }
+
+            n++;
+        }
+
+        if (n > 0 && save_block(b, i, p, n, &origins) < 0) {
+            avahi_dns_packet_free(p);
+            goto finish;
+        }
+
+        avahi_dns_packet_free(p);
+    }
+
+    ret = 0;
+
+finish:
+    avahi_free(origins.data);
+
+    return ret;
+}
+
+int avahi_server_save_cache(AvahiServer *s, int fd) {
+    AvahiInterface *i;
+    Buffer b = { NULL, 0, 0 };
+    size_t n;
+    int ret;
+
+    assert(s);
+    assert(fd >= 0);
+
+    if (buffer_append(&b, SNAPSHOT_MAGIC, 4) < 0 ||
+        buffer_append_uint16(&b, SNAPSHOT_VERSION) < 0 ||
+        buffer_append_uint16(&b, 0) < 0 ||
+        buffer_append_uint32(&b, (uint32_t) time(NULL)) < 0) {
+        ret = avahi_server_set_errno(s, AVAHI_ERR_NO_MEMORY);
+        goto finish;
+    }
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next) {
+        if (!i->announcing)
+            continue;
+
+        if (save_interface(&b, i) < 0) {
+            ret = avahi_server_set_errno(s, AVAHI_ERR_NO_MEMORY);
+            goto finish;
+        }
+    }
+
+    if (lseek(fd, 0, SEEK_SET) < 0 || ftruncate(fd, 0) < 0) {
+        avahi_log_warn(__FILE__": Failed to truncate cache snapshot: %s", strerror(errno));
+        ret = avahi_server_set_errno(s, AVAHI_ERR_OS);
+        goto finish;
+    }
+
+    for (n = 0; n < b.size;) {
+        ssize_t r;
+
+        if ((r = write(fd, b.data + n, b.size - n)) < 0) {
+            if (errno == EINTR)
+                continue;
+
+            avahi_log_warn(__FILE__": Failed to write cache snapshot: %s", strerror(errno));
+            ret = avahi_server_set_errno(s, AVAHI_ERR_OS);
+            goto finish;
+        }
+
+        n += (size_t) r;
+    }
+
+    ret = AVAHI_OK;
+
+finish:
+    avahi_free(b.data);
+
+    return ret;
+}
+
+static AvahiInterface *find_interface(AvahiServer *s, const char *name, AvahiProtocol protocol) {
+    AvahiInterface *i;
+
+    assert(s);
+    assert(name);
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next)
+        if (i->protocol == protocol && strcmp(i->hardware->name, name) == 0)
+            return i;
+
+    return NULL;
+}
+
+static int load_block(AvahiServer *s, const uint8_t *d, size_t size, size_t *idx, unsigned elapsed) {
+    const uint8_t *origins;
+    char name[256];
+    AvahiProtocol protocol;
+    AvahiInterface *i;
+    AvahiDnsPacket *p;
+    size_t l, psize;
+    unsigned n, k;
+
+    assert(s);
+    assert(d);
+    assert(idx);
+
+    if (*idx + 2 > size)
+        return -1;
+
+    protocol = (AvahiProtocol) d[*idx];
+    l = d[*idx+1];
+    *idx += 2;
+
+    if (*idx + l + 6 > size)
+        return -1;
+
+    memcpy(name, d + *idx, l);
+    name[l] = 0;
+    *idx += l;
+
+    n = get_uint16(d + *idx);
+    psize = get_uint32(d + *idx + 2);
+    *idx += 6;
+
+    if (psize < AVAHI_DNS_PACKET_HEADER_SIZE || psize > AVAHI_DNS_PACKET_SIZE_MAX ||
+        *idx + psize + (size_t) n * SNAPSHOT_ORIGIN_SIZE > size)
+        return -1;
+
+    origins = d + *idx + psize;
+
+    /* Skip interfaces we don't know (anymore) */
+    if (!AVAHI_PROTO_VALID(protocol) ||
+        !(i = find_interface(s, name, protocol)) ||
+        !i->announcing) {
+        *idx += psize + (size_t) n * SNAPSHOT_ORIGIN_SIZE;
+        return 0;
+    }
+
+    if (!(p = avahi_dns_packet_new(0)))
+        return -1;
+
+    memcpy(AVAHI_DNS_PACKET_DATA(p), d + *idx, psize);
+    p->size = psize;
+    p->key_table = s->key_table;
+    *idx += psize + (size_t) n * SNAPSHOT_ORIGIN_SIZE;
+
+    for (k = 0; k < n; k++, origins += SNAPSHOT_ORIGIN_SIZE) {
+        AvahiRecord *r;
+        AvahiAddress a;
+        int cache_flush = 0;
+
+        if (!(r = avahi_dns_packet_consume_record(p, &cache_flush))) {
+            avahi_dns_packet_free(p);
+            return -1;
+        }
+
+        a.proto = (AvahiProtocol) origins[0];
+        memcpy(a.data.data, origins + 1, sizeof(a.data.data));
+
+        /* The cache packs origins assuming they are of the interface's
+         * protocol, so skip anything else a corrupt file might contain */
+        if (a.proto == i->protocol &&
+            r->ttl > elapsed && !avahi_key_is_pattern(r->key)) {
+            r->ttl -= elapsed;
+            avahi_cache_add_unverified(i->cache, r, cache_flush, &a);
+        }
+
+        avahi_record_unref(r);
+    }
+
+    avahi_dns_packet_free(p);
+
+    return 0;
+}
+
+int avahi_server_load_cache(AvahiServer *s, int fd) {
+    struct stat st;
+    uint8_t *d = NULL;
+    size_t size, idx;
+    uint32_t saved;
+    time_t now;
+    unsigned elapsed;
+    int ret;
+
+    assert(s);
+    assert(fd >= 0);
+
+    if (fstat(fd, &st) < 0 || lseek(fd, 0, SEEK_SET) < 0) {
+        avahi_log_warn(__FILE__": Failed to access cache snapshot: %s", strerror(errno));
+        return avahi_server_set_errno(s, AVAHI_ERR_OS);
+    }
+
+    /* An empty file is no snapshot yet */
+    if (st.st_size == 0)
+        return AVAHI_OK;
+
+    if (st.st_size < SNAPSHOT_HEADER_SIZE || st.st_size > SNAPSHOT_SIZE_MAX)
+        return avahi_server_set_errno(s, AVAHI_ERR_INVALID_PACKET);
+
+    size = (size_t) st.st_size;
+
+    if (!(d = avahi_new(uint8_t, size)))
+        return avahi_server_set_errno(s, AVAHI_ERR_NO_MEMORY);
+
+    for (idx = 0; idx < size;) {
+        ssize_t r;
+
+        if ((r = read(fd, d + idx, size - idx)) <= 0) {
+            if (r < 0 && errno == EINTR)
+                continue;
+
+            avahi_log_warn(__FILE__": Failed to read cache snapshot: %s", r < 0 ? strerror(errno) : "EOF");
+            ret = avahi_server_set_errno(s, AVAHI_ERR_OS);
+            goto finish;
+        }
+
+        idx += (size_t) r;
+    }
+
+    if (memcmp(d, SNAPSHOT_MAGIC, 4) != 0) {
+        ret = avahi_server_set_errno(s, AVAHI_ERR_INVALID_PACKET);
+        goto finish;
+    }
+
+    if (get_uint16(d + 4) != SNAPSHOT_VERSION) {
+        ret = avahi_server_set_errno(s, AVAHI_ERR_VERSION_MISMATCH);
+        goto finish;
+    }
+
+    saved = get_uint32(d + 8);
+    now = time(NULL);
+    elapsed = (uint32_t) now > saved ? (uint32_t) now - saved : 0;
+
+    for (idx = SNAPSHOT_HEADER_SIZE; idx < size;)
+        if (load_block(s, d, size, &idx, elapsed) < 0) {
+            ret = avahi_server_set_errno(s, AVAHI_ERR_INVALID_PACKET);
+            goto finish;
+        }
+
+    ret = AVAHI_OK;
+
+finish:
+    avahi_free(d);
+
+    return ret;
+}
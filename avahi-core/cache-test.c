@@ -0,0 +1,489 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <unistd.h>
+
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/address.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/error.h>
+
+#include "internal.h"
+#include "iface.h"
+#include "cache.h"
+#include "querier.h"
+#include "multicast-lookup.h"
+
+/* Like in sched-test.c we fake the parts of the server and the
+ * interface the cache needs. The interface is not announcing, hence
+ * queriers never post any queries. */
+
+static AvahiServer server;
+static AvahiInterfaceMonitor monitor;
+static AvahiHwInterface hardware;
+static AvahiInterface interface;
+static AvahiAddress origin, origin6;
+
+static void setup(AvahiSimplePoll *simple_poll, unsigned n_entries_max) {
+    memset(&server, 0, sizeof(server));
+    memset(&monitor, 0, sizeof(monitor));
+    memset(&hardware, 0, sizeof(hardware));
+    memset(&interface, 0, sizeof(interface));
+
+    server.time_event_queue = avahi_time_event_queue_new(avahi_simple_poll_get(simple_poll), AVAHI_TIME_EVENT_QUEUE_PRIOQ);
+    server.cache_entry_pool = avahi_pool_new("cache-entry", sizeof(AvahiCacheEntry), 0);
+    server.multicast_lookup_engine = avahi_multicast_lookup_engine_new(&server);
+    server.config.n_cache_entries_max = n_entries_max;
+
+    server.monitor = &monitor;
+    monitor.server = &server;
+    monitor.interfaces = &interface;
+
+    hardware.monitor = &monitor;
+    hardware.index = 1;
+    hardware.name = (char*) "eth0";
+
+    interface.monitor = &monitor;
+    interface.hardware = &hardware;
+    interface.protocol = AVAHI_PROTO_INET;
+    interface.queriers_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL);
+    interface.cache = avahi_cache_new(&server, &interface);
+
+    avahi_address_parse("192.168.50.1", AVAHI_PROTO_INET, &origin);
+    avahi_address_parse("fe80::1", AVAHI_PROTO_INET6, &origin6);
+}
+
+static void teardown(void) {
+    avahi_cache_free(interface.cache);
+
+    if (server.cache_records)
+        avahi_hashmap_free(server.cache_records);
+
+    avahi_querier_free_all(&interface);
+    avahi_hashmap_free(interface.queriers_by_key);
+
+    avahi_multicast_lookup_engine_free(server.multicast_lookup_engine);
+    avahi_time_event_queue_free(server.time_event_queue);
+    avahi_pool_free(server.cache_entry_pool);
+}
+
+static AvahiKey *make_key(const char *prefix, unsigned i) {
+    char name[64];
+
+    snprintf(name, sizeof(name), "%s-%u.local", prefix, i);
+    return avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_A);
+}
+
+static void add_to(AvahiCache *c, const char *prefix, unsigned i, uint32_t ttl) {
+    AvahiRecord *r;
+    AvahiKey *k;
+
+    k = make_key(prefix, i);
+    r = avahi_record_new(k, ttl);
+    r->data.a.address.address = htonl(0xc0a83200 + i);
+
+    avahi_cache_update(c, r, 0, c->interface->protocol == AVAHI_PROTO_INET6 ? &origin6 : &origin);
+
+    avahi_record_unref(r);
+    avahi_key_unref(k);
+}
+
+static void add(const char *prefix, unsigned i) {
+    add_to(interface.cache, prefix, i, AVAHI_DEFAULT_TTL);
+}
+
+static void subscribe(const char *prefix, unsigned i) {
+    AvahiKey *k;
+
+    k = make_key(prefix, i);
+    avahi_querier_add(&interface, k, NULL);
+    avahi_key_unref(k);
+}
+
+static void* found_callback(AVAHI_GCC_UNUSED AvahiCache *c, AVAHI_GCC_UNUSED AvahiKey *pattern, AvahiCacheEntry *e, AVAHI_GCC_UNUSED void* userdata) {
+    return e;
+}
+
+/* Note that this counts as a hit */
+static AvahiCacheEntry *find(AvahiCache *c, const char *prefix, unsigned i) {
+    AvahiCacheEntry *e;
+    AvahiKey *k;
+
+    k = make_key(prefix, i);
+    e = avahi_cache_walk(c, k, found_callback, NULL);
+    avahi_key_unref(k);
+
+    return e;
+}
+
+static int cached(const char *prefix, unsigned i) {
+    return !!find(interface.cache, prefix, i);
+}
+
+static void test_lru(AvahiSimplePoll *simple_poll) {
+    unsigned i;
+
+    setup(simple_poll, 100);
+
+    for (i = 0; i < 100; i++)
+        add("host", i);
+
+    assert(interface.cache->n_entries == 100);
+
+    /* host-0 is now the most recently hit entry, host-1 the least */
+    assert(cached("host", 0));
+
+    add("host", 100);
+    assert(interface.cache->n_entries == 100);
+    assert(interface.cache->n_evicted == 1);
+    assert(interface.cache->n_rejected == 0);
+
+    assert(cached("host", 0));
+    assert(!cached("host", 1));
+    assert(cached("host", 2));
+    assert(cached("host", 100));
+
+    teardown();
+}
+
+static void test_subscribed(AvahiSimplePoll *simple_poll) {
+    unsigned i;
+
+    setup(simple_poll, 4);
+
+    for (i = 0; i < 4; i++)
+        add("host", i);
+
+    /* host-0 and host-1 are the coldest entries, but browsed for */
+    subscribe("host", 0);
+    subscribe("host", 1);
+
+    add("other", 0);
+    assert(interface.cache->n_evicted == 1);
+    assert(!cached("host", 2));
+    assert(cached("host", 0));
+    assert(cached("host", 1));
+
+    /* Now everything in the cache is browsed for */
+    subscribe("host", 3);
+    subscribe("other", 0);
+
+    /* A record nobody is interested in can't replace those */
+    add("other", 1);
+    assert(interface.cache->n_evicted == 1);
+    assert(interface.cache->n_rejected == 1);
+    assert(!cached("other", 1));
+
+    /* But one somebody browses for replaces the least recently hit one */
+    subscribe("other", 2);
+    add("other", 2);
+    assert(interface.cache->n_evicted == 2);
+    assert(interface.cache->n_rejected == 1);
+    assert(cached("other", 2));
+    assert(!cached("host", 3));
+
+    teardown();
+}
+
+static void count_shared_callback(AVAHI_GCC_UNUSED void *key, AVAHI_GCC_UNUSED void *value, void *userdata) {
+    unsigned *n = userdata;
+
+    (*n)++;
+}
+
+static unsigned count_shared(void) {
+    unsigned n = 0;
+
+    avahi_hashmap_foreach(server.cache_records, count_shared_callback, &n);
+    return n;
+}
+
+static void test_shared(AvahiSimplePoll *simple_poll) {
+    AvahiInterface interface6;
+    AvahiCacheEntry *e, *e6;
+    AvahiRecord *r, *r6;
+
+    setup(simple_poll, 100);
+    server.cache_records = avahi_cache_shared_records_new();
+
+    /* The IPv6 side of the same link */
+    interface6 = interface;
+    interface6.protocol = AVAHI_PROTO_INET6;
+    interface6.queriers_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL);
+    interface6.cache = avahi_cache_new(&server, &interface6);
+
+    add_to(interface.cache, "host", 0, AVAHI_DEFAULT_TTL);
+    add_to(interface6.cache, "host", 0, AVAHI_DEFAULT_TTL);
+
+    e = find(interface.cache, "host", 0);
+    e6 = find(interface6.cache, "host", 0);
+    assert(e && e6 && e != e6);
+    assert(e->record == e6->record);
+    assert(count_shared() == 1);
+
+    /* Refreshing it doesn't change anything */
+    add_to(interface6.cache, "host", 0, AVAHI_DEFAULT_TTL);
+    e6 = find(interface6.cache, "host", 0);
+    assert(e->record == e6->record);
+
+    /* A different TTL makes it a different record */
+    add_to(interface6.cache, "host", 0, AVAHI_DEFAULT_TTL/2);
+    e6 = find(interface6.cache, "host", 0);
+    assert(e->record != e6->record);
+    assert(e6->record->ttl == AVAHI_DEFAULT_TTL/2);
+    assert(count_shared() == 2);
+
+    r = avahi_record_ref(e->record);
+    r6 = avahi_record_ref(e6->record);
+
+    /* The record still used by the IPv4 cache stays shared, the one
+     * only the IPv6 cache used is gone */
+    avahi_cache_flush(interface6.cache);
+    assert(find(interface.cache, "host", 0));
+    assert(count_shared() == 1);
+    assert(avahi_hashmap_lookup(server.cache_records, r));
+    assert(!avahi_hashmap_lookup(server.cache_records, r6));
+
+    /* Nothing is left once neither cache uses it */
+    avahi_cache_free(interface6.cache);
+    avahi_hashmap_free(interface6.queriers_by_key);
+    avahi_cache_flush(interface.cache);
+    assert(count_shared() == 0);
+
+    avahi_record_unref(r);
+    avahi_record_unref(r6);
+
+    teardown();
+}
+
+/* Claim every record in the snapshot was received from an IPv6
+ * address, which doesn't fit into the IPv4 interface they are on */
+static void corrupt_origins(FILE *f) {
+    uint8_t d[256*1024];
+    size_t size, idx;
+
+    size = (size_t) pread(fileno(f), d, sizeof(d), 0);
+    assert(size > 12 && size < sizeof(d));
+
+    /* Skip the header, then walk the blocks */
+    for (idx = 12; idx < size;) {
+        unsigned n, k;
+        size_t psize;
+
+        idx += 2 + d[idx+1];
+        n = (unsigned) (d[idx] << 8 | d[idx+1]);
+        psize = (size_t) d[idx+2] << 24 | (size_t) d[idx+3] << 16 | (size_t) d[idx+4] << 8 | d[idx+5];
+        idx += 6 + psize;
+
+        for (k = 0; k < n; k++, idx += 17)
+            d[idx] = (uint8_t) AVAHI_PROTO_INET6;
+    }
+
+    assert(idx == size);
+    assert(pwrite(fileno(f), d, size, 0) == (ssize_t) size);
+}
+
+static void test_snapshot(AvahiSimplePoll *simple_poll) {
+    AvahiCacheEntry *e;
+    AvahiAddress a;
+    FILE *f;
+    unsigned i;
+
+    setup(simple_poll, 1000);
+
+    /* Only interfaces that are up are saved and loaded */
+    interface.announcing = 1;
+
+    for (i = 0; i < 500; i++)
+        add("host", i);
+
+    f = tmpfile();
+    assert(f);
+
+    assert(avahi_server_save_cache(&server, fileno(f)) == AVAHI_OK);
+
+    avahi_cache_flush(interface.cache);
+    assert(interface.cache->n_entries == 0);
+
+    assert(avahi_server_load_cache(&server, fileno(f)) == AVAHI_OK);
+    assert(interface.cache->n_entries == 500);
+
+    for (i = 0; i < 500; i++) {
+        e = find(interface.cache, "host", i);
+        assert(e);
+        assert(e->unverified);
+        assert(e->record->ttl <= AVAHI_DEFAULT_TTL && e->record->ttl >= AVAHI_DEFAULT_TTL - 2);
+        assert(e->record->data.a.address.address == htonl(0xc0a83200 + i));
+        avahi_cache_entry_get_origin(interface.cache, e, &a);
+        assert(avahi_address_cmp(&a, &origin) == 0);
+    }
+
+    /* Seeing it on the network confirms it */
+    add("host", 0);
+    e = find(interface.cache, "host", 0);
+    assert(e && !e->unverified);
+
+    /* Loading the snapshot again doesn't make it unverified again */
+    assert(avahi_server_load_cache(&server, fileno(f)) == AVAHI_OK);
+    e = find(interface.cache, "host", 0);
+    assert(e && !e->unverified);
+
+    /* Records whose origin doesn't match the interface are skipped */
+    corrupt_origins(f);
+    avahi_cache_flush(interface.cache);
+    assert(avahi_server_load_cache(&server, fileno(f)) == AVAHI_OK);
+    assert(interface.cache->n_entries == 0);
+
+    /* Snapshots of other interfaces are ignored */
+    hardware.name = (char*) "eth1";
+    avahi_cache_flush(interface.cache);
+    assert(avahi_server_load_cache(&server, fileno(f)) == AVAHI_OK);
+    assert(interface.cache->n_entries == 0);
+
+    /* And so is garbage */
+    assert(ftruncate(fileno(f), 0) == 0);
+    fprintf(f, "Not a cache snapshot");
+    fflush(f);
+    assert(avahi_server_load_cache(&server, fileno(f)) == AVAHI_ERR_INVALID_PACKET);
+
+    fclose(f);
+    teardown();
+}
+
+static void test_expiry(AvahiSimplePoll *simple_poll) {
+    struct timeval start;
+    unsigned i;
+
+    setup(simple_poll, 2000);
+
+    /* Records received together with the same TTL expire together,
+     * hence share a single time event */
+    for (i = 0; i < 1000; i++)
+        add("host", i);
+
+    assert(interface.cache->n_entries == 1000);
+    assert(interface.cache->n_buckets >= 1 && interface.cache->n_buckets <= 2);
+
+    for (i = 0; i < 10; i++)
+        add_to(interface.cache, "short", i, 1);
+
+    assert(interface.cache->n_entries == 1010);
+    assert(interface.cache->n_buckets <= 4);
+
+    /* Let the short lived records run through all expiry stages */
+    gettimeofday(&start, NULL);
+    while (interface.cache->n_entries > 1000) {
+        assert(avahi_age(&start) < 10000000);
+        avahi_simple_poll_iterate(simple_poll, -1);
+    }
+
+    assert(!cached("short", 0));
+    assert(cached("host", 0));
+    assert(interface.cache->n_buckets >= 1 && interface.cache->n_buckets <= 2);
+
+    teardown();
+}
+
+static void* count_callback(AVAHI_GCC_UNUSED AvahiCache *c, AVAHI_GCC_UNUSED AvahiKey *pattern, AVAHI_GCC_UNUSED AvahiCacheEntry *e, void* userdata) {
+    unsigned *n = userdata;
+
+    (*n)++;
+    return NULL;
+}
+
+static void benchmark_walk(AvahiSimplePoll *simple_poll, unsigned n_entries, unsigned n_walks) {
+    struct timeval start;
+    AvahiKey **keys;
+    unsigned i, n;
+
+    setup(simple_poll, n_entries);
+
+    printf("cache: entry size:       %8u bytes\n", (unsigned) sizeof(AvahiCacheEntry));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_entries; i++)
+        add("host", i);
+    printf("cache: add %u:           %8llu usec\n", n_entries, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_walks; i++) {
+        AvahiKey *k;
+        char name[64];
+
+        /* Like an ANY query, or POOF for a name */
+        snprintf(name, sizeof(name), "host-%u.local", (i * 7919) % n_entries);
+        k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY);
+
+        n = 0;
+        avahi_cache_walk(interface.cache, k, count_callback, &n);
+        assert(n == 1);
+
+        avahi_key_unref(k);
+    }
+    printf("cache: pattern walk %u:  %8llu usec\n", n_walks, (unsigned long long) avahi_age(&start));
+
+    keys = avahi_new(AvahiKey*, n_entries);
+    for (i = 0; i < n_entries; i++)
+        keys[i] = make_key("host", (i * 7919) % n_entries);
+
+    /* Like the known answer lookups for each outgoing question */
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_entries; i++) {
+        n = 0;
+        avahi_cache_walk(interface.cache, keys[i], count_callback, &n);
+        assert(n == 1);
+    }
+    printf("cache: lookup %u:       %8llu usec\n", n_entries, (unsigned long long) avahi_age(&start));
+
+    for (i = 0; i < n_entries; i++)
+        avahi_key_unref(keys[i]);
+    avahi_free(keys);
+
+    teardown();
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiSimplePoll *simple_poll;
+
+    simple_poll = avahi_simple_poll_new();
+
+    test_lru(simple_poll);
+    test_subscribed(simple_poll);
+    test_shared(simple_poll);
+    test_snapshot(simple_poll);
+    test_expiry(simple_poll);
+
+    benchmark_walk(simple_poll, 50000, 1000);
+
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
@@ -21,16 +21,199 @@
 #include <config.h>
 #endif
 
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <time.h>
 
 #include <avahi-common/timeval.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/domain.h>
 
 #include "cache.h"
 #include "log.h"
 #include "rr-util.h"
+#include "querier.h"
+#include "util.h"
+
+/* How many entries at the cold end of the LRU list we look at when
+ * searching for one nobody is interested in */
+#define AVAHI_CACHE_EVICT_SCAN 16
+
+/* The width of the time slots entry expiries are rounded up to. All
+ * entries expiring in the same slot share one time event, and the
+ * refresh queries they trigger are posted together, so that the
+ * query scheduler packs them into the same packet. */
+#define AVAHI_CACHE_EXPIRY_SLOT_MSEC 1000
+
+struct AvahiCacheBucket {
+    AvahiCache *cache;
+    uint64_t slot;
+    AvahiTimeEvent *time_event;
+
+    AVAHI_LLIST_HEAD(AvahiCacheEntry, entries);
+};
+
+/* An entry in the server wide table of shared records. The records
+ * are hash-consed including the TTL, so that a shared record is
+ * indistinguishable from the one we received. */
+typedef struct AvahiSharedRecord {
+    AvahiRecord *record;
+    unsigned n_used;
+} AvahiSharedRecord;
+
+static int shared_record_equal(const AvahiRecord *a, const AvahiRecord *b) {
+    return a->ttl == b->ttl && avahi_record_equal_no_ttl(a, b);
+}
+
+AvahiHashmap *avahi_cache_shared_records_new(void) {
+    return avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) shared_record_equal, NULL, NULL);
+}
+
+static AvahiRecord *record_share(AvahiCache *c, AvahiRecord *r) {
+    AvahiSharedRecord *sr;
+
+    assert(c);
+    assert(r);
+
+    if (!c->server->cache_records)
+        return avahi_record_ref(r);
+
+    if ((sr = avahi_hashmap_lookup(c->server->cache_records, r))) {
+        sr->n_used++;
+        return avahi_record_ref(sr->record);
+    }
+
+    /* If we're out of memory we simply don't share this one */
+    if (!(sr = avahi_new(AvahiSharedRecord, 1)))
+        return avahi_record_ref(r);
+
+    sr->record = avahi_record_ref(r);
+    sr->n_used = 1;
+
+    if (avahi_hashmap_insert(c->server->cache_records, sr->record, sr) < 0) {
+        avahi_record_unref(sr->record);
+        avahi_free(sr);
+    }
+
+    return avahi_record_ref(r);
+}
+
+static void record_unshare(AvahiCache *c, AvahiRecord *r) {
+    AvahiSharedRecord *sr;
+
+    assert(c);
+    assert(r);
+
+    if (c->server->cache_records &&
+        (sr = avahi_hashmap_lookup(c->server->cache_records, r)) &&
+        sr->record == r) {
+
+        assert(sr->n_used >= 1);
+
+        if (--sr->n_used <= 0) {
+            avahi_hashmap_remove(c->server->cache_records, r);
+            avahi_record_unref(sr->record);
+            avahi_free(sr);
+        }
+    }
+
+    avahi_record_unref(r);
+}
+
+static size_t address_size(AvahiCache *c) {
+    assert(c);
+
+    return c->interface->protocol == AVAHI_PROTO_INET6 ? sizeof(AvahiIPv6Address) : sizeof(AvahiIPv4Address);
+}
+
+static void address_pack(AvahiCache *c, AvahiCacheAddress *dst, const AvahiAddress *a) {
+    assert(c);
+    assert(dst);
+    assert(a);
+    assert(a->proto == c->interface->protocol);
+
+    memset(dst, 0, sizeof(*dst));
+    memcpy(dst, &a->data, address_size(c));
+}
+
+static int address_equal(AvahiCache *c, const AvahiCacheAddress *packed, const AvahiAddress *a) {
+    assert(c);
+    assert(packed);
+    assert(a);
+
+    return a->proto == c->interface->protocol && memcmp(packed, &a->data, address_size(c)) == 0;
+}
+
+static void lru_prepend(AvahiCache *c, AvahiCacheEntry *e) {
+    assert(c);
+    assert(e);
+
+    AVAHI_LLIST_PREPEND(AvahiCacheEntry, lru, c->lru, e);
+
+    if (!c->lru_tail)
+        c->lru_tail = e;
+}
+
+static void lru_remove(AvahiCache *c, AvahiCacheEntry *e) {
+    assert(c);
+    assert(e);
+
+    if (c->lru_tail == e)
+        c->lru_tail = e->lru_prev;
+
+    AVAHI_LLIST_REMOVE(AvahiCacheEntry, lru, c->lru, e);
+}
+
+static void lru_touch(AvahiCache *c, AvahiCacheEntry *e) {
+    assert(c);
+    assert(e);
+
+    if (c->lru == e)
+        return;
+
+    lru_remove(c, e);
+    lru_prepend(c, e);
+}
+
+static unsigned slot_hash(const uint64_t *slot) {
+    return (unsigned) (*slot ^ (*slot >> 32));
+}
+
+static int slot_equal(const uint64_t *a, const uint64_t *b) {
+    return *a == *b;
+}
+
+static void bucket_free(AvahiCache *c, AvahiCacheBucket *b) {
+    assert(c);
+    assert(b);
+    assert(!b->entries);
+
+    avahi_hashmap_remove(c->buckets, &b->slot);
+    avahi_time_event_free(b->time_event);
+    avahi_free(b);
+
+    assert(c->n_buckets >= 1);
+    --c->n_buckets;
+}
+
+static void entry_unschedule(AvahiCache *c, AvahiCacheEntry *e) {
+    AvahiCacheBucket *b;
+
+    assert(c);
+    assert(e);
+
+    if (!(b = e->bucket))
+        return;
+
+    AVAHI_LLIST_REMOVE(AvahiCacheEntry, bucket, b->entries, e);
+    e->bucket = NULL;
+
+    /* A bucket that is currently being run has already been removed
+     * from the table, bucket_elapse_func() frees it itself */
+    if (!b->entries && avahi_hashmap_lookup(c->buckets, &b->slot) == b)
+        bucket_free(c, b);
+}
 
 static void remove_entry(AvahiCache *c, AvahiCacheEntry *e) {
     AvahiCacheEntry *t;
@@ -48,17 +231,24 @@ static void remove_entry(AvahiCache *c, AvahiCacheEntry *e) {
     else
         avahi_hashmap_remove(c->hashmap, e->record->key);
 
-    /* Remove from linked list */
-    AVAHI_LLIST_REMOVE(AvahiCacheEntry, entry, c->entries, e);
+    /* Remove from name index */
+    t = avahi_hashmap_lookup(c->by_name, e->record->key);
+    AVAHI_LLIST_REMOVE(AvahiCacheEntry, by_name, t, e);
+    if (t)
+        avahi_hashmap_replace(c->by_name, t->record->key, t);
+    else
+        avahi_hashmap_remove(c->by_name, e->record->key);
+
+    /* Remove from linked lists */
+    lru_remove(c, e);
 
-    if (e->time_event)
-        avahi_time_event_free(e->time_event);
+    entry_unschedule(c, e);
 
     avahi_multicast_lookup_engine_notify(c->server->multicast_lookup_engine, c->interface, e->record, AVAHI_BROWSER_REMOVE);
 
-    avahi_record_unref(e->record);
+    record_unshare(c, e->record);
 
-    avahi_free(e);
+    avahi_pool_release(c->server->cache_entry_pool, e);
 
     assert(c->n_entries >= 1);
     --c->n_entries;
@@ -68,7 +258,7 @@ AvahiCache *avahi_cache_new(AvahiServer *server, AvahiInterface *iface) {
     AvahiCache *c;
     assert(server);
 
-    if (!(c = avahi_new(AvahiCache, 1))) {
+    if (!(c = avahi_new0(AvahiCache, 1))) {
         avahi_log_error(__FILE__": Out of memory.");
         return NULL; /* OOM */
     }
@@ -82,8 +272,25 @@ AvahiCache *avahi_cache_new(AvahiServer *server, AvahiInterface *iface) {
         return NULL; /* OOM */
     }
 
-    AVAHI_LLIST_HEAD_INIT(AvahiCacheEntry, c->entries);
+    if (!(c->by_name = avahi_hashmap_new((AvahiHashFunc) avahi_key_name_hash, (AvahiEqualFunc) avahi_key_name_equal, NULL, NULL))) {
+        avahi_log_error(__FILE__": Out of memory.");
+        avahi_hashmap_free(c->hashmap);
+        avahi_free(c);
+        return NULL; /* OOM */
+    }
+
+    if (!(c->buckets = avahi_hashmap_new((AvahiHashFunc) slot_hash, (AvahiEqualFunc) slot_equal, NULL, NULL))) {
+        avahi_log_error(__FILE__": Out of memory.");
+        avahi_hashmap_free(c->hashmap);
+        avahi_hashmap_free(c->by_name);
+        avahi_free(c);
+        return NULL; /* OOM */
+    }
+
+    AVAHI_LLIST_HEAD_INIT(AvahiCacheEntry, c->lru);
+    c->lru_tail = NULL;
     c->n_entries = 0;
+    c->n_buckets = 0;
 
     c->last_rand_timestamp = 0;
 
@@ -93,11 +300,14 @@ AvahiCache *avahi_cache_new(AvahiServer *server, AvahiInterface *iface) {
 void avahi_cache_free(AvahiCache *c) {
     assert(c);
 
-    while (c->entries)
-        remove_entry(c, c->entries);
+    while (c->lru)
+        remove_entry(c, c->lru);
     assert(c->n_entries == 0);
+    assert(c->n_buckets == 0);
 
     avahi_hashmap_free(c->hashmap);
+    avahi_hashmap_free(c->by_name);
+    avahi_hashmap_free(c->buckets);
 
     avahi_free(c);
 }
@@ -121,12 +331,17 @@ void* avahi_cache_walk(AvahiCache *c, AvahiKey *pattern, AvahiCacheWalkCallback
     if (avahi_key_is_pattern(pattern)) {
         AvahiCacheEntry *e, *n;
 
-        for (e = c->entries; e; e = n) {
-            n = e->entry_next;
+        /* Patterns only match on type and class, so we only need to
+         * look at the entries with a matching name */
+        for (e = avahi_hashmap_lookup(c->by_name, pattern); e; e = n) {
+            n = e->by_name_next;
+
+            if (avahi_key_pattern_match(pattern, e->record->key)) {
+                lru_touch(c, e);
 
-            if (avahi_key_pattern_match(pattern, e->record->key))
                 if ((ret = cb(c, pattern, e, userdata)))
                     return ret;
+            }
         }
 
     } else {
@@ -135,6 +350,8 @@ void* avahi_cache_walk(AvahiCache *c, AvahiKey *pattern, AvahiCacheWalkCallback
         for (e = lookup_key(c, pattern); e; e = n) {
             n = e->by_key_next;
 
+            lru_touch(c, e);
+
             if ((ret = cb(c, pattern, e, userdata)))
                 return ret;
         }
@@ -143,32 +360,27 @@ void* avahi_cache_walk(AvahiCache *c, AvahiKey *pattern, AvahiCacheWalkCallback
     return NULL;
 }
 
-static void* lookup_record_callback(AvahiCache *c, AvahiKey *pattern, AvahiCacheEntry *e, void *userdata) {
-    assert(c);
-    assert(pattern);
-    assert(e);
-
-    if (avahi_record_equal_no_ttl(e->record, userdata))
-        return e;
-
-    return NULL;
-}
-
 static AvahiCacheEntry *lookup_record(AvahiCache *c, AvahiRecord *r) {
+    AvahiCacheEntry *e;
+
     assert(c);
     assert(r);
 
-    return avahi_cache_walk(c, r->key, lookup_record_callback, r);
+    /* Unlike avahi_cache_walk() this doesn't count as a hit */
+    for (e = lookup_key(c, r->key); e; e = e->by_key_next)
+        if (avahi_record_equal_no_ttl(e->record, r))
+            return e;
+
+    return NULL;
 }
 
 static void next_expiry(AvahiCache *c, AvahiCacheEntry *e, unsigned percent);
 
-static void elapse_func(AvahiTimeEvent *t, void *userdata) {
-    AvahiCacheEntry *e = userdata;
+static void elapse_entry(AvahiCache *c, AvahiCacheEntry *e) {
 /*     char *txt; */
     unsigned percent = 0;
 
-    assert(t);
+    assert(c);
     assert(e);
 
 /*     txt = avahi_record_to_string(e->record); */
@@ -180,7 +392,7 @@ static void elapse_func(AvahiTimeEvent *t, void *userdata) {
         case AVAHI_CACHE_GOODBYE_FINAL:
         case AVAHI_CACHE_REPLACE_FINAL:
 
-            remove_entry(e->cache, e);
+            remove_entry(c, e);
 
             e = NULL;
 /*         avahi_log_debug("Removing entry from cache due to expiration (%s)", txt); */
@@ -212,39 +424,113 @@ static void elapse_func(AvahiTimeEvent *t, void *userdata) {
         assert(percent > 0);
 
         /* Request a cache update if we are subscribed to this entry */
-        if (avahi_querier_shall_refresh_cache(e->cache->interface, e->record->key))
-            avahi_interface_post_query(e->cache->interface, e->record->key, 0, NULL);
+        if (avahi_querier_shall_refresh_cache(c->interface, e->record->key))
+            avahi_interface_post_query(c->interface, e->record->key, 0, NULL);
 
         /* Check again later */
-        next_expiry(e->cache, e, percent);
+        next_expiry(c, e, percent);
 
     }
 
 /*     avahi_free(txt); */
 }
 
+static void bucket_elapse_func(AvahiTimeEvent *t, void *userdata) {
+    AvahiCacheBucket *b = userdata;
+    AvahiCache *c;
+    AvahiCacheEntry *e;
+
+    assert(t);
+    assert(b);
+
+    c = b->cache;
+
+    /* Entries that are rescheduled into this very slot while we are
+     * running get a new bucket */
+    avahi_hashmap_remove(c->buckets, &b->slot);
+
+    while ((e = b->entries)) {
+        AVAHI_LLIST_REMOVE(AvahiCacheEntry, bucket, b->entries, e);
+        e->bucket = NULL;
+
+        elapse_entry(c, e);
+    }
+
+    avahi_time_event_free(b->time_event);
+    avahi_free(b);
+
+    assert(c->n_buckets >= 1);
+    --c->n_buckets;
+}
+
+static AvahiCacheBucket *bucket_new(AvahiCache *c, uint64_t slot) {
+    AvahiCacheBucket *b;
+    uint64_t when, now;
+    struct timeval tv;
+
+    assert(c);
+
+    if (!(b = avahi_new(AvahiCacheBucket, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    b->cache = c;
+    b->slot = slot;
+    AVAHI_LLIST_HEAD_INIT(AvahiCacheEntry, b->entries);
+
+    /* The time event queue runs on the system time */
+    when = slot * AVAHI_CACHE_EXPIRY_SLOT_MSEC;
+    now = avahi_monotonic_msec();
+    avahi_elapse_time(&tv, when > now ? (unsigned) (when - now) : 0, 0);
+
+    if (!(b->time_event = avahi_time_event_new(c->server->time_event_queue, &tv, bucket_elapse_func, b))) {
+        avahi_log_error(__FILE__": Out of memory");
+        avahi_free(b);
+        return NULL;
+    }
+
+    avahi_hashmap_insert(c->buckets, &b->slot, b);
+    c->n_buckets++;
+
+    return b;
+}
+
 static void update_time_event(AvahiCache *c, AvahiCacheEntry *e) {
+    AvahiCacheBucket *b;
+    uint64_t slot;
+
     assert(c);
     assert(e);
 
-    if (e->time_event)
-        avahi_time_event_update(e->time_event, &e->expiry);
-    else
-        e->time_event = avahi_time_event_new(c->server->time_event_queue, &e->expiry, elapse_func, e);
+    /* Round up, so that we never refresh or expire early */
+    slot = (e->expiry + AVAHI_CACHE_EXPIRY_SLOT_MSEC - 1) / AVAHI_CACHE_EXPIRY_SLOT_MSEC;
+
+    if (e->bucket && e->bucket->slot == slot)
+        return;
+
+    entry_unschedule(c, e);
+
+    if (!(b = avahi_hashmap_lookup(c->buckets, &slot)))
+        if (!(b = bucket_new(c, slot)))
+            return; /* OOM */
+
+    AVAHI_LLIST_PREPEND(AvahiCacheEntry, bucket, b->entries, e);
+    e->bucket = b;
 }
 
 static void next_expiry(AvahiCache *c, AvahiCacheEntry *e, unsigned percent) {
-    AvahiUsec usec, left, right;
+    uint64_t msec, left, right;
     time_t now;
 
     assert(c);
     assert(e);
     assert(percent > 0 && percent <= 100);
 
-    usec = (AvahiUsec) e->record->ttl * 10000;
+    msec = (uint64_t) e->record->ttl * 10;
 
-    left = usec * percent;
-    right = usec * (percent+2); /* 2% jitter */
+    left = msec * percent;
+    right = msec * (percent+2); /* 2% jitter */
 
     now = time(NULL);
 
@@ -253,12 +539,11 @@ static void next_expiry(AvahiCache *c, AvahiCacheEntry *e, unsigned percent) {
         c->last_rand_timestamp = now;
     }
 
-    usec = left + (AvahiUsec) ((double) (right-left) * c->last_rand / (RAND_MAX+1.0));
+    msec = left + (uint64_t) ((double) (right-left) * c->last_rand / (RAND_MAX+1.0));
 
-    e->expiry = e->timestamp;
-    avahi_timeval_add(&e->expiry, usec);
+    e->expiry = e->timestamp + msec;
 
-/*     g_message("wake up in +%lu seconds", e->expiry.tv_sec - e->timestamp.tv_sec); */
+/*     g_message("wake up in +%lu seconds", (e->expiry - e->timestamp) / 1000); */
 
     update_time_event(c, e);
 }
@@ -268,11 +553,55 @@ static void expire_in_one_second(AvahiCache *c, AvahiCacheEntry *e, AvahiCacheEn
     assert(e);
 
     e->state = state;
-    gettimeofday(&e->expiry, NULL);
-    avahi_timeval_add(&e->expiry, 1000000); /* 1s */
+    e->expiry = avahi_monotonic_msec() + 1000; /* 1s */
     update_time_event(c, e);
 }
 
+static int entry_is_wanted(AvahiCache *c, AvahiCacheEntry *e) {
+    assert(c);
+    assert(e);
+
+    /* Entries that are about to go away anyway are not worth keeping */
+    if (e->state == AVAHI_CACHE_EXPIRY_FINAL ||
+        e->state == AVAHI_CACHE_POOF_FINAL ||
+        e->state == AVAHI_CACHE_GOODBYE_FINAL ||
+        e->state == AVAHI_CACHE_REPLACE_FINAL)
+        return 0;
+
+    return avahi_querier_is_subscribed(c->interface, e->record->key);
+}
+
+static int make_room(AvahiCache *c, AvahiRecord *r) {
+    AvahiCacheEntry *e;
+    unsigned n;
+
+    assert(c);
+    assert(r);
+
+    /* Look for the least recently hit entry nobody is interested
+     * in. We only look at the cold end of the list, to keep this
+     * O(1). */
+    for (e = c->lru_tail, n = 0; e && n < AVAHI_CACHE_EVICT_SCAN; e = e->lru_prev, n++)
+        if (!entry_is_wanted(c, e))
+            break;
+
+    if (!e || n >= AVAHI_CACHE_EVICT_SCAN) {
+
+        /* All candidates are being browsed for. Replace the least
+         * recently hit one of them only if the new record is
+         * interesting as well. */
+        if (!c->lru_tail || !avahi_querier_is_subscribed(c->interface, r->key))
+            return 0;
+
+        e = c->lru_tail;
+    }
+
+    remove_entry(c, e);
+    c->n_evicted++;
+
+    return 1;
+}
+
 void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const AvahiAddress *a) {
 /*     char *txt; */
 
@@ -290,10 +619,10 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
             expire_in_one_second(c, e, AVAHI_CACHE_GOODBYE_FINAL);
 
     } else {
-        AvahiCacheEntry *e = NULL, *first;
-        struct timeval now;
+        AvahiCacheEntry *e = NULL, *first, *first_by_name;
+        uint64_t now;
 
-        gettimeofday(&now, NULL);
+        now = avahi_monotonic_msec();
 
         /* This is an update request */
 
@@ -302,14 +631,9 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
             if (cache_flush) {
 
                 /* For unique entries drop all entries older than one second */
-                for (e = first; e; e = e->by_key_next) {
-                    AvahiUsec t;
-
-                    t = avahi_timeval_diff(&now, &e->timestamp);
-
-                    if (t > 1000000)
+                for (e = first; e; e = e->by_key_next)
+                    if (now - e->timestamp > 1000)
                         expire_in_one_second(c, e, AVAHI_CACHE_REPLACE_FINAL);
-                }
             }
 
             /* Look for exactly the same entry */
@@ -322,14 +646,19 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
 
 /*             avahi_log_debug("found matching cache entry");  */
 
-            /* We need to update the hash table key if we replace the
+            AvahiRecord *old = e->record;
+
+            /* Update the record */
+            e->record = record_share(c, r);
+
+            /* We need to update the hash table keys if we replace the
              * record */
             if (e->by_key_prev == NULL)
-                avahi_hashmap_replace(c->hashmap, r->key, e);
+                avahi_hashmap_replace(c->hashmap, e->record->key, e);
+            if (e->by_name_prev == NULL)
+                avahi_hashmap_replace(c->by_name, e->record->key, e);
 
-            /* Update the record */
-            avahi_record_unref(e->record);
-            e->record = avahi_record_ref(r);
+            record_unshare(c, old);
 
 /*             avahi_log_debug("cache: updating %s", txt);   */
 
@@ -338,24 +667,35 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
 
 /*             avahi_log_debug("cache: couldn't find matching cache entry for %s", txt);   */
 
-            if (c->n_entries >= c->server->config.n_cache_entries_max)
-                return;
+            if (c->n_entries >= c->server->config.n_cache_entries_max) {
 
-            if (!(e = avahi_new(AvahiCacheEntry, 1))) {
+                if (!make_room(c, r)) {
+                    c->n_rejected++;
+                    return;
+                }
+
+                /* We might have removed the head of our chain */
+                first = lookup_key(c, r->key);
+            }
+
+            if (!(e = avahi_pool_alloc(c->server->cache_entry_pool))) {
                 avahi_log_error(__FILE__": Out of memory");
                 return;
             }
 
-            e->cache = c;
-            e->time_event = NULL;
-            e->record = avahi_record_ref(r);
+            e->bucket = NULL;
+            e->record = record_share(c, r);
 
-            /* Append to hash table */
+            /* Append to hash tables */
             AVAHI_LLIST_PREPEND(AvahiCacheEntry, by_key, first, e);
             avahi_hashmap_replace(c->hashmap, e->record->key, first);
 
-            /* Append to linked list */
-            AVAHI_LLIST_PREPEND(AvahiCacheEntry, entry, c->entries, e);
+            first_by_name = avahi_hashmap_lookup(c->by_name, e->record->key);
+            AVAHI_LLIST_PREPEND(AvahiCacheEntry, by_name, first_by_name, e);
+            avahi_hashmap_replace(c->by_name, e->record->key, first_by_name);
+
+            /* Append to linked lists */
+            lru_prepend(c, e);
 
             c->n_entries++;
 
@@ -363,16 +703,34 @@ void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const Av
             avahi_multicast_lookup_engine_notify(c->server->multicast_lookup_engine, c->interface, e->record, AVAHI_BROWSER_NEW);
         }
 
-        e->origin = *a;
+        address_pack(c, &e->origin, a);
         e->timestamp = now;
         next_expiry(c, e, 80);
         e->state = AVAHI_CACHE_VALID;
         e->cache_flush = cache_flush;
+        e->unverified = 0;
     }
 
 /*     avahi_free(txt);  */
 }
 
+void avahi_cache_add_unverified(AvahiCache *c, AvahiRecord *r, int cache_flush, const AvahiAddress *a) {
+    AvahiCacheEntry *e;
+
+    assert(c);
+    assert(r && r->ref >= 1);
+    assert(r->ttl > 0);
+
+    /* Don't touch what we have seen on the network already */
+    if ((e = lookup_record(c, r)) && !e->unverified)
+        return;
+
+    avahi_cache_update(c, r, cache_flush, a);
+
+    if ((e = lookup_record(c, r)))
+        e->unverified = 1;
+}
+
 struct dump_data {
     AvahiDumpCallback callback;
     void* userdata;
@@ -400,6 +758,7 @@ static void dump_callback(void* key, void* data, void* userdata) {
 
 int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata) {
     struct dump_data data;
+    char ln[256];
 
     assert(c);
     assert(callback);
@@ -411,44 +770,53 @@ int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata)
 
     avahi_hashmap_foreach(c->hashmap, dump_callback, &data);
 
+    snprintf(ln, sizeof(ln), ";;; CACHE: %u entries of %u bytes, %u evicted, %u rejected ;;;", c->n_entries, (unsigned) sizeof(AvahiCacheEntry), c->n_evicted, c->n_rejected);
+    callback(ln, userdata);
+
     return 0;
 }
 
 int avahi_cache_entry_half_ttl(AvahiCache *c, AvahiCacheEntry *e) {
-    struct timeval now;
     unsigned age;
 
     assert(c);
     assert(e);
 
-    gettimeofday(&now, NULL);
-
-    age = (unsigned) (avahi_timeval_diff(&now, &e->timestamp)/1000000);
+    age = (unsigned) ((avahi_monotonic_msec() - e->timestamp)/1000);
 
 /*     avahi_log_debug("age: %lli, ttl/2: %u", age, e->record->ttl);  */
 
     return age >= e->record->ttl/2;
 }
 
+void avahi_cache_entry_get_origin(AvahiCache *c, AvahiCacheEntry *e, AvahiAddress *ret_address) {
+    assert(c);
+    assert(e);
+    assert(ret_address);
+
+    ret_address->proto = c->interface->protocol;
+    memcpy(&ret_address->data, &e->origin, address_size(c));
+}
+
 void avahi_cache_flush(AvahiCache *c) {
     assert(c);
 
-    while (c->entries)
-        remove_entry(c, c->entries);
+    while (c->lru)
+        remove_entry(c, c->lru);
 }
 
 /*** Passive observation of failure ***/
 
 static void* start_poof_callback(AvahiCache *c, AvahiKey *pattern, AvahiCacheEntry *e, void *userdata) {
     AvahiAddress *a = userdata;
-    struct timeval now;
+    uint64_t now;
 
     assert(c);
     assert(pattern);
     assert(e);
     assert(a);
 
-    gettimeofday(&now, NULL);
+    now = avahi_monotonic_msec();
 
     switch (e->state) {
         case AVAHI_CACHE_VALID:
@@ -457,18 +825,18 @@ static void* start_poof_callback(AvahiCache *c, AvahiKey *pattern, AvahiCacheEnt
              * POOF mode */
 
             e->state = AVAHI_CACHE_POOF;
-            e->poof_address = *a;
+            address_pack(c, &e->poof_address, a);
             e->poof_timestamp = now;
             e->poof_num = 0;
 
             break;
 
         case AVAHI_CACHE_POOF:
-            if (avahi_timeval_diff(&now, &e->poof_timestamp) < 1000000)
+            if (now - e->poof_timestamp < 1000)
               break;
 
             e->poof_timestamp = now;
-            e->poof_address = *a;
+            address_pack(c, &e->poof_address, a);
             e->poof_num ++;
 
             /* This is the 4th time we got no response, so let's
@@ -506,8 +874,21 @@ void avahi_cache_stop_poof(AvahiCache *c, AvahiRecord *record, const AvahiAddres
        query address is the same, we put it back into valid mode */
 
     if (e->state == AVAHI_CACHE_POOF || e->state == AVAHI_CACHE_POOF_FINAL)
-        if (avahi_address_cmp(a, &e->poof_address) == 0) {
+        if (address_equal(c, &e->poof_address, a)) {
             e->state = AVAHI_CACHE_VALID;
             next_expiry(c, e, 80);
         }
 }
+
+int avahi_cache_is_poofing(AvahiCache *c, AvahiKey *key) {
+    AvahiCacheEntry *e;
+
+    assert(c);
+    assert(key);
+
+    for (e = lookup_key(c, key); e; e = e->by_key_next)
+        if (e->state == AVAHI_CACHE_POOF || e->state == AVAHI_CACHE_POOF_FINAL)
+            return 1;
+
+    return 0;
+}
@@ -41,25 +41,38 @@ typedef enum {
 } AvahiCacheEntryState;
 
 typedef struct AvahiCacheEntry AvahiCacheEntry;
+typedef struct AvahiCacheBucket AvahiCacheBucket;
+
+/* A cache only holds records received on one interface, hence the
+ * protocol of the addresses we store is implied by the cache */
+typedef union AvahiCacheAddress {
+    AvahiIPv6Address ipv6;
+    AvahiIPv4Address ipv4;
+} AvahiCacheAddress;
 
 struct AvahiCacheEntry {
-    AvahiCache *cache;
     AvahiRecord *record;
-    struct timeval timestamp;
-    struct timeval poof_timestamp;
-    struct timeval expiry;
-    int cache_flush;
-    int poof_num;
 
-    AvahiAddress origin;
+    /* The expiry bucket this entry is waiting in, if any */
+    AvahiCacheBucket *bucket;
+
+    /* Milliseconds, see avahi_monotonic_msec() */
+    uint64_t timestamp;
+    uint64_t poof_timestamp;
+    uint64_t expiry;
 
-    AvahiCacheEntryState state;
-    AvahiTimeEvent *time_event;
+    AvahiCacheAddress origin;
+    AvahiCacheAddress poof_address;
 
-    AvahiAddress poof_address;
+    unsigned state:4; /* AvahiCacheEntryState */
+    unsigned cache_flush:1;
+    unsigned poof_num:3;
+    unsigned unverified:1; /* Loaded from a cache snapshot and not seen on the network since */
 
     AVAHI_LLIST_FIELDS(AvahiCacheEntry, by_key);
-    AVAHI_LLIST_FIELDS(AvahiCacheEntry, entry);
+    AVAHI_LLIST_FIELDS(AvahiCacheEntry, by_name);
+    AVAHI_LLIST_FIELDS(AvahiCacheEntry, lru);
+    AVAHI_LLIST_FIELDS(AvahiCacheEntry, bucket);
 };
 
 struct AvahiCache {
@@ -69,10 +82,25 @@ struct AvahiCache {
 
     AvahiHashmap *hashmap;
 
-    AVAHI_LLIST_HEAD(AvahiCacheEntry, entries);
+    /* Entries of all types and classes, by name, for pattern walks */
+    AvahiHashmap *by_name;
+
+    /* All entries, most recently hit first */
+    AVAHI_LLIST_HEAD(AvahiCacheEntry, lru);
+    AvahiCacheEntry *lru_tail;
 
     unsigned n_entries;
 
+    /* Entries whose expiry falls into the same time slot share a
+     * single time event, by slot */
+    AvahiHashmap *buckets;
+    unsigned n_buckets;
+
+    /* Number of entries evicted to make room for new ones, and of
+     * new entries dropped because the cache was full */
+    unsigned n_evicted;
+    unsigned n_rejected;
+
     int last_rand;
     time_t last_rand_timestamp;
 };
@@ -82,6 +110,11 @@ void avahi_cache_free(AvahiCache *c);
 
 void avahi_cache_update(AvahiCache *c, AvahiRecord *r, int cache_flush, const AvahiAddress *a);
 
+/* Like avahi_cache_update(), but for records that were not received
+ * from the network, e.g. loaded from a cache snapshot. They are not
+ * used for known answer suppression until they are confirmed. */
+void avahi_cache_add_unverified(AvahiCache *c, AvahiRecord *r, int cache_flush, const AvahiAddress *a);
+
 int avahi_cache_dump(AvahiCache *c, AvahiDumpCallback callback, void* userdata);
 
 typedef void* AvahiCacheWalkCallback(AvahiCache *c, AvahiKey *pattern, AvahiCacheEntry *e, void* userdata);
@@ -89,6 +122,9 @@ void* avahi_cache_walk(AvahiCache *c, AvahiKey *pattern, AvahiCacheWalkCallback
 
 int avahi_cache_entry_half_ttl(AvahiCache *c, AvahiCacheEntry *e);
 
+/* Return the address we received the entry from */
+void avahi_cache_entry_get_origin(AvahiCache *c, AvahiCacheEntry *e, AvahiAddress *ret_address);
+
 /** Start the "Passive observation of Failure" algorithm for all
  * records of the specified key. The specified address is  */
 void avahi_cache_start_poof(AvahiCache *c, AvahiKey *key, const AvahiAddress *a);
@@ -96,6 +132,12 @@ void avahi_cache_start_poof(AvahiCache *c, AvahiKey *key, const AvahiAddress *a)
 /* Stop a previously started POOF algorithm for a record. (Used for response suppression records */
 void avahi_cache_stop_poof(AvahiCache *c, AvahiRecord *record, const AvahiAddress *a);
 
+/* Returns non-zero if a record of the specified key is in POOF state */
+int avahi_cache_is_poofing(AvahiCache *c, AvahiKey *key);
+
 void avahi_cache_flush(AvahiCache *c);
 
+/* Create the server wide table of records shared between the caches */
+AvahiHashmap *avahi_cache_shared_records_new(void);
+
 #endif
@@ -70,6 +70,11 @@ typedef struct AvahiServerConfig {
     unsigned n_cache_entries_max;     /**< Maximum number of cache entries per interface */
     AvahiUsec ratelimit_interval;     /**< If non-zero, rate-limiting interval parameter. */
     unsigned ratelimit_burst;         /**< If ratelimit_interval is non-zero, rate-limiting burst parameter. */
+    int use_timer_wheel;              /**< Schedule timeouts on a hierarchical timing wheel instead of a priority queue. This runs all events due within the same millisecond in a single main loop wakeup. */
+    AvahiUsec timer_slack;            /**< When waking up for a timeout, also handle all timeouts that are due within this many microseconds. */
+    unsigned recv_batch_size;         /**< Read up to this many packets from the multicast sockets per wakeup, with a single system call where available. 0 or 1 reads one packet per wakeup. */
+    unsigned send_batch_size;         /**< Collect outgoing packets during a main loop iteration and send up to this many at once, with a single system call where available. 0 or 1 sends every packet right away. */
+    int share_cache_records;          /**< Keep only one copy of identical records received on several interfaces, e.g. on the IPv4 and IPv6 interface of a dual-stack link, instead of one per interface cache */
 } AvahiServerConfig;
 
 /** Allocate a new mDNS responder object. */
@@ -146,6 +151,20 @@ typedef void (*AvahiDumpCallback)(const char *text, void* userdata);
 /** Dump the current server status by calling "callback" for each line.  */
 int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata);
 
+/** Replace the contents of the file "fd" with a snapshot of the
+ * record caches of all interfaces, for use with
+ * avahi_server_load_cache() after a restart. \since 0.9 */
+int avahi_server_save_cache(AvahiServer *s, int fd);
+
+/** Load a cache snapshot written by avahi_server_save_cache() into
+ * the caches of the interfaces with the same names. The remaining
+ * TTLs of the records are reduced by the time passed since the
+ * snapshot was written. The records are passed to browsers right
+ * away, but are not used for known answer suppression until they
+ * have been seen on the network again. An empty file is
+ * ignored. \since 0.9 */
+int avahi_server_load_cache(AvahiServer *s, int fd);
+
 /** Return the last error code */
 int avahi_server_errno(AvahiServer *s);
 
@@ -22,6 +22,8 @@
 #endif
 
 #include <assert.h>
+#include <stdio.h>
+#include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -41,6 +43,9 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     const char *a, *b, *c, *d;
     AvahiDnsPacket *p;
     AvahiRecord *r, *r2;
+    AvahiKey *k, *k2;
+    AvahiKeyTable *kt;
+    AvahiRecordView v;
     uint8_t rdata[AVAHI_DNS_RDATA_MAX];
     size_t l;
     int res;
@@ -187,5 +192,104 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     avahi_free(m);
     avahi_record_unref(r);
 
+    /* KEY INTERNING */
+
+    kt = avahi_key_table_new();
+    assert(kt);
+
+    p = avahi_dns_packet_new(0);
+    p->key_table = kt;
+
+    k = avahi_key_new("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR);
+    assert(avahi_dns_packet_append_key(p, k, 0));
+    assert(avahi_dns_packet_append_key(p, k, 1));
+    avahi_key_unref(k);
+
+    k = avahi_key_new("_HTTP._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR);
+    assert(avahi_dns_packet_append_key(p, k, 0));
+    avahi_key_unref(k);
+
+    r = avahi_record_new_full("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL);
+    r->data.ptr.name = avahi_strdup("Test._http._tcp.local");
+    assert(avahi_dns_packet_append_record(p, r, 0, 0));
+    avahi_record_unref(r);
+
+    k = avahi_dns_packet_consume_key(p, NULL);
+    k2 = avahi_dns_packet_consume_key(p, NULL);
+    assert(k && k == k2);
+    avahi_key_unref(k2);
+
+    /* Interning doesn't change the case of names */
+    k2 = avahi_dns_packet_consume_key(p, NULL);
+    assert(k2 && k2 != k);
+    assert(strcmp(k2->name, "_HTTP._tcp.local") == 0);
+    avahi_key_unref(k2);
+
+    r = avahi_dns_packet_consume_record(p, NULL);
+    assert(r && r->key == k);
+
+    avahi_dns_packet_free(p);
+
+    /* Keys nobody uses anymore are dropped from the table over time */
+    for (l = 0; l < 10000; l++) {
+        char n[64];
+
+        snprintf(n, sizeof(n), "host-%u.local", (unsigned) l);
+        k2 = avahi_key_table_get(kt, n, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_A);
+        assert(k2);
+        avahi_key_unref(k2);
+    }
+
+    /* Keys outlive the table */
+    avahi_key_table_free(kt);
+    assert(strcmp(r->key->name, "_http._tcp.local") == 0);
+
+    avahi_key_unref(k);
+    avahi_record_unref(r);
+
+    /* RECORD VIEWS */
+
+    p = avahi_dns_packet_new(0);
+
+    /* The SRV target is compressed against the PTR record */
+    r = avahi_record_new_full("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL);
+    r->data.ptr.name = avahi_strdup("Test._http._tcp.local");
+    assert(avahi_dns_packet_append_record(p, r, 0, 0));
+    avahi_record_unref(r);
+
+    r = avahi_record_new_full("Test._http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_SRV, AVAHI_DEFAULT_TTL_HOST_NAME);
+    r->data.srv.port = 80;
+    r->data.srv.name = avahi_strdup("_http._tcp.local");
+    assert(avahi_dns_packet_append_record(p, r, 1, 0));
+
+    r2 = avahi_dns_packet_consume_record(p, NULL);
+    assert(r2);
+    avahi_record_unref(r2);
+
+    l = p->rindex;
+    res = avahi_dns_packet_consume_record_view(p, &v);
+    assert(res == 0);
+    assert(v.cache_flush);
+    assert(v.ttl == AVAHI_DEFAULT_TTL_HOST_NAME);
+    assert(avahi_key_equal(v.key, r->key));
+    assert(v.rdata_index > l && v.rdata_index + v.rdlength == p->rindex);
+    assert(p->rindex == p->size);
+
+    r2 = avahi_record_view_materialize(&v);
+    assert(r2);
+    assert(avahi_record_equal_no_ttl(r, r2));
+    assert(p->rindex == p->size);
+    avahi_record_unref(r2);
+
+    /* Views on damaged rdata can be read but not materialized */
+    v.rdlength--;
+    assert(!avahi_record_view_materialize(&v));
+
+    avahi_record_view_done(&v);
+    assert(!v.key);
+
+    avahi_record_unref(r);
+    avahi_dns_packet_free(p);
+
     return 0;
 }
@@ -57,6 +57,7 @@ AvahiDnsPacket* avahi_dns_packet_new(unsigned mtu) {
     p->max_size = max_size;
     p->res_size = 0;
     p->name_table = NULL;
+    p->key_table = NULL;
     p->data = NULL;
 
     memset(AVAHI_DNS_PACKET_DATA(p), 0, p->size);
@@ -433,6 +434,61 @@ int avahi_dns_packet_consume_name(AvahiDnsPacket *p, char *ret_name, size_t l) {
     return 0;
 }
 
+static int skip_labels(AvahiDnsPacket *p, size_t *idx) {
+    int i;
+
+    /* Like consume_labels(), but we only need to know where the name
+     * ends, so the labels aren't decoded and pointers aren't followed */
+
+    for (i = 0; i < AVAHI_DNS_LABELS_MAX; i++) {
+        uint8_t n;
+
+        if (*idx+1 > p->size)
+            return -1;
+
+        n = AVAHI_DNS_PACKET_DATA(p)[*idx];
+
+        if (!n) {
+            (*idx)++;
+            return 0;
+        } else if (n <= 63)
+            *idx += 1 + n;
+        else if ((n & 0xC0) == 0xC0) {
+            if (*idx+2 > p->size)
+                return -1;
+
+            *idx += 2;
+            return 0;
+        } else
+            return -1;
+    }
+
+    return -1;
+}
+
+int avahi_dns_packet_question_section_size(AvahiDnsPacket *p, size_t *ret_size) {
+    size_t idx = AVAHI_DNS_PACKET_HEADER_SIZE;
+    unsigned n;
+
+    assert(p);
+    assert(ret_size);
+
+    for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT); n > 0; n--) {
+
+        if (skip_labels(p, &idx) < 0)
+            return -1;
+
+        /* Type and class */
+        if (idx+4 > p->size)
+            return -1;
+
+        idx += 4;
+    }
+
+    *ret_size = idx - AVAHI_DNS_PACKET_HEADER_SIZE;
+    return 0;
+}
+
 int avahi_dns_packet_consume_uint16(AvahiDnsPacket *p, uint16_t *ret_v) {
     uint8_t *d;
 
@@ -632,43 +688,96 @@ static int parse_rdata(AvahiDnsPacket *p, AvahiRecord *r, uint16_t rdlength) {
     return 0;
 }
 
-AvahiRecord* avahi_dns_packet_consume_record(AvahiDnsPacket *p, int *ret_cache_flush) {
+int avahi_dns_packet_consume_record_view(AvahiDnsPacket *p, AvahiRecordView *v) {
     char name[AVAHI_DOMAIN_NAME_MAX];
     uint16_t type, class;
-    uint32_t ttl;
-    uint16_t rdlength;
-    AvahiRecord *r = NULL;
 
     assert(p);
+    assert(v);
 
     if (avahi_dns_packet_consume_name(p, name, sizeof(name)) < 0 ||
         avahi_dns_packet_consume_uint16(p, &type) < 0 ||
         avahi_dns_packet_consume_uint16(p, &class) < 0 ||
-        avahi_dns_packet_consume_uint32(p, &ttl) < 0 ||
-        avahi_dns_packet_consume_uint16(p, &rdlength) < 0 ||
-        p->rindex + rdlength > p->size)
-        goto fail;
+        avahi_dns_packet_consume_uint32(p, &v->ttl) < 0 ||
+        avahi_dns_packet_consume_uint16(p, &v->rdlength) < 0 ||
+        p->rindex + v->rdlength > p->size)
+        return -1;
 
-    if (ret_cache_flush)
-        *ret_cache_flush = !!(class & AVAHI_DNS_CACHE_FLUSH);
+    v->cache_flush = !!(class & AVAHI_DNS_CACHE_FLUSH);
     class &= ~AVAHI_DNS_CACHE_FLUSH;
 
-    if (!(r = avahi_record_new_full(name, class, type, ttl)))
-        goto fail;
+    if (p->key_table)
+        v->key = avahi_key_table_get(p->key_table, name, class, type);
+    else
+        v->key = avahi_key_new(name, class, type);
 
-    if (parse_rdata(p, r, rdlength) < 0)
-        goto fail;
+    if (!v->key)
+        return -1;
 
-    if (!avahi_record_is_valid(r))
-        goto fail;
+    if (!avahi_key_is_valid(v->key)) {
+        avahi_key_unref(v->key);
+        return -1;
+    }
 
-    return r;
+    v->packet = p;
+    v->rdata_index = p->rindex;
+    p->rindex += v->rdlength;
 
-fail:
-    if (r)
+    return 0;
+}
+
+AvahiRecord* avahi_record_view_materialize(const AvahiRecordView *v) {
+    AvahiRecord *r;
+    size_t rindex;
+
+    assert(v);
+    assert(v->packet);
+    assert(v->key);
+
+    if (!(r = avahi_record_new(v->key, v->ttl)))
+        return NULL;
+
+    /* Names in the rdata may be compressed, hence we need to parse
+     * them in the context of the whole packet */
+    rindex = v->packet->rindex;
+    v->packet->rindex = v->rdata_index;
+
+    if (parse_rdata(v->packet, r, v->rdlength) < 0 ||
+        !avahi_record_is_valid(r)) {
         avahi_record_unref(r);
+        r = NULL;
+    }
 
-    return NULL;
+    v->packet->rindex = rindex;
+
+    return r;
+}
+
+void avahi_record_view_done(AvahiRecordView *v) {
+    assert(v);
+
+    if (v->key) {
+        avahi_key_unref(v->key);
+        v->key = NULL;
+    }
+}
+
+AvahiRecord* avahi_dns_packet_consume_record(AvahiDnsPacket *p, int *ret_cache_flush) {
+    AvahiRecordView v;
+    AvahiRecord *r;
+
+    assert(p);
+
+    if (avahi_dns_packet_consume_record_view(p, &v) < 0)
+        return NULL;
+
+    r = avahi_record_view_materialize(&v);
+    avahi_record_view_done(&v);
+
+    if (r && ret_cache_flush)
+        *ret_cache_flush = v.cache_flush;
+
+    return r;
 }
 
 AvahiKey* avahi_dns_packet_consume_key(AvahiDnsPacket *p, int *ret_unicast_response) {
@@ -688,7 +797,12 @@ AvahiKey* avahi_dns_packet_consume_key(AvahiDnsPacket *p, int *ret_unicast_respo
 
     class &= ~AVAHI_DNS_UNICAST_RESPONSE;
 
-    if (!(k = avahi_key_new(name, class, type)))
+    if (p->key_table)
+        k = avahi_key_table_get(p->key_table, name, class, type);
+    else
+        k = avahi_key_new(name, class, type);
+
+    if (!k)
         return NULL;
 
     if (!avahi_key_is_valid(k)) {
@@ -883,6 +997,7 @@ int avahi_rdata_parse(AvahiRecord *record, const void* rdata, size_t size) {
     p.max_size = p.size = size;
     p.rindex = 0;
     p.name_table = NULL;
+    p.key_table = NULL;
 
     ret = parse_rdata(&p, record, size);
 
@@ -903,6 +1018,7 @@ size_t avahi_rdata_serialize(AvahiRecord *record, void *rdata, size_t max_size)
     p.max_size = max_size;
     p.size = p.rindex = 0;
     p.name_table = NULL;
+    p.key_table = NULL;
 
     ret = append_rdata(&p, record);
 
@@ -21,6 +21,7 @@
 ***/
 
 #include "rr.h"
+#include "rr-util.h"
 #include "hashmap.h"
 
 #define AVAHI_DNS_PACKET_HEADER_SIZE 12
@@ -32,6 +33,7 @@
 typedef struct AvahiDnsPacket {
     size_t size, rindex, max_size, res_size;
     AvahiHashmap *name_table; /* for name compression */
+    AvahiKeyTable *key_table; /* for interning parsed keys, may be NULL */
     uint8_t *data;
 } AvahiDnsPacket;
 
@@ -117,6 +119,36 @@ AvahiKey* avahi_dns_packet_consume_key(AvahiDnsPacket *p, int *ret_unicast_respo
 AvahiRecord* avahi_dns_packet_consume_record(AvahiDnsPacket *p, int *ret_cache_flush);
 int avahi_dns_packet_consume_string(AvahiDnsPacket *p, char *ret_string, size_t l);
 
+/** A resource record that has been read from a packet, with the rdata
+ * left unparsed in the packet buffer. The view doesn't own the packet
+ * and is only usable as long as the packet is. */
+typedef struct AvahiRecordView {
+    AvahiDnsPacket *packet;
+    AvahiKey *key;
+    uint32_t ttl;
+    int cache_flush;
+    size_t rdata_index;
+    uint16_t rdlength;
+} AvahiRecordView;
+
+/** Extract the owner name, type, class and TTL of a resource record
+ * from packet and skip its rdata.
+ *
+ * @return 0 on success, -1 on error. On success the view holds a reference to its key which needs to be released with avahi_record_view_done(). */
+int avahi_dns_packet_consume_record_view(AvahiDnsPacket *p, AvahiRecordView *v);
+/** Parse the rdata a view points to. Doesn't touch the read index of the packet.
+ *
+ * @return NULL on error, avahi_record reference on success. */
+AvahiRecord* avahi_record_view_materialize(const AvahiRecordView *v);
+/** Release the key reference of a view. */
+void avahi_record_view_done(AvahiRecordView *v);
+
+/** Determine the size of the question section, which starts right
+ * after the header, without parsing the questions. Doesn't touch the
+ * read index of the packet.
+ * @returns 0 on success, -1 if the question section is invalid. */
+int avahi_dns_packet_question_section_size(AvahiDnsPacket *p, size_t *ret_size);
+
 /** Get pointer to rindex in packet. */
 const void* avahi_dns_packet_get_rptr(AvahiDnsPacket *p);
 
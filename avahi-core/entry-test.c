@@ -0,0 +1,222 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <assert.h>
+
+#include <sys/time.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/defs.h>
+#include <avahi-common/error.h>
+
+#include "internal.h"
+#include "iface.h"
+#include "rrlist.h"
+#include "publish.h"
+
+static AvahiSEntryGroup *add_group(AvahiServer *s, unsigned i) {
+    AvahiSEntryGroup *g;
+    char name[64];
+    int ret;
+
+    snprintf(name, sizeof(name), "Container %u", i);
+
+    g = avahi_s_entry_group_new(s, NULL, NULL);
+    assert(g);
+
+    ret = avahi_server_add_service(s, g, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, 80, "path=/", NULL);
+    assert(ret == AVAHI_OK);
+
+    return g;
+}
+
+static void benchmark_churn(AvahiServer *s, unsigned n, unsigned rounds) {
+    AvahiSEntryGroup **groups;
+    struct timeval start;
+    AvahiUsec usec;
+    unsigned i;
+
+    groups = avahi_new(AvahiSEntryGroup*, n);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++)
+        groups[i] = add_group(s, i);
+    printf("publish %u services:  %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    /* Withdraw and republish one service at a time, cleaning up after
+     * each step like the server does after each packet */
+    for (i = 0, usec = 0; i < rounds; i++) {
+        gettimeofday(&start, NULL);
+        avahi_s_entry_group_free(groups[i % n]);
+        avahi_cleanup_dead_entries(s);
+        usec += avahi_age(&start);
+
+        groups[i % n] = add_group(s, n + i);
+    }
+    printf("churn %u services:    %8llu usec\n", rounds, (unsigned long long) usec);
+
+    /* Resetting a group kills its entries but not the group itself */
+    avahi_s_entry_group_reset(groups[0]);
+    assert(s->dead_entries);
+    assert(!s->dead_groups);
+    avahi_cleanup_dead_entries(s);
+    assert(!s->dead_entries);
+    assert(avahi_s_entry_group_is_empty(groups[0]));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++)
+        avahi_s_entry_group_free(groups[i]);
+    avahi_cleanup_dead_entries(s);
+    printf("withdraw %u services: %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    assert(!s->entries);
+    assert(!s->dead_entries);
+    assert(!s->groups);
+    assert(!s->dead_groups);
+
+    avahi_free(groups);
+}
+
+static void group_callback(AVAHI_GCC_UNUSED AvahiServer *s, AVAHI_GCC_UNUSED AvahiSEntryGroup *g, AvahiEntryGroupState state, void *userdata) {
+    AvahiEntryGroupState *ret_state = userdata;
+
+    *ret_state = state;
+}
+
+static unsigned count_responses(AvahiServer *s, AvahiInterface *i, const char *name, uint16_t clazz, uint16_t type, uint16_t expect_type) {
+    AvahiKey *k;
+    AvahiRecord *r;
+    unsigned n = 0;
+
+    k = avahi_key_new(name, clazz, type);
+    assert(k);
+
+    avahi_server_prepare_matching_responses(s, i, k, 0);
+    avahi_key_unref(k);
+
+    while ((r = avahi_record_list_next(s->record_list, NULL, NULL, NULL))) {
+        assert(!expect_type || r->key->type == expect_type);
+        avahi_record_unref(r);
+        n++;
+    }
+
+    avahi_record_list_flush(s->record_list);
+
+    return n;
+}
+
+static void check_any(AvahiSimplePoll *simple_poll, AvahiServer *s, unsigned n) {
+    AvahiEntryGroupState state = AVAHI_ENTRY_GROUP_UNCOMMITED;
+    AvahiSEntryGroup *g;
+    AvahiInterface *i;
+    struct timeval start;
+    unsigned j;
+    int ret;
+
+    g = avahi_s_entry_group_new(s, group_callback, &state);
+    assert(g);
+
+    for (j = 0; j < n; j++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "Container %u", j);
+        ret = avahi_server_add_service(s, g, AVAHI_IF_UNSPEC, AVAHI_PROTO_UNSPEC, 0, name, "_http._tcp", NULL, NULL, 80, "path=/", NULL);
+        assert(ret == AVAHI_OK);
+    }
+
+    ret = avahi_s_entry_group_commit(g);
+    assert(ret == AVAHI_OK);
+
+    /* Unique records are only answered for once they have been probed */
+    gettimeofday(&start, NULL);
+    while (state != AVAHI_ENTRY_GROUP_ESTABLISHED) {
+        assert(state == AVAHI_ENTRY_GROUP_REGISTERING);
+        assert(avahi_age(&start) < (AvahiUsec) 60 * 1000000);
+        avahi_simple_poll_iterate(simple_poll, -1);
+    }
+
+    for (i = s->monitor->interfaces; i; i = i->interface_next)
+        if (i->announcing)
+            break;
+    assert(i);
+
+    /* The PTR records of all services share one name */
+    assert(count_responses(s, i, "_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY, AVAHI_DNS_TYPE_PTR) == n);
+
+    /* SRV and TXT */
+    assert(count_responses(s, i, "Container 7._http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY, 0) == 2);
+    assert(count_responses(s, i, "container 7._HTTP._tcp.local", AVAHI_DNS_CLASS_ANY, AVAHI_DNS_TYPE_ANY, 0) == 2);
+    assert(count_responses(s, i, "Container 7._http._tcp.local", AVAHI_DNS_CLASS_ANY, AVAHI_DNS_TYPE_TXT, AVAHI_DNS_TYPE_TXT) == 1);
+    assert(count_responses(s, i, "Container 7._http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_TXT, AVAHI_DNS_TYPE_TXT) == 1);
+    assert(count_responses(s, i, "Container 7._ftp._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY, 0) == 0);
+
+    gettimeofday(&start, NULL);
+    for (j = 0; j < n; j++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "Container %u._http._tcp.local", j);
+        ret = count_responses(s, i, name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY, 0);
+        assert(ret == 2);
+    }
+    printf("ANY queries %u:       %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    avahi_s_entry_group_free(g);
+    avahi_cleanup_dead_entries(s);
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiSimplePoll *simple_poll;
+    AvahiServerConfig config;
+    AvahiServer *s;
+    int error;
+
+    simple_poll = avahi_simple_poll_new();
+    assert(simple_poll);
+
+    /* Only check_any() runs the main loop, the other tests don't
+     * need anything to be announced */
+    avahi_server_config_init(&config);
+    config.publish_addresses = config.publish_hinfo = config.publish_workstation = config.publish_domain = 0;
+    config.use_ipv6 = 0;
+
+    s = avahi_server_new(avahi_simple_poll_get(simple_poll), &config, NULL, NULL, &error);
+    avahi_server_config_free(&config);
+
+    if (!s) {
+        fprintf(stderr, "Failed to create server: %s\n", avahi_strerror(error));
+        avahi_simple_poll_free(simple_poll);
+        return 1;
+    }
+
+    benchmark_churn(s, 5000, 2000);
+    check_any(simple_poll, s, 2000);
+
+    avahi_server_free(s);
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
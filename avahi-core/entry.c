@@ -88,14 +88,37 @@ void avahi_entry_free(AvahiServer*s, AvahiEntry *e) {
     else
         avahi_hashmap_remove(s->entries_by_key, e->record->key);
 
+    t = avahi_hashmap_lookup(s->entries_by_name, e->record->key);
+    AVAHI_LLIST_REMOVE(AvahiEntry, by_name, t, e);
+    if (t)
+        avahi_hashmap_replace(s->entries_by_name, t->record->key, t);
+    else
+        avahi_hashmap_remove(s->entries_by_name, e->record->key);
+
     /* Remove from associated group */
     if (e->group)
         AVAHI_LLIST_REMOVE(AvahiEntry, by_group, e->group->entries, e);
 
+    if (e->dead)
+        AVAHI_LLIST_REMOVE(AvahiEntry, dead, s->dead_entries, e);
+
+    s->response_generation++;
+
     avahi_record_unref(e->record);
     avahi_free(e);
 }
 
+void avahi_entry_mark_dead(AvahiServer *s, AvahiEntry *e) {
+    assert(s);
+    assert(e);
+    assert(!e->dead);
+
+    e->dead = 1;
+    AVAHI_LLIST_PREPEND(AvahiEntry, dead, s->dead_entries, e);
+
+    s->response_generation++;
+}
+
 void avahi_entry_group_free(AvahiServer *s, AvahiSEntryGroup *g) {
     assert(s);
     assert(g);
@@ -107,39 +130,24 @@ void avahi_entry_group_free(AvahiServer *s, AvahiSEntryGroup *g) {
         avahi_time_event_free(g->register_time_event);
 
     AVAHI_LLIST_REMOVE(AvahiSEntryGroup, groups, s->groups, g);
+
+    if (g->dead)
+        AVAHI_LLIST_REMOVE(AvahiSEntryGroup, dead, s->dead_groups, g);
+
     avahi_free(g);
 }
 
 void avahi_cleanup_dead_entries(AvahiServer *s) {
     assert(s);
 
-    if (s->need_group_cleanup) {
-        AvahiSEntryGroup *g, *next;
-
-        for (g = s->groups; g; g = next) {
-            next = g->groups_next;
-
-            if (g->dead)
-                avahi_entry_group_free(s, g);
-        }
-
-        s->need_group_cleanup = 0;
-    }
+    /* Freeing a group frees its entries too, which are all dead */
+    while (s->dead_groups)
+        avahi_entry_group_free(s, s->dead_groups);
 
-    if (s->need_entry_cleanup) {
-        AvahiEntry *e, *next;
+    while (s->dead_entries)
+        avahi_entry_free(s, s->dead_entries);
 
-        for (e = s->entries; e; e = next) {
-            next = e->entries_next;
-
-            if (e->dead)
-                avahi_entry_free(s, e);
-        }
-
-        s->need_entry_cleanup = 0;
-    }
-
-    if (s->need_browser_cleanup)
+    if (s->dead_record_browsers)
         avahi_browser_cleanup(s);
 
     if (s->cleanup_time_event) {
@@ -255,6 +263,8 @@ static AvahiEntry * server_add_internal(
         e->record = avahi_record_ref(r);
         e->flags = flags;
 
+        s->response_generation++;
+
         /* Announce our changes when needed */
         if (!avahi_record_equal_no_ttl(old_record, r) && (!g || g->state != AVAHI_ENTRY_GROUP_UNCOMMITED)) {
 
@@ -269,6 +279,8 @@ static AvahiEntry * server_add_internal(
         /* If we were the first entry in the list, we need to update the key */
         if (is_first)
             avahi_hashmap_replace(s->entries_by_key, e->record->key, e);
+        if (!e->by_name_prev)
+            avahi_hashmap_replace(s->entries_by_name, e->record->key, e);
 
         avahi_record_unref(old_record);
 
@@ -294,6 +306,7 @@ static AvahiEntry * server_add_internal(
         e->protocol = protocol;
         e->flags = flags;
         e->dead = 0;
+        AVAHI_LLIST_INIT(AvahiEntry, dead, e);
 
         AVAHI_LLIST_HEAD_INIT(AvahiAnnouncer, e->announcers);
 
@@ -304,10 +317,16 @@ static AvahiEntry * server_add_internal(
         AVAHI_LLIST_PREPEND(AvahiEntry, by_key, t, e);
         avahi_hashmap_replace(s->entries_by_key, e->record->key, t);
 
+        t = avahi_hashmap_lookup(s->entries_by_name, e->record->key);
+        AVAHI_LLIST_PREPEND(AvahiEntry, by_name, t, e);
+        avahi_hashmap_replace(s->entries_by_name, e->record->key, t);
+
         /* Insert into group list */
         if (g)
             AVAHI_LLIST_PREPEND(AvahiEntry, by_group, g->entries, e);
 
+        s->response_generation++;
+
         avahi_announce_entry(s, e);
     }
 
@@ -345,8 +364,19 @@ const AvahiRecord *avahi_server_iterate(AvahiServer *s, AvahiSEntryGroup *g, voi
     return avahi_record_ref((*e)->record);
 }
 
+static void dump_pool_stats(const AvahiPoolStats *stats, AvahiDumpCallback callback, void* userdata) {
+    char ln[256];
+
+    snprintf(ln, sizeof(ln), ";;; POOL %s: %u objects of %lu bytes live, at most %u, %u slabs ;;;",
+             stats->name, stats->n_live, (unsigned long) stats->object_size, stats->n_live_max, stats->n_slabs);
+    callback(ln, userdata);
+}
+
 int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata) {
     AvahiEntry *e;
+    const AvahiTimeEventQueueStats *stats;
+    AvahiPoolStats pool_stats;
+    char ln[256];
 
     assert(s);
     assert(callback);
@@ -355,7 +385,6 @@ int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata
 
     for (e = s->entries; e; e = e->entries_next) {
         char *t;
-        char ln[256];
 
         if (e->dead)
             continue;
@@ -373,6 +402,23 @@ int avahi_server_dump(AvahiServer *s, AvahiDumpCallback callback, void* userdata
 
     if (s->wide_area_lookup_engine)
         avahi_wide_area_cache_dump(s->wide_area_lookup_engine, callback, userdata);
+
+    stats = avahi_time_event_queue_get_stats(s->time_event_queue);
+    snprintf(ln, sizeof(ln), ";;; TIME EVENTS: %u wakeups, %u events run, at most %u per wakeup, %u ahead of time, %u wakeups cut short ;;;",
+             stats->n_wakeups, stats->n_events, stats->n_events_per_wakeup_max, stats->n_events_early, stats->n_batches_limited);
+    callback(ln, userdata);
+
+    avahi_time_event_queue_get_pool_stats(s->time_event_queue, &pool_stats);
+    dump_pool_stats(&pool_stats, callback, userdata);
+    avahi_pool_get_stats(s->cache_entry_pool, &pool_stats);
+    dump_pool_stats(&pool_stats, callback, userdata);
+    avahi_pool_get_stats(s->response_job_pool, &pool_stats);
+    dump_pool_stats(&pool_stats, callback, userdata);
+    avahi_pool_get_stats(s->query_job_pool, &pool_stats);
+    dump_pool_stats(&pool_stats, callback, userdata);
+    avahi_pool_get_stats(s->probe_job_pool, &pool_stats);
+    dump_pool_stats(&pool_stats, callback, userdata);
+
     return AVAHI_OK;
 }
 
@@ -1063,6 +1109,7 @@ AvahiSEntryGroup *avahi_s_entry_group_new(AvahiServer *s, AvahiSEntryGroupCallba
     g->callback = callback;
     g->userdata = userdata;
     g->dead = 0;
+    AVAHI_LLIST_INIT(AvahiSEntryGroup, dead, g);
     g->state = AVAHI_ENTRY_GROUP_UNCOMMITED;
     g->n_probing = 0;
     g->n_register_try = 0;
@@ -1101,7 +1148,7 @@ void avahi_s_entry_group_free(AvahiSEntryGroup *g) {
     for (e = g->entries; e; e = e->by_group_next) {
         if (!e->dead) {
             avahi_goodbye_entry(g->server, e, 1, 1);
-            e->dead = 1;
+            avahi_entry_mark_dead(g->server, e);
         }
     }
 
@@ -1111,9 +1158,7 @@ void avahi_s_entry_group_free(AvahiSEntryGroup *g) {
     }
 
     g->dead = 1;
-
-    g->server->need_group_cleanup = 1;
-    g->server->need_entry_cleanup = 1;
+    AVAHI_LLIST_PREPEND(AvahiSEntryGroup, dead, g->server->dead_groups, g);
 
     schedule_cleanup(g->server);
 }
@@ -1187,10 +1232,9 @@ void avahi_s_entry_group_reset(AvahiSEntryGroup *g) {
     for (e = g->entries; e; e = e->by_group_next) {
         if (!e->dead) {
             avahi_goodbye_entry(g->server, e, 1, 1);
-            e->dead = 1;
+            avahi_entry_mark_dead(g->server, e);
         }
     }
-    g->server->need_entry_cleanup = 1;
 
     g->n_probing = 0;
 
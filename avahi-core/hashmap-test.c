@@ -22,13 +22,119 @@
 #endif
 
 #include <stdio.h>
+#include <assert.h>
+#include <sys/time.h>
 
 #include <avahi-common/domain.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
 
 #include "hashmap.h"
 #include "util.h"
 
+static void count_callback(AVAHI_GCC_UNUSED void *key, AVAHI_GCC_UNUSED void *value, void *userdata) {
+    unsigned *n = userdata;
+
+    (*n)++;
+}
+
+static void remove_odd_callback(void *key, void *value, void *userdata) {
+    AvahiHashmap *m = userdata;
+
+    assert(*(int*) key == *(int*) value);
+
+    if (*(int*) key & 1)
+        avahi_hashmap_remove(m, key);
+}
+
+static void check_int_map(unsigned n_keys) {
+    AvahiHashmap *m;
+    unsigned i, n;
+
+    m = avahi_hashmap_new(avahi_int_hash, avahi_int_equal, avahi_free, NULL);
+
+    for (i = 0; i < n_keys; i++) {
+        int *k = avahi_new(int, 1);
+        *k = (int) i;
+        assert(avahi_hashmap_insert(m, k, k) == 0);
+    }
+
+    for (i = 0; i < n_keys; i++) {
+        int k = (int) i;
+        assert(avahi_hashmap_lookup(m, &k));
+        assert(*(int*) avahi_hashmap_lookup(m, &k) == k);
+    }
+
+    /* Remove entries from within the foreach callback, like
+     * avahi_dns_packet_cleanup_name_table() does */
+    avahi_hashmap_foreach(m, remove_odd_callback, m);
+
+    n = 0;
+    avahi_hashmap_foreach(m, count_callback, &n);
+    assert(n == (n_keys + 1) / 2);
+
+    for (i = 0; i < n_keys; i++) {
+        int k = (int) i;
+
+        if (i & 1)
+            assert(!avahi_hashmap_lookup(m, &k));
+        else {
+            assert(avahi_hashmap_lookup(m, &k));
+            avahi_hashmap_remove(m, &k);
+            assert(!avahi_hashmap_lookup(m, &k));
+        }
+    }
+
+    n = 0;
+    avahi_hashmap_foreach(m, count_callback, &n);
+    assert(n == 0);
+
+    avahi_hashmap_free(m);
+}
+
+static void benchmark(unsigned n_keys) {
+    AvahiHashmap *m;
+    char **keys;
+    unsigned i;
+    struct timeval start;
+    AvahiUsec insert_usec, lookup_usec, remove_usec;
+
+    keys = avahi_new(char*, n_keys);
+    for (i = 0; i < n_keys; i++)
+        keys[i] = avahi_strdup_printf("_service-%u._tcp.local", i);
+
+    m = avahi_hashmap_new(avahi_string_hash, avahi_string_equal, NULL, NULL);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_keys; i++)
+        avahi_hashmap_insert(m, keys[i], keys[i]);
+    insert_usec = avahi_age(&start);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_keys; i++) {
+        const char *t = avahi_hashmap_lookup(m, keys[(i * 7919) % n_keys]);
+        assert(t == keys[(i * 7919) % n_keys]);
+    }
+    lookup_usec = avahi_age(&start);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_keys; i++)
+        avahi_hashmap_remove(m, keys[i]);
+    remove_usec = avahi_age(&start);
+
+    printf("%6u keys: insert %8.1f ns/op, lookup %8.1f ns/op, remove %8.1f ns/op\n",
+           n_keys,
+           (double) insert_usec * 1000 / n_keys,
+           (double) lookup_usec * 1000 / n_keys,
+           (double) remove_usec * 1000 / n_keys);
+
+    avahi_hashmap_free(m);
+
+    for (i = 0; i < n_keys; i++)
+        avahi_free(keys[i]);
+    avahi_free(keys);
+}
+
 int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     unsigned n;
     AvahiHashmap *m;
@@ -58,5 +164,13 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
 
     avahi_hashmap_free(m);
 
+    check_int_map(1);
+    check_int_map(1000);
+    check_int_map(100000);
+
+    benchmark(1000);
+    benchmark(10000);
+    benchmark(100000);
+
     return 0;
 }
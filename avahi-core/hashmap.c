@@ -24,23 +24,29 @@
 #include <stdlib.h>
 #include <string.h>
 
-#include <avahi-common/llist.h>
 #include <avahi-common/domain.h>
 #include <avahi-common/malloc.h>
 
 #include "hashmap.h"
 #include "util.h"
 
-#define HASH_MAP_SIZE 123
+/* This is an open addressing hash table using Robin Hood probing
+ * with backward shift deletion. The entries are stored inline in a
+ * power-of-two sized array, together with their (mixed) hash
+ * value. A stored hash value of 0 marks an empty slot. */
+
+#define HASH_MAP_SIZE_MIN 8
+
+/* Grow when more than 3/4 of all slots are used, shrink when less
+ * than 1/8 are. */
+#define HASH_MAP_LOAD_MAX(size) ((size) - (size) / 4)
+#define HASH_MAP_LOAD_MIN(size) ((size) / 8)
 
 typedef struct Entry Entry;
 struct Entry {
-    AvahiHashmap *hashmap;
+    unsigned hash;
     void *key;
     void *value;
-
-    AVAHI_LLIST_FIELDS(Entry, bucket);
-    AVAHI_LLIST_FIELDS(Entry, entries);
 };
 
 struct AvahiHashmap {
@@ -48,39 +54,192 @@ struct AvahiHashmap {
     AvahiEqualFunc equal_func;
     AvahiFreeFunc key_free_func, value_free_func;
 
-    Entry *entries[HASH_MAP_SIZE];
-    AVAHI_LLIST_HEAD(Entry, entries_list);
+    Entry *entries;
+    unsigned size, n_entries;
+
+    /* Greater than zero while avahi_hashmap_foreach() is running */
+    unsigned n_iterating;
 };
 
+static unsigned hash_key(AvahiHashmap *m, const void *key) {
+    unsigned h;
+
+    /* We only look at the lowest bits of the hash value, and the
+     * hash functions passed in by our users are pretty weak there,
+     * hence mix them a bit. */
+    h = m->hash_func(key);
+    h ^= h >> 16;
+    h *= 0x45d9f3bU;
+    h ^= h >> 16;
+
+    return h ? h : 1;
+}
+
+static unsigned probe_distance(AvahiHashmap *m, unsigned hash, unsigned idx) {
+    return (idx - hash) & (m->size - 1);
+}
+
 static Entry* entry_get(AvahiHashmap *m, const void *key) {
-    unsigned idx;
-    Entry *e;
+    unsigned hash, idx, d;
+
+    if (m->n_entries <= 0)
+        return NULL;
+
+    hash = hash_key(m, key);
+    idx = hash & (m->size - 1);
+
+    for (d = 0;; d++) {
+        Entry *e = m->entries + idx;
 
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
+        /* Robin Hood probing guarantees that our key cannot come
+         * after an entry that is closer to its home slot than we
+         * are to ours */
+        if (!e->hash || probe_distance(m, e->hash, idx) < d)
+            return NULL;
 
-    for (e = m->entries[idx]; e; e = e->bucket_next)
-        if (m->equal_func(key, e->key))
+        if (e->hash == hash && m->equal_func(key, e->key))
             return e;
 
-    return NULL;
+        idx = (idx + 1) & (m->size - 1);
+    }
+}
+
+static void entry_put(AvahiHashmap *m, unsigned hash, void *key, void *value) {
+    unsigned idx, d;
+    Entry t;
+
+    assert(m->n_entries < m->size);
+
+    t.hash = hash;
+    t.key = key;
+    t.value = value;
+
+    idx = hash & (m->size - 1);
+
+    for (d = 0;; d++) {
+        Entry *e = m->entries + idx;
+        unsigned ed;
+
+        if (!e->hash) {
+            *e = t;
+            m->n_entries++;
+            return;
+        }
+
+        /* Take the slot away from entries that are closer to their
+         * home slot than we are, and continue with them instead */
+        if ((ed = probe_distance(m, e->hash, idx)) < d) {
+            Entry x = *e;
+            *e = t;
+            t = x;
+            d = ed;
+        }
+
+        idx = (idx + 1) & (m->size - 1);
+    }
+}
+
+static void entry_remove(AvahiHashmap *m, Entry *e) {
+    unsigned idx, next;
+
+    assert(m->n_entries > 0);
+
+    idx = (unsigned) (e - m->entries);
+
+    /* Shift the following entries of the probe sequence back by
+     * one, so that we don't need tombstones */
+    for (;;) {
+        Entry *n;
+
+        next = (idx + 1) & (m->size - 1);
+        n = m->entries + next;
+
+        if (!n->hash || probe_distance(m, n->hash, next) == 0)
+            break;
+
+        m->entries[idx] = *n;
+        idx = next;
+    }
+
+    memset(m->entries + idx, 0, sizeof(Entry));
+    m->n_entries--;
+}
+
+static int resize(AvahiHashmap *m, unsigned size) {
+    Entry *old_entries, *e;
+    unsigned old_size, i;
+
+    assert(size >= HASH_MAP_SIZE_MIN);
+    assert((size & (size - 1)) == 0);
+    assert(m->n_entries <= HASH_MAP_LOAD_MAX(size));
+
+    if (!(e = avahi_new0(Entry, size)))
+        return -1;
+
+    old_entries = m->entries;
+    old_size = m->size;
+
+    m->entries = e;
+    m->size = size;
+    m->n_entries = 0;
+
+    for (i = 0; i < old_size; i++)
+        if (old_entries[i].hash)
+            entry_put(m, old_entries[i].hash, old_entries[i].key, old_entries[i].value);
+
+    avahi_free(old_entries);
+    return 0;
+}
+
+static int make_room(AvahiHashmap *m) {
+
+    /* We don't move entries around while somebody is iterating
+     * through them */
+    assert(m->n_iterating <= 0);
+
+    if (m->size <= 0)
+        return resize(m, HASH_MAP_SIZE_MIN);
+
+    if (m->n_entries + 1 > HASH_MAP_LOAD_MAX(m->size))
+        return resize(m, m->size * 2);
+
+    return 0;
+}
+
+static void maybe_shrink(AvahiHashmap *m) {
+    unsigned size;
+
+    if (m->n_iterating > 0)
+        return;
+
+    size = m->size;
+    while (size > HASH_MAP_SIZE_MIN && m->n_entries < HASH_MAP_LOAD_MIN(size))
+        size /= 2;
+
+    /* If this fails we simply keep the larger table */
+    if (size != m->size)
+        resize(m, size);
 }
 
 static void entry_free(AvahiHashmap *m, Entry *e, int stolen) {
-    unsigned idx;
+    void *key, *value;
+
     assert(m);
     assert(e);
 
-    idx = m->hash_func(e->key) % HASH_MAP_SIZE;
+    key = e->key;
+    value = e->value;
 
-    AVAHI_LLIST_REMOVE(Entry, bucket, m->entries[idx], e);
-    AVAHI_LLIST_REMOVE(Entry, entries, m->entries_list, e);
+    /* Remove the entry from the table first, the free functions
+     * might want to access the hash map */
+    entry_remove(m, e);
 
     if (m->key_free_func)
-        m->key_free_func(e->key);
+        m->key_free_func(key);
     if (m->value_free_func && !stolen)
-        m->value_free_func(e->value);
+        m->value_free_func(value);
 
-    avahi_free(e);
+    maybe_shrink(m);
 }
 
 AvahiHashmap* avahi_hashmap_new(AvahiHashFunc hash_func, AvahiEqualFunc equal_func, AvahiFreeFunc key_free_func, AvahiFreeFunc value_free_func) {
@@ -97,17 +256,26 @@ AvahiHashmap* avahi_hashmap_new(AvahiHashFunc hash_func, AvahiEqualFunc equal_fu
     m->key_free_func = key_free_func;
     m->value_free_func = value_free_func;
 
-    AVAHI_LLIST_HEAD_INIT(Entry, m->entries_list);
+    /* The table itself is allocated lazily on the first insertion */
+    m->entries = NULL;
+    m->size = m->n_entries = 0;
 
     return m;
 }
 
 void avahi_hashmap_free(AvahiHashmap *m) {
+    unsigned i;
+
     assert(m);
 
-    while (m->entries_list)
-        entry_free(m, m->entries_list, 0);
+    /* Prevent entry_free() from resizing the table under our feet */
+    m->n_iterating++;
+
+    for (i = 0; i < m->size; i++)
+        while (m->entries[i].hash)
+            entry_free(m, m->entries + i, 0);
 
+    avahi_free(m->entries);
     avahi_free(m);
 }
 
@@ -123,7 +291,6 @@ void* avahi_hashmap_lookup(AvahiHashmap *m, const void *key) {
 }
 
 int avahi_hashmap_insert(AvahiHashmap *m, void *key, void *value) {
-    unsigned idx;
     Entry *e;
 
     assert(m);
@@ -137,51 +304,38 @@ int avahi_hashmap_insert(AvahiHashmap *m, void *key, void *value) {
         return 1;
     }
 
-    if (!(e = avahi_new(Entry, 1)))
+    if (make_room(m) < 0)
         return -1;
 
-    e->hashmap = m;
-    e->key = key;
-    e->value = value;
-
-    AVAHI_LLIST_PREPEND(Entry, entries, m->entries_list, e);
-
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
-    AVAHI_LLIST_PREPEND(Entry, bucket, m->entries[idx], e);
+    entry_put(m, hash_key(m, key), key, value);
 
     return 0;
 }
 
 
 int avahi_hashmap_replace(AvahiHashmap *m, void *key, void *value) {
-    unsigned idx;
     Entry *e;
 
     assert(m);
 
     if ((e = entry_get(m, key))) {
-        if (m->key_free_func)
-            m->key_free_func(e->key);
-        if (m->value_free_func)
-            m->value_free_func(e->value);
+        void *old_key = e->key, *old_value = e->value;
 
         e->key = key;
         e->value = value;
 
+        if (m->key_free_func)
+            m->key_free_func(old_key);
+        if (m->value_free_func)
+            m->value_free_func(old_value);
+
         return 1;
     }
 
-    if (!(e = avahi_new(Entry, 1)))
+    if (make_room(m) < 0)
         return -1;
 
-    e->hashmap = m;
-    e->key = key;
-    e->value = value;
-
-    AVAHI_LLIST_PREPEND(Entry, entries, m->entries_list, e);
-
-    idx = m->hash_func(key) % HASH_MAP_SIZE;
-    AVAHI_LLIST_PREPEND(Entry, bucket, m->entries[idx], e);
+    entry_put(m, hash_key(m, key), key, value);
 
     return 0;
 }
@@ -198,15 +352,36 @@ void avahi_hashmap_remove(AvahiHashmap *m, const void *key) {
 }
 
 void avahi_hashmap_foreach(AvahiHashmap *m, AvahiHashmapForeachCallback callback, void *userdata) {
-    Entry *e, *next;
+    unsigned start, i;
+
     assert(m);
     assert(callback);
 
-    for (e = m->entries_list; e; e = next) {
-        next = e->entries_next;
+    if (m->n_entries <= 0)
+        return;
+
+    /* We walk the table backwards, starting right before an empty
+     * slot. Backward shift deletion only ever moves entries that
+     * follow the removed one within the same probe sequence. Since
+     * that sequence ends at our empty starting slot at the latest,
+     * the callback may remove the entry it has been passed without
+     * making us skip or revisit any other entry. */
+
+    for (start = 0; m->entries[start].hash; start++)
+        ;
 
-        callback(e->key, e->value, userdata);
+    m->n_iterating++;
+
+    for (i = 1; i < m->size; i++) {
+        Entry *e = m->entries + ((start - i) & (m->size - 1));
+
+        if (e->hash)
+            callback(e->key, e->value, userdata);
     }
+
+    m->n_iterating--;
+
+    maybe_shrink(m);
 }
 
 unsigned avahi_string_hash(const void *data) {
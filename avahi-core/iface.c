@@ -261,12 +261,67 @@ static int interface_mdns_mcast_rejoin(AvahiInterface *i) {
     return interface_mdns_mcast_join(i, 1);
 }
 
+static unsigned address_hash(const void *data) {
+    const AvahiAddress *a = data;
+    uint32_t w[4];
+
+    assert(a);
+
+    if (a->proto == AVAHI_PROTO_INET)
+        return a->data.ipv4.address;
+
+    memcpy(w, a->data.ipv6.address, sizeof(w));
+    return w[0] ^ w[1] ^ w[2] ^ w[3];
+}
+
+static int address_equal(const void *a, const void *b) {
+    return avahi_address_cmp(a, b) == 0;
+}
+
+static void address_index_remove(AvahiInterfaceMonitor *m, AvahiInterfaceAddress *a) {
+    AvahiInterfaceAddress *t;
+
+    assert(m);
+    assert(a);
+
+    t = avahi_hashmap_lookup(m->address_hashmap, &a->address);
+    AVAHI_LLIST_REMOVE(AvahiInterfaceAddress, by_address, t, a);
+    if (t)
+        avahi_hashmap_replace(m->address_hashmap, &t->address, t);
+    else
+        avahi_hashmap_remove(m->address_hashmap, &a->address);
+}
+
+static unsigned address_prefix_len(AvahiInterface *i, unsigned prefix_len) {
+    unsigned max = i->protocol == AVAHI_PROTO_INET ? 32 : 128;
+
+    return prefix_len > max ? max : prefix_len;
+}
+
+static void rebuild_prefix_tree(AvahiInterface *i) {
+    AvahiInterfaceAddress *a;
+    int r;
+
+    assert(i);
+
+    /* This is only called after an address was removed, so the
+     * remaining prefixes fit into the memory we already have */
+    avahi_prefix_tree_clear(i->prefix_tree);
+
+    for (a = i->addresses; a; a = a->address_next) {
+        r = avahi_prefix_tree_add(i->prefix_tree, a->address.data.data, address_prefix_len(i, a->prefix_len));
+        assert(r == 0);
+    }
+}
+
 void avahi_interface_address_free(AvahiInterfaceAddress *a) {
     assert(a);
     assert(a->interface);
 
     avahi_interface_address_update_rrs(a, 1);
     AVAHI_LLIST_REMOVE(AvahiInterfaceAddress, address, a->interface->addresses, a);
+    address_index_remove(a->monitor, a);
+    rebuild_prefix_tree(a->interface);
 
     if (a->entry_group)
         avahi_s_entry_group_free(a->entry_group);
@@ -300,7 +355,9 @@ void avahi_interface_free(AvahiInterface *i, int send_goodbye) {
     avahi_response_scheduler_free(i->response_scheduler);
     avahi_query_scheduler_free(i->query_scheduler);
     avahi_probe_scheduler_free(i->probe_scheduler);
+    avahi_response_memo_free(i->response_memo);
     avahi_cache_free(i->cache);
+    avahi_prefix_tree_free(i->prefix_tree);
 
     AVAHI_LLIST_REMOVE(AvahiInterface, interface, i->monitor->interfaces, i);
     AVAHI_LLIST_REMOVE(AvahiInterface, by_hardware, i->hardware->interfaces, i);
@@ -352,8 +409,10 @@ AvahiInterface* avahi_interface_new(AvahiInterfaceMonitor *m, AvahiHwInterface *
     i->response_scheduler = avahi_response_scheduler_new(i);
     i->query_scheduler = avahi_query_scheduler_new(i);
     i->probe_scheduler = avahi_probe_scheduler_new(i);
+    i->response_memo = avahi_response_memo_new();
+    i->prefix_tree = avahi_prefix_tree_new(protocol == AVAHI_PROTO_INET ? 32 : 128);
 
-    if (!i->cache || !i->response_scheduler || !i->query_scheduler || !i->probe_scheduler)
+    if (!i->cache || !i->response_scheduler || !i->query_scheduler || !i->probe_scheduler || !i->response_memo || !i->prefix_tree)
         goto fail; /* OOM */
 
     AVAHI_LLIST_PREPEND(AvahiInterface, by_hardware, hw->interfaces, i);
@@ -372,6 +431,10 @@ fail:
             avahi_query_scheduler_free(i->query_scheduler);
         if (i->probe_scheduler)
             avahi_probe_scheduler_free(i->probe_scheduler);
+        if (i->response_memo)
+            avahi_response_memo_free(i->response_memo);
+        if (i->prefix_tree)
+            avahi_prefix_tree_free(i->prefix_tree);
     }
 
     return NULL;
@@ -411,10 +474,11 @@ AvahiHwInterface *avahi_hw_interface_new(AvahiInterfaceMonitor *m, AvahiIfIndex
 }
 
 AvahiInterfaceAddress *avahi_interface_address_new(AvahiInterfaceMonitor *m, AvahiInterface *i, const AvahiAddress *addr, unsigned prefix_len) {
-    AvahiInterfaceAddress *a;
+    AvahiInterfaceAddress *a, *t;
 
     assert(m);
     assert(i);
+    assert(addr->proto == i->protocol);
 
     if (!(a = avahi_new(AvahiInterfaceAddress, 1)))
         return NULL;
@@ -427,6 +491,23 @@ AvahiInterfaceAddress *avahi_interface_address_new(AvahiInterfaceMonitor *m, Ava
     a->deprecated = 0;
     a->entry_group = NULL;
 
+    if (avahi_prefix_tree_add(i->prefix_tree, addr->data.data, address_prefix_len(i, prefix_len)) < 0) {
+        avahi_free(a);
+        return NULL;
+    }
+
+    t = avahi_hashmap_lookup(m->address_hashmap, addr);
+
+    /* Only link the new address into the chain once it is the head,
+     * the old head must not point to it if that fails */
+    if (avahi_hashmap_replace(m->address_hashmap, &a->address, a) < 0) {
+        rebuild_prefix_tree(i);
+        avahi_free(a);
+        return NULL;
+    }
+
+    AVAHI_LLIST_PREPEND(AvahiInterfaceAddress, by_address, t, a);
+
     AVAHI_LLIST_PREPEND(AvahiInterfaceAddress, address, i->addresses, a);
 
     return a;
@@ -498,6 +579,10 @@ AvahiInterfaceMonitor *avahi_interface_monitor_new(AvahiServer *s) {
     m->server = s;
     m->list_complete = 0;
     m->hashmap = avahi_hashmap_new(avahi_int_hash, avahi_int_equal, NULL, NULL);
+    m->address_hashmap = avahi_hashmap_new(address_hash, address_equal, NULL, NULL);
+
+    if (!m->hashmap || !m->address_hashmap)
+        goto fail;
 
     AVAHI_LLIST_HEAD_INIT(AvahiInterface, m->interfaces);
     AVAHI_LLIST_HEAD_INIT(AvahiHwInterface, m->hw_interfaces);
@@ -525,6 +610,9 @@ void avahi_interface_monitor_free(AvahiInterfaceMonitor *m) {
     if (m->hashmap)
         avahi_hashmap_free(m->hashmap);
 
+    if (m->address_hashmap)
+        avahi_hashmap_free(m->address_hashmap);
+
     avahi_free(m);
 }
 
@@ -561,8 +649,8 @@ AvahiInterfaceAddress* avahi_interface_monitor_get_address(AvahiInterfaceMonitor
     assert(i);
     assert(raddr);
 
-    for (ia = i->addresses; ia; ia = ia->address_next)
-        if (avahi_address_cmp(&ia->address, raddr) == 0)
+    for (ia = avahi_hashmap_lookup(m->address_hashmap, raddr); ia; ia = ia->by_address_next)
+        if (ia->interface == i)
             return ia;
 
     return NULL;
@@ -599,9 +687,9 @@ void avahi_interface_send_packet_unicast(AvahiInterface *i, AvahiDnsPacket *p, c
     }
 
     if (i->protocol == AVAHI_PROTO_INET && i->monitor->server->fd_ipv4 >= 0)
-        avahi_send_dns_packet_ipv4(i->monitor->server->fd_ipv4, i->hardware->index, p, i->mcast_joined ? &i->local_mcast_address.data.ipv4 : NULL, a ? &a->data.ipv4 : NULL, port);
+        avahi_server_send_dns_packet_ipv4(i->monitor->server, i->monitor->server->fd_ipv4, i->hardware->index, p, i->mcast_joined ? &i->local_mcast_address.data.ipv4 : NULL, a ? &a->data.ipv4 : NULL, port);
     else if (i->protocol == AVAHI_PROTO_INET6 && i->monitor->server->fd_ipv6 >= 0)
-        avahi_send_dns_packet_ipv6(i->monitor->server->fd_ipv6, i->hardware->index, p, i->mcast_joined ? &i->local_mcast_address.data.ipv6 : NULL, a ? &a->data.ipv6 : NULL, port);
+        avahi_server_send_dns_packet_ipv6(i->monitor->server, i->monitor->server->fd_ipv6, i->hardware->index, p, i->mcast_joined ? &i->local_mcast_address.data.ipv6 : NULL, a ? &a->data.ipv6 : NULL, port);
 }
 
 void avahi_interface_send_packet(AvahiInterface *i, AvahiDnsPacket *p) {
@@ -764,88 +852,41 @@ void avahi_interface_monitor_walk(AvahiInterfaceMonitor *m, AvahiIfIndex interfa
 
 
 int avahi_address_is_local(AvahiInterfaceMonitor *m, const AvahiAddress *a) {
-    AvahiInterface *i;
-    AvahiInterfaceAddress *ia;
     assert(m);
     assert(a);
 
-    for (i = m->interfaces; i; i = i->interface_next)
-        for (ia = i->addresses; ia; ia = ia->address_next)
-            if (avahi_address_cmp(a, &ia->address) == 0)
-                return 1;
-
-    return 0;
+    return !!avahi_hashmap_lookup(m->address_hashmap, a);
 }
 
 int avahi_interface_address_on_link(AvahiInterface *i, const AvahiAddress *a) {
-    AvahiInterfaceAddress *ia;
-
     assert(i);
     assert(a);
 
     if (a->proto != i->protocol)
         return 0;
 
-    for (ia = i->addresses; ia; ia = ia->address_next) {
-
-        if (a->proto == AVAHI_PROTO_INET) {
-            uint32_t m;
-
-            m = ~(((uint32_t) -1) >> ia->prefix_len);
-
-            if ((ntohl(a->data.ipv4.address) & m) == (ntohl(ia->address.data.ipv4.address) & m))
-                return 1;
-        } else {
-            unsigned j;
-            unsigned char pl;
-            assert(a->proto == AVAHI_PROTO_INET6);
-
-            pl = ia->prefix_len;
-
-            for (j = 0; j < 16; j++) {
-                uint8_t m;
-
-                if (pl >= 8) {
-                    m = 0xFF;
-                    pl -= 8;
-                } else {
-                    m = ~(0xFF >> pl);
-                    pl = 0;
-                }
-
-                if ((a->data.ipv6.address[j] & m) != (ia->address.data.ipv6.address[j] & m))
-                    break;
-
-                if (pl == 0)
-                    return 1;
-            }
-        }
-    }
-
-    return 0;
+    return avahi_prefix_tree_match(i->prefix_tree, a->data.data);
 }
 
 int avahi_interface_has_address(AvahiInterfaceMonitor *m, AvahiIfIndex iface, const AvahiAddress *a) {
-    AvahiInterface *i;
-    AvahiInterfaceAddress *j;
+    AvahiInterfaceAddress *ia;
 
     assert(m);
     assert(iface != AVAHI_IF_UNSPEC);
     assert(a);
 
-    if (!(i = avahi_interface_monitor_get_interface(m, iface, a->proto)))
-        return 0;
-
-    for (j = i->addresses; j; j = j->address_next)
-        if (avahi_address_cmp(a, &j->address) == 0)
+    for (ia = avahi_hashmap_lookup(m->address_hashmap, a); ia; ia = ia->by_address_next)
+        if (ia->interface->hardware->index == iface)
             return 1;
 
     return 0;
 }
 
 AvahiIfIndex avahi_find_interface_for_address(AvahiInterfaceMonitor *m, const AvahiAddress *a) {
-    AvahiInterface *i;
+    AvahiInterfaceAddress *ia;
+
     assert(m);
+    assert(a);
 
     /* Some stupid OS don't support passing the interface index when a
      * packet is received. We have to work around that limitation by
@@ -853,16 +894,8 @@ AvahiIfIndex avahi_find_interface_for_address(AvahiInterfaceMonitor *m, const Av
      * attached. This is sometimes ambiguous, but we have to live with
      * it. */
 
-    for (i = m->interfaces; i; i = i->interface_next) {
-        AvahiInterfaceAddress *ai;
-
-        if (i->protocol != a->proto)
-            continue;
-
-        for (ai = i->addresses; ai; ai = ai->address_next)
-            if (avahi_address_cmp(a, &ai->address) == 0)
-                return i->hardware->index;
-    }
+    if ((ia = avahi_hashmap_lookup(m->address_hashmap, a)))
+        return ia->interface->hardware->index;
 
     return AVAHI_IF_UNSPEC;
 }
@@ -37,6 +37,8 @@ typedef struct AvahiHwInterface AvahiHwInterface;
 #include "announce.h"
 #include "browse.h"
 #include "querier.h"
+#include "prefix-tree.h"
+#include "response-memo.h"
 
 #ifdef HAVE_NETLINK
 #include "iface-linux.h"
@@ -62,6 +64,11 @@ struct AvahiInterfaceMonitor {
     AvahiServer *server;
     AvahiHashmap *hashmap;
 
+    /* All interface addresses, indexed by address. The same address
+     * may be configured on more than one interface, hence the values
+     * are the heads of by_address lists. */
+    AvahiHashmap *address_hashmap;
+
     AVAHI_LLIST_HEAD(AvahiInterface, interfaces);
     AVAHI_LLIST_HEAD(AvahiHwInterface, hw_interfaces);
 
@@ -110,9 +117,15 @@ struct AvahiInterface {
     AvahiResponseScheduler * response_scheduler;
     AvahiProbeScheduler *probe_scheduler;
 
+    /* Legacy unicast replies sent on this interface */
+    AvahiResponseMemo *response_memo;
+
     AVAHI_LLIST_HEAD(AvahiInterfaceAddress, addresses);
     AVAHI_LLIST_HEAD(AvahiAnnouncer, announcers);
 
+    /* The prefixes of all addresses, for avahi_interface_address_on_link() */
+    AvahiPrefixTree *prefix_tree;
+
     AvahiHashmap *queriers_by_key;
     AVAHI_LLIST_HEAD(AvahiQuerier, queriers);
 };
@@ -122,6 +135,7 @@ struct AvahiInterfaceAddress {
     AvahiInterface *interface;
 
     AVAHI_LLIST_FIELDS(AvahiInterfaceAddress, address);
+    AVAHI_LLIST_FIELDS(AvahiInterfaceAddress, by_address);
 
     AvahiAddress address;
     unsigned prefix_len;
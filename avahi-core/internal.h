@@ -24,6 +24,7 @@
 typedef struct AvahiEntry AvahiEntry;
 
 #include <avahi-common/llist.h>
+#include <avahi-common/pool.h>
 #include <avahi-common/watch.h>
 #include <avahi-common/timeval.h>
 
@@ -39,6 +40,7 @@ typedef struct AvahiEntry AvahiEntry;
 #include "wide-area.h"
 #include "multicast-lookup.h"
 #include "dns-srv-rr.h"
+#include "socket.h"
 
 #define AVAHI_LEGACY_UNICAST_REFLECT_SLOTS_MAX 100
 
@@ -74,7 +76,9 @@ struct AvahiEntry {
 
     AVAHI_LLIST_FIELDS(AvahiEntry, entries);
     AVAHI_LLIST_FIELDS(AvahiEntry, by_key);
+    AVAHI_LLIST_FIELDS(AvahiEntry, by_name);
     AVAHI_LLIST_FIELDS(AvahiEntry, by_group);
+    AVAHI_LLIST_FIELDS(AvahiEntry, dead);
 
     AVAHI_LLIST_HEAD(AvahiAnnouncer, announcers);
 };
@@ -96,6 +100,7 @@ struct AvahiSEntryGroup {
     struct timeval established_at;
 
     AVAHI_LLIST_FIELDS(AvahiSEntryGroup, groups);
+    AVAHI_LLIST_FIELDS(AvahiSEntryGroup, dead);
     AVAHI_LLIST_HEAD(AvahiEntry, entries);
 };
 
@@ -108,6 +113,13 @@ struct AvahiServer {
     AVAHI_LLIST_HEAD(AvahiEntry, entries);
     AvahiHashmap *entries_by_key;
 
+    /* Entries indexed by name only, for ANY queries */
+    AvahiHashmap *entries_by_name;
+
+    /* Changed whenever an entry or the state of one of its announcers
+     * changes, invalidating the replies kept in the response memos */
+    unsigned response_generation;
+
     AVAHI_LLIST_HEAD(AvahiSEntryGroup, groups);
 
     AVAHI_LLIST_HEAD(AvahiSRecordBrowser, record_browsers);
@@ -120,7 +132,11 @@ struct AvahiServer {
     AVAHI_LLIST_HEAD(AvahiSServiceResolver, service_resolvers);
     AVAHI_LLIST_HEAD(AvahiSDNSServerBrowser, dns_server_browsers);
 
-    int need_entry_cleanup, need_group_cleanup, need_browser_cleanup;
+    /* Objects that have been freed by the user but not yet released,
+     * see avahi_cleanup_dead_entries() */
+    AVAHI_LLIST_HEAD(AvahiEntry, dead_entries);
+    AVAHI_LLIST_HEAD(AvahiSEntryGroup, dead_groups);
+    AVAHI_LLIST_HEAD(AvahiSRecordBrowser, dead_record_browsers);
 
     /* Used for scheduling RR cleanup */
     AvahiTimeEvent *cleanup_time_event;
@@ -136,6 +152,15 @@ struct AvahiServer {
     AvahiWatch *watch_ipv4, *watch_ipv6,
         *watch_legacy_unicast_ipv4, *watch_legacy_unicast_ipv6;
 
+    /* Packet buffers all sockets are read into, recv_batch_size
+     * packets at a time */
+    AvahiRecvBatch *recv_batch;
+
+    /* Outgoing packets waiting for the next main loop iteration, NULL
+     * if send_batch_size is <= 1 */
+    AvahiSendQueue *send_queue;
+    AvahiTimeout *send_queue_timeout;
+
     AvahiServerState state;
     AvahiServerCallback callback;
     void* userdata;
@@ -159,11 +184,25 @@ struct AvahiServer {
 
     AvahiMulticastLookupEngine *multicast_lookup_engine;
     AvahiWideAreaLookupEngine *wide_area_lookup_engine;
+
+    /* Object pools for the per-interface caches and schedulers */
+    AvahiPool *cache_entry_pool;
+    AvahiPool *response_job_pool, *query_job_pool, *probe_job_pool;
+
+    /* Records shared between the per-interface caches, if enabled */
+    AvahiHashmap *cache_records;
+
+    /* Keys parsed from incoming packets */
+    AvahiKeyTable *key_table;
 };
 
 void avahi_entry_free(AvahiServer*s, AvahiEntry *e);
 void avahi_entry_group_free(AvahiServer *s, AvahiSEntryGroup *g);
 
+/* Mark the entry as dead, so that it is freed by the next call to
+ * avahi_cleanup_dead_entries() */
+void avahi_entry_mark_dead(AvahiServer *s, AvahiEntry *e);
+
 void avahi_cleanup_dead_entries(AvahiServer *s);
 
 void avahi_server_prepare_response(AvahiServer *s, AvahiInterface *i, AvahiEntry *e, int unicast_response, int auxiliary);
@@ -182,6 +221,10 @@ void avahi_server_decrease_host_rr_pending(AvahiServer *s);
 
 int avahi_server_set_errno(AvahiServer *s, int error);
 
+/* Like avahi_send_dns_packet_ipv4/ipv6(), but through the transmit queue if enabled */
+int avahi_server_send_dns_packet_ipv4(AvahiServer *s, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv4Address *src_address, const AvahiIPv4Address *dst_address, uint16_t dst_port);
+int avahi_server_send_dns_packet_ipv6(AvahiServer *s, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv6Address *src_address, const AvahiIPv6Address *dst_address, uint16_t dst_port);
+
 int avahi_server_is_service_local(AvahiServer *s, AvahiIfIndex interface, AvahiProtocol protocol, const char *name);
 int avahi_server_is_record_local(AvahiServer *s, AvahiIfIndex interface, AvahiProtocol protocol, AvahiRecord *record);
 
@@ -0,0 +1,204 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+
+#include "prefix-tree.h"
+
+#define N_PREFIXES 500
+#define N_LOOKUPS 100000
+
+typedef struct Prefix {
+    uint8_t address[16];
+    unsigned prefix_len;
+} Prefix;
+
+/* What avahi_interface_address_on_link() did before, one address at a time */
+static int linear_match(const Prefix *prefixes, unsigned n, const uint8_t *address) {
+    unsigned i, j;
+
+    for (i = 0; i < n; i++) {
+        unsigned pl = prefixes[i].prefix_len;
+
+        for (j = 0; j < 16; j++) {
+            uint8_t m;
+
+            if (pl == 0)
+                return 1;
+
+            if (pl >= 8) {
+                m = 0xFF;
+                pl -= 8;
+            } else {
+                m = ~(0xFF >> pl);
+                pl = 0;
+            }
+
+            if ((address[j] & m) != (prefixes[i].address[j] & m))
+                break;
+        }
+
+        if (j == 16)
+            return 1;
+    }
+
+    return 0;
+}
+
+static void random_address(uint8_t *address) {
+    unsigned j;
+
+    for (j = 0; j < 16; j++)
+        address[j] = (uint8_t) rand();
+}
+
+static void check_ipv4(void) {
+    AvahiPrefixTree *t;
+    uint8_t a[4];
+
+    t = avahi_prefix_tree_new(32);
+    assert(t);
+
+    memcpy(a, "\xc0\xa8\x32\x01", 4);
+    assert(!avahi_prefix_tree_match(t, a));
+
+    /* 192.168.50.1/24 */
+    assert(avahi_prefix_tree_add(t, a, 24) == 0);
+    assert(avahi_prefix_tree_match(t, a));
+    memcpy(a, "\xc0\xa8\x32\xff", 4);
+    assert(avahi_prefix_tree_match(t, a));
+    memcpy(a, "\xc0\xa8\x33\x01", 4);
+    assert(!avahi_prefix_tree_match(t, a));
+
+    /* 10.0.0.1/32 only covers itself */
+    memcpy(a, "\x0a\x00\x00\x01", 4);
+    assert(avahi_prefix_tree_add(t, a, 32) == 0);
+    assert(avahi_prefix_tree_match(t, a));
+    memcpy(a, "\x0a\x00\x00\x02", 4);
+    assert(!avahi_prefix_tree_match(t, a));
+
+    /* After clearing nothing matches, until a default route shows up */
+    avahi_prefix_tree_clear(t);
+    assert(!avahi_prefix_tree_match(t, a));
+    assert(avahi_prefix_tree_add(t, a, 0) == 0);
+    memcpy(a, "\x08\x08\x08\x08", 4);
+    assert(avahi_prefix_tree_match(t, a));
+
+    avahi_prefix_tree_free(t);
+}
+
+static void check_ipv6(void) {
+    AvahiPrefixTree *t;
+    Prefix *prefixes;
+    struct timeval start;
+    AvahiUsec tree_usec, linear_usec;
+    Prefix *addresses;
+    unsigned i, n, n_matches, n_linear;
+
+    prefixes = avahi_new(Prefix, N_PREFIXES);
+    addresses = avahi_new(Prefix, N_LOOKUPS);
+
+    /* Hundreds of addresses, most of them /64 like on a busy router,
+     * some sharing a prefix and a few odd prefix lengths */
+    for (i = 0; i < N_PREFIXES; i++) {
+        random_address(prefixes[i].address);
+        prefixes[i].address[0] = 0xfd;
+
+        if (i % 5 == 1)
+            memcpy(prefixes[i].address, prefixes[i-1].address, 8);
+
+        prefixes[i].prefix_len = i % 50 == 0 ? (unsigned) (rand() % 129) : 64;
+        if (prefixes[i].prefix_len < 8)
+            prefixes[i].prefix_len += 8;
+    }
+
+    t = avahi_prefix_tree_new(128);
+    assert(t);
+
+    for (i = 0; i < N_PREFIXES; i++)
+        assert(avahi_prefix_tree_add(t, prefixes[i].address, prefixes[i].prefix_len) == 0);
+
+    /* Half of the addresses are close to one of the prefixes */
+    for (i = 0; i < N_LOOKUPS; i++) {
+        random_address(addresses[i].address);
+
+        if (i & 1)
+            memcpy(addresses[i].address, prefixes[rand() % N_PREFIXES].address, 8 + rand() % 8);
+    }
+
+    for (i = 0, n_matches = 0; i < N_LOOKUPS; i++) {
+        int r = avahi_prefix_tree_match(t, addresses[i].address);
+
+        assert(r == linear_match(prefixes, N_PREFIXES, addresses[i].address));
+        if (r)
+            n_matches++;
+    }
+
+    /* Drop prefixes like avahi_interface_address_free() does */
+    for (n = N_PREFIXES; n > N_PREFIXES - 50; n--) {
+        avahi_prefix_tree_clear(t);
+
+        for (i = 0; i < n - 1; i++)
+            assert(avahi_prefix_tree_add(t, prefixes[i].address, prefixes[i].prefix_len) == 0);
+
+        for (i = 0; i < 1000; i++)
+            assert(avahi_prefix_tree_match(t, addresses[i].address) == linear_match(prefixes, n - 1, addresses[i].address));
+    }
+
+    gettimeofday(&start, NULL);
+    for (i = 0, n_matches = 0; i < N_LOOKUPS; i++)
+        n_matches += !!avahi_prefix_tree_match(t, addresses[i].address);
+    tree_usec = avahi_age(&start);
+
+    gettimeofday(&start, NULL);
+    for (i = 0, n_linear = 0; i < N_LOOKUPS; i++)
+        n_linear += linear_match(prefixes, n, addresses[i].address);
+    linear_usec = avahi_age(&start);
+
+    assert(n_matches == n_linear);
+
+    printf("%u prefixes, %u of %u addresses on link: tree %6.1f ns/op, linear %8.1f ns/op\n",
+           n, n_matches, N_LOOKUPS,
+           (double) tree_usec * 1000 / N_LOOKUPS,
+           (double) linear_usec * 1000 / N_LOOKUPS);
+
+    avahi_prefix_tree_free(t);
+    avahi_free(prefixes);
+    avahi_free(addresses);
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+
+    check_ipv4();
+    check_ipv6();
+
+    return 0;
+}
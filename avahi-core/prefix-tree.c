@@ -0,0 +1,138 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include <avahi-common/malloc.h>
+
+#include "prefix-tree.h"
+
+/* The nodes are stored in a single array, the root being the first
+ * element. Since the root is nobody's child, a child index of 0 means
+ * there is no child. */
+
+#define NODES_MIN 16
+
+typedef struct Node {
+    uint32_t child[2];
+    int terminal;
+} Node;
+
+struct AvahiPrefixTree {
+    unsigned max_prefix_len;
+
+    Node *nodes;
+    unsigned n_nodes, n_allocated;
+};
+
+static int bit(const uint8_t *p, unsigned i) {
+    return (p[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+AvahiPrefixTree *avahi_prefix_tree_new(unsigned max_prefix_len) {
+    AvahiPrefixTree *t;
+
+    if (!(t = avahi_new(AvahiPrefixTree, 1)))
+        return NULL;
+
+    t->max_prefix_len = max_prefix_len;
+    t->n_allocated = NODES_MIN;
+
+    if (!(t->nodes = avahi_new(Node, t->n_allocated))) {
+        avahi_free(t);
+        return NULL;
+    }
+
+    avahi_prefix_tree_clear(t);
+
+    return t;
+}
+
+void avahi_prefix_tree_free(AvahiPrefixTree *t) {
+    assert(t);
+
+    avahi_free(t->nodes);
+    avahi_free(t);
+}
+
+void avahi_prefix_tree_clear(AvahiPrefixTree *t) {
+    assert(t);
+
+    memset(&t->nodes[0], 0, sizeof(Node));
+    t->n_nodes = 1;
+}
+
+int avahi_prefix_tree_add(AvahiPrefixTree *t, const uint8_t *prefix, unsigned prefix_len) {
+    unsigned i, n = 0;
+
+    assert(t);
+    assert(prefix);
+    assert(prefix_len <= t->max_prefix_len);
+
+    /* We always store the full path, even below a shorter terminal
+     * prefix, so that any subset of the prefixes fits into the nodes
+     * the full set needed. */
+
+    for (i = 0; i < prefix_len; i++) {
+        int b = bit(prefix, i);
+
+        if (!t->nodes[n].child[b]) {
+
+            if (t->n_nodes >= t->n_allocated) {
+                Node *nodes;
+
+                if (!(nodes = avahi_realloc(t->nodes, sizeof(Node) * t->n_allocated * 2)))
+                    return -1;
+
+                t->nodes = nodes;
+                t->n_allocated *= 2;
+            }
+
+            memset(&t->nodes[t->n_nodes], 0, sizeof(Node));
+            t->nodes[n].child[b] = t->n_nodes++;
+        }
+
+        n = t->nodes[n].child[b];
+    }
+
+    t->nodes[n].terminal = 1;
+
+    return 0;
+}
+
+int avahi_prefix_tree_match(AvahiPrefixTree *t, const uint8_t *address) {
+    unsigned i, n = 0;
+
+    assert(t);
+    assert(address);
+
+    for (i = 0;; i++) {
+
+        if (t->nodes[n].terminal)
+            return 1;
+
+        if (i >= t->max_prefix_len || !(n = t->nodes[n].child[bit(address, i)]))
+            return 0;
+    }
+}
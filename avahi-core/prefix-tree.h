@@ -0,0 +1,51 @@
+#ifndef fooprefixtreehfoo
+#define fooprefixtreehfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <inttypes.h>
+
+#include <avahi-common/cdecl.h>
+
+AVAHI_C_DECL_BEGIN
+
+/* A binary trie of network prefixes, used for checking whether an
+ * address is on link in time proportional to the prefix length
+ * instead of the number of addresses. Prefixes and addresses are
+ * passed in network byte order. */
+typedef struct AvahiPrefixTree AvahiPrefixTree;
+
+AvahiPrefixTree *avahi_prefix_tree_new(unsigned max_prefix_len);
+void avahi_prefix_tree_free(AvahiPrefixTree *t);
+
+/* Remove all prefixes, but keep the memory for the next round of
+ * avahi_prefix_tree_add(). Adding a subset of the previous prefixes
+ * after this never allocates. */
+void avahi_prefix_tree_clear(AvahiPrefixTree *t);
+
+/* Returns 0 on success, -1 on OOM */
+int avahi_prefix_tree_add(AvahiPrefixTree *t, const uint8_t *prefix, unsigned prefix_len);
+
+/* Returns non-zero if any prefix in the tree covers the address */
+int avahi_prefix_tree_match(AvahiPrefixTree *t, const uint8_t *address);
+
+AVAHI_C_DECL_END
+
+#endif
@@ -26,7 +26,11 @@
 #include <stdio.h>
 #include <assert.h>
 
+#include <sys/time.h>
+
 #include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
 
 #include "prioq.h"
 
@@ -43,41 +47,65 @@ static int compare_ptr(const void* a, const void* b) {
     return a < b ? -1 : (a > b ? 1 : 0);
 }
 
-static void rec(AvahiPrioQueueNode *n) {
-    if (!n)
-        return;
+static void check(AvahiPrioQueue *q) {
+    unsigned i;
+
+    assert(q->n_nodes <= q->n_allocated);
 
-    if (n->left)
-        assert(n->left->parent == n);
+    for (i = 0; i < q->n_nodes; i++) {
+        AvahiPrioQueueNode *n = q->nodes[i];
 
-    if (n->right)
-        assert(n->right->parent == n);
+        assert(n->queue == q);
+        assert(n->idx == i);
 
-    if (n->parent) {
-        assert(n->parent->left == n || n->parent->right == n);
+        if (i > 0) {
+            AvahiPrioQueueNode *p = q->nodes[(i-1)/2];
 
-        if (n->parent->left == n)
-            assert(n->next == n->parent->right);
+            if (q->compare(p->data, n->data) > 0) {
+                printf("%u <= %u: NO\n", (i-1)/2, i);
+                abort();
+            }
+        }
     }
+}
 
-    if (!n->next) {
-        assert(n->queue->last == n);
+static void benchmark(unsigned n_nodes) {
+    AvahiPrioQueue *q;
+    AvahiPrioQueueNode **nodes;
+    struct timeval start;
+    AvahiUsec put_usec, shuffle_usec, remove_usec;
+    unsigned i;
 
-        if (n->parent && n->parent->left == n)
-            assert(n->parent->right == NULL);
+    q = avahi_prio_queue_new(compare_int);
+    nodes = avahi_new(AvahiPrioQueueNode*, n_nodes);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_nodes; i++)
+        nodes[i] = avahi_prio_queue_put(q, INT_TO_POINTER(random() & 0xFFFFFF));
+    put_usec = avahi_age(&start);
+
+    /* Like the time event queue does when an event is rescheduled */
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n_nodes; i++) {
+        AvahiPrioQueueNode *n = nodes[random() % n_nodes];
+        n->data = INT_TO_POINTER(random() & 0xFFFFFF);
+        avahi_prio_queue_shuffle(q, n);
     }
+    shuffle_usec = avahi_age(&start);
 
+    gettimeofday(&start, NULL);
+    while (avahi_prio_queue_root(q))
+        avahi_prio_queue_remove(q, avahi_prio_queue_root(q));
+    remove_usec = avahi_age(&start);
 
-    if (n->parent) {
-        int a = POINTER_TO_INT(n->parent->data), b = POINTER_TO_INT(n->data);
-        if (a > b) {
-            printf("%i <= %i: NO\n", a, b);
-            abort();
-        }
-    }
+    fprintf(stderr, "%7u nodes: put %7.1f ns/op, shuffle %7.1f ns/op, remove root %7.1f ns/op\n",
+            n_nodes,
+            (double) put_usec * 1000 / n_nodes,
+            (double) shuffle_usec * 1000 / n_nodes,
+            (double) remove_usec * 1000 / n_nodes);
 
-    rec(n->left);
-    rec(n->right);
+    avahi_free(nodes);
+    avahi_prio_queue_free(q);
 }
 
 int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
@@ -92,16 +120,16 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
     for (i = 0; i < 10000; i++)
         avahi_prio_queue_put(q2, avahi_prio_queue_put(q, INT_TO_POINTER(random() & 0xFFFF)));
 
-    while (q2->root) {
-        rec(q->root);
-        rec(q2->root);
+    while (avahi_prio_queue_root(q2)) {
+        check(q);
+        check(q2);
 
         assert(q->n_nodes == q2->n_nodes);
 
-        printf("%i\n", POINTER_TO_INT(((AvahiPrioQueueNode*)q2->root->data)->data));
+        printf("%i\n", POINTER_TO_INT(((AvahiPrioQueueNode*)avahi_prio_queue_root(q2)->data)->data));
 
-        avahi_prio_queue_remove(q, q2->root->data);
-        avahi_prio_queue_remove(q2, q2->root);
+        avahi_prio_queue_remove(q, avahi_prio_queue_root(q2)->data);
+        avahi_prio_queue_remove(q2, avahi_prio_queue_root(q2));
     }
 
 
@@ -116,5 +144,11 @@ int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
 /*     } */
 
     avahi_prio_queue_free(q);
+    avahi_prio_queue_free(q2);
+
+    benchmark(1000);
+    benchmark(10000);
+    benchmark(100000);
+
     return 0;
 }
@@ -28,6 +28,11 @@
 
 #include "prioq.h"
 
+#define PRIOQ_ALLOCATED_MIN 16
+
+#define PARENT(i) (((i) - 1) / 2)
+#define LEFT(i) (2 * (i) + 1)
+
 AvahiPrioQueue* avahi_prio_queue_new(AvahiPQCompareFunc compare) {
     AvahiPrioQueue *q;
     assert(compare);
@@ -35,8 +40,8 @@ AvahiPrioQueue* avahi_prio_queue_new(AvahiPQCompareFunc compare) {
     if (!(q = avahi_new(AvahiPrioQueue, 1)))
         return NULL; /* OOM */
 
-    q->root = q->last = NULL;
-    q->n_nodes = 0;
+    q->nodes = NULL;
+    q->n_nodes = q->n_allocated = 0;
     q->compare = compare;
 
     return q;
@@ -45,213 +50,68 @@ AvahiPrioQueue* avahi_prio_queue_new(AvahiPQCompareFunc compare) {
 void avahi_prio_queue_free(AvahiPrioQueue *q) {
     assert(q);
 
-    while (q->last)
-        avahi_prio_queue_remove(q, q->last);
+    /* Only nodes allocated by avahi_prio_queue_put() may still be
+     * linked in at this point */
+    while (q->n_nodes > 0)
+        avahi_prio_queue_remove(q, q->nodes[q->n_nodes-1]);
 
-    assert(!q->n_nodes);
+    avahi_free(q->nodes);
     avahi_free(q);
 }
 
-static AvahiPrioQueueNode* get_node_at_xy(AvahiPrioQueue *q, unsigned x, unsigned y) {
-    unsigned r;
-    AvahiPrioQueueNode *n;
-    assert(q);
-
-    n = q->root;
-    assert(n);
-
-    for (r = 0; r < y; r++) {
-        assert(n);
+static void set_node(AvahiPrioQueue *q, unsigned idx, AvahiPrioQueueNode *n) {
+    q->nodes[idx] = n;
+    n->idx = idx;
+}
 
-        if ((x >> (y-r-1)) & 1)
-            n = n->right;
-        else
-            n = n->left;
-    }
+static int sift_up(AvahiPrioQueue *q, AvahiPrioQueueNode *n) {
+    unsigned idx = n->idx;
+    int moved = 0;
 
-    assert(n->x == x);
-    assert(n->y == y);
+    while (idx > 0) {
+        AvahiPrioQueueNode *p = q->nodes[PARENT(idx)];
 
-    return n;
-}
+        if (q->compare(p->data, n->data) <= 0)
+            break;
 
-static void exchange_nodes(AvahiPrioQueue *q, AvahiPrioQueueNode *a, AvahiPrioQueueNode *b) {
-    AvahiPrioQueueNode *l, *r, *p, *ap, *an, *bp, *bn;
-    unsigned t;
-    assert(q);
-    assert(a);
-    assert(b);
-    assert(a != b);
-
-    /* Swap positions */
-    t = a->x; a->x = b->x; b->x = t;
-    t = a->y; a->y = b->y; b->y = t;
-
-    if (a->parent == b) {
-        /* B is parent of A */
-
-        p = b->parent;
-        b->parent = a;
-
-        if ((a->parent = p)) {
-            if (a->parent->left == b)
-                a->parent->left = a;
-            else
-                a->parent->right = a;
-        } else
-            q->root = a;
-
-        if (b->left == a) {
-            if ((b->left = a->left))
-                b->left->parent = b;
-            a->left = b;
-
-            r = a->right;
-            if ((a->right = b->right))
-                a->right->parent = a;
-            if ((b->right = r))
-                b->right->parent = b;
-
-        } else {
-            if ((b->right = a->right))
-                b->right->parent = b;
-            a->right = b;
-
-            l = a->left;
-            if ((a->left = b->left))
-                a->left->parent = a;
-            if ((b->left = l))
-                b->left->parent = b;
-        }
-    } else if (b->parent == a) {
-        /* A is parent of B */
-
-        p = a->parent;
-        a->parent = b;
-
-        if ((b->parent = p)) {
-            if (b->parent->left == a)
-                b->parent->left = b;
-            else
-                b->parent->right = b;
-        } else
-            q->root = b;
-
-        if (a->left == b) {
-            if ((a->left = b->left))
-                a->left->parent = a;
-            b->left = a;
-
-            r = a->right;
-            if ((a->right = b->right))
-                a->right->parent = a;
-            if ((b->right = r))
-                b->right->parent = b;
-        } else {
-            if ((a->right = b->right))
-                a->right->parent = a;
-            b->right = a;
-
-            l = a->left;
-            if ((a->left = b->left))
-                a->left->parent = a;
-            if ((b->left = l))
-                b->left->parent = b;
-        }
-    } else {
-        AvahiPrioQueueNode *apl = NULL, *bpl = NULL;
-
-        /* Swap parents */
-        ap = a->parent;
-        bp = b->parent;
-
-        if (ap)
-            apl = ap->left;
-        if (bp)
-            bpl = bp->left;
-
-        if ((a->parent = bp)) {
-            if (bpl == b)
-                bp->left = a;
-            else
-                bp->right = a;
-        } else
-            q->root = a;
-
-        if ((b->parent = ap)) {
-            if (apl == a)
-                ap->left = b;
-            else
-                ap->right = b;
-        } else
-            q->root = b;
-
-        /* Swap children */
-        l = a->left;
-        r = a->right;
-
-        if ((a->left = b->left))
-            a->left->parent = a;
-
-        if ((b->left = l))
-            b->left->parent = b;
-
-        if ((a->right = b->right))
-            a->right->parent = a;
-
-        if ((b->right = r))
-            b->right->parent = b;
+        set_node(q, idx, p);
+        idx = PARENT(idx);
+        moved = 1;
     }
 
-    /* Swap siblings */
-    ap = a->prev; an = a->next;
-    bp = b->prev; bn = b->next;
+    if (moved)
+        set_node(q, idx, n);
 
-    if (a->next == b) {
-        /* A is predecessor of B */
-        a->prev = b;
-        b->next = a;
-
-        if ((a->next = bn))
-            a->next->prev = a;
-        else
-            q->last = a;
-
-        if ((b->prev = ap))
-            b->prev->next = b;
+    return moved;
+}
 
-    } else if (b->next == a) {
-        /* B is predecessor of A */
-        a->next = b;
-        b->prev = a;
+static void sift_down(AvahiPrioQueue *q, AvahiPrioQueueNode *n) {
+    unsigned idx = n->idx;
 
-        if ((a->prev = bp))
-            a->prev->next = a;
+    for (;;) {
+        unsigned c = LEFT(idx);
+        AvahiPrioQueueNode *min;
 
-        if ((b->next = an))
-            b->next->prev = b;
-        else
-            q->last = b;
+        if (c >= q->n_nodes)
+            /* No children */
+            break;
 
-    } else {
-        /* A is no neighbour of B */
+        min = q->nodes[c];
 
-        if ((a->prev = bp))
-            a->prev->next = a;
+        if (c+1 < q->n_nodes && q->compare(q->nodes[c+1]->data, min->data) < 0)
+            min = q->nodes[++c];
 
-        if ((a->next = bn))
-            a->next->prev = a;
-        else
-            q->last = a;
+        /* min now contains the smaller one of our two children */
 
-        if ((b->prev = ap))
-            b->prev->next = b;
+        if (q->compare(n->data, min->data) <= 0)
+            /* Order OK */
+            break;
 
-        if ((b->next = an))
-            b->next->prev = b;
-        else
-            q->last = b;
+        set_node(q, idx, min);
+        idx = c;
     }
+
+    set_node(q, idx, n);
 }
 
 /* Move a node to the correct position */
@@ -259,80 +119,70 @@ void avahi_prio_queue_shuffle(AvahiPrioQueue *q, AvahiPrioQueueNode *n) {
     assert(q);
     assert(n);
     assert(n->queue == q);
+    assert(n->idx < q->n_nodes);
+    assert(q->nodes[n->idx] == n);
 
-    /* Move up until the position is OK */
-    while (n->parent && q->compare(n->parent->data, n->data) > 0)
-        exchange_nodes(q, n, n->parent);
-
-    /* Move down until the position is OK */
-    for (;;) {
-        AvahiPrioQueueNode *min;
+    if (!sift_up(q, n))
+        sift_down(q, n);
+}
 
-        if (!(min = n->left)) {
-            /* No children */
-            assert(!n->right);
-            break;
-        }
+int avahi_prio_queue_link(AvahiPrioQueue *q, AvahiPrioQueueNode *n, void *data) {
+    assert(q);
+    assert(n);
 
-        if (n->right && q->compare(n->right->data, min->data) < 0)
-            min = n->right;
+    if (q->n_nodes >= q->n_allocated) {
+        AvahiPrioQueueNode **nodes;
+        unsigned n_allocated;
 
-        /* min now contains the smaller one of our two children */
+        n_allocated = q->n_allocated > 0 ? q->n_allocated * 2 : PRIOQ_ALLOCATED_MIN;
 
-        if (q->compare(n->data, min->data) <= 0)
-            /* Order OK */
-            break;
+        if (!(nodes = avahi_realloc(q->nodes, sizeof(AvahiPrioQueueNode*) * n_allocated)))
+            return -1; /* OOM */
 
-        exchange_nodes(q, n, min);
+        q->nodes = nodes;
+        q->n_allocated = n_allocated;
     }
-}
-
-AvahiPrioQueueNode* avahi_prio_queue_put(AvahiPrioQueue *q, void* data) {
-    AvahiPrioQueueNode *n;
-    assert(q);
-
-    if (!(n = avahi_new(AvahiPrioQueueNode, 1)))
-        return NULL; /* OOM */
 
     n->queue = q;
     n->data = data;
 
-    if (q->last) {
-        assert(q->root);
-        assert(q->n_nodes);
+    set_node(q, q->n_nodes++, n);
+    sift_up(q, n);
 
-        n->y = q->last->y;
-        n->x = q->last->x+1;
-
-        if (n->x >= ((unsigned) 1 << n->y)) {
-            n->x = 0;
-            n->y++;
-        }
+    return 0;
+}
 
-        q->last->next = n;
-        n->prev = q->last;
+void avahi_prio_queue_unlink(AvahiPrioQueue *q, AvahiPrioQueueNode *n) {
+    AvahiPrioQueueNode *replacement;
 
-        assert(n->y > 0);
-        n->parent = get_node_at_xy(q, n->x/2, n->y-1);
+    assert(q);
+    assert(n);
+    assert(q == n->queue);
+    assert(n->idx < q->n_nodes);
+    assert(q->nodes[n->idx] == n);
 
-        if (n->x & 1)
-            n->parent->right = n;
-        else
-            n->parent->left = n;
-    } else {
-        assert(!q->root);
-        assert(!q->n_nodes);
+    replacement = q->nodes[--q->n_nodes];
 
-        n->y = n->x = 0;
-        q->root = n;
-        n->prev = n->parent = NULL;
+    if (replacement != n) {
+        /* Move the last node into the hole and fix up its position */
+        set_node(q, n->idx, replacement);
+        avahi_prio_queue_shuffle(q, replacement);
     }
 
-    n->next = n->left = n->right = NULL;
-    q->last = n;
-    q->n_nodes++;
+    n->queue = NULL;
+}
+
+AvahiPrioQueueNode* avahi_prio_queue_put(AvahiPrioQueue *q, void* data) {
+    AvahiPrioQueueNode *n;
+    assert(q);
 
-    avahi_prio_queue_shuffle(q, n);
+    if (!(n = avahi_new(AvahiPrioQueueNode, 1)))
+        return NULL; /* OOM */
+
+    if (avahi_prio_queue_link(q, n, data) < 0) {
+        avahi_free(n);
+        return NULL;
+    }
 
     return n;
 }
@@ -340,49 +190,7 @@ AvahiPrioQueueNode* avahi_prio_queue_put(AvahiPrioQueue *q, void* data) {
 void avahi_prio_queue_remove(AvahiPrioQueue *q, AvahiPrioQueueNode *n) {
     assert(q);
     assert(n);
-    assert(q == n->queue);
-
-    if (n != q->last) {
-        AvahiPrioQueueNode *replacement = q->last;
-        exchange_nodes(q, replacement, n);
-        avahi_prio_queue_remove(q, n);
-        avahi_prio_queue_shuffle(q, replacement);
-        return;
-    }
-
-    assert(n == q->last);
-    assert(!n->next);
-    assert(!n->left);
-    assert(!n->right);
-
-    q->last = n->prev;
-
-    if (n->prev) {
-        n->prev->next = NULL;
-        assert(n->parent);
-    } else
-        assert(!n->parent);
-
-    if (n->parent) {
-        assert(n->prev);
-        if (n->parent->left == n) {
-            assert(n->parent->right == NULL);
-            n->parent->left = NULL;
-        } else {
-            assert(n->parent->right == n);
-            assert(n->parent->left != NULL);
-            n->parent->right = NULL;
-        }
-    } else {
-        assert(q->root == n);
-        assert(!n->prev);
-        assert(q->n_nodes == 1);
-        q->root = NULL;
-    }
 
+    avahi_prio_queue_unlink(q, n);
     avahi_free(n);
-
-    assert(q->n_nodes > 0);
-    q->n_nodes--;
 }
-
@@ -25,17 +25,20 @@ typedef struct AvahiPrioQueueNode AvahiPrioQueueNode;
 
 typedef int (*AvahiPQCompareFunc)(const void* a, const void* b);
 
+/* A binary heap, stored in a contiguous array of node pointers */
 struct AvahiPrioQueue {
-    AvahiPrioQueueNode *root, *last;
-    unsigned n_nodes;
+    AvahiPrioQueueNode **nodes;
+    unsigned n_nodes, n_allocated;
     AvahiPQCompareFunc compare;
 };
 
+/* A node is a stable handle to an element in the queue. It may either
+ * be allocated by avahi_prio_queue_put() or embedded in the user's
+ * own structure and linked in with avahi_prio_queue_link(). */
 struct AvahiPrioQueueNode {
     AvahiPrioQueue *queue;
     void* data;
-    unsigned x, y;
-    AvahiPrioQueueNode *left, *right, *parent, *next, *prev;
+    unsigned idx;
 };
 
 AvahiPrioQueue* avahi_prio_queue_new(AvahiPQCompareFunc compare);
@@ -44,6 +47,14 @@ void avahi_prio_queue_free(AvahiPrioQueue *q);
 AvahiPrioQueueNode* avahi_prio_queue_put(AvahiPrioQueue *q, void* data);
 void avahi_prio_queue_remove(AvahiPrioQueue *q, AvahiPrioQueueNode *n);
 
+/* Like avahi_prio_queue_put()/avahi_prio_queue_remove() but for
+ * nodes that are owned by the caller. Returns -1 on OOM. */
+int avahi_prio_queue_link(AvahiPrioQueue *q, AvahiPrioQueueNode *n, void *data);
+void avahi_prio_queue_unlink(AvahiPrioQueue *q, AvahiPrioQueueNode *n);
+
 void avahi_prio_queue_shuffle(AvahiPrioQueue *q, AvahiPrioQueueNode *n);
 
+/* Return the smallest node in the queue, or NULL if it is empty */
+#define avahi_prio_queue_root(q) ((q)->n_nodes > 0 ? (q)->nodes[0] : NULL)
+
 #endif
@@ -28,6 +28,7 @@
 #include <avahi-common/malloc.h>
 
 #include "probe-sched.h"
+#include "hashmap.h"
 #include "log.h"
 #include "rr-util.h"
 
@@ -47,6 +48,7 @@ struct AvahiProbeJob {
     AvahiRecord *record;
 
     AVAHI_LLIST_FIELDS(AvahiProbeJob, jobs);
+    AVAHI_LLIST_FIELDS(AvahiProbeJob, by_record);
 };
 
 struct AvahiProbeScheduler {
@@ -55,15 +57,48 @@ struct AvahiProbeScheduler {
 
     AVAHI_LLIST_HEAD(AvahiProbeJob, jobs);
     AVAHI_LLIST_HEAD(AvahiProbeJob, history);
+
+    AvahiHashmap *jobs_by_record;
+    AvahiHashmap *history_by_record;
 };
 
+static void job_index_add(AvahiProbeScheduler *s, AvahiProbeJob *pj) {
+    AvahiHashmap *m;
+    AvahiProbeJob *first;
+
+    assert(s);
+    assert(pj);
+
+    m = pj->done ? s->history_by_record : s->jobs_by_record;
+    first = avahi_hashmap_lookup(m, pj->record);
+    AVAHI_LLIST_PREPEND(AvahiProbeJob, by_record, first, pj);
+    avahi_hashmap_replace(m, pj->record, first);
+}
+
+static void job_index_remove(AvahiProbeScheduler *s, AvahiProbeJob *pj) {
+    AvahiHashmap *m;
+    AvahiProbeJob *first;
+
+    assert(s);
+    assert(pj);
+
+    m = pj->done ? s->history_by_record : s->jobs_by_record;
+    first = avahi_hashmap_lookup(m, pj->record);
+    AVAHI_LLIST_REMOVE(AvahiProbeJob, by_record, first, pj);
+
+    if (first)
+        avahi_hashmap_replace(m, first->record, first);
+    else
+        avahi_hashmap_remove(m, pj->record);
+}
+
 static AvahiProbeJob* job_new(AvahiProbeScheduler *s, AvahiRecord *record, int done) {
     AvahiProbeJob *pj;
 
     assert(s);
     assert(record);
 
-    if (!(pj = avahi_new(AvahiProbeJob, 1))) {
+    if (!(pj = avahi_pool_alloc(s->interface->monitor->server->probe_job_pool))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL; /* OOM */
     }
@@ -78,6 +113,8 @@ static AvahiProbeJob* job_new(AvahiProbeScheduler *s, AvahiRecord *record, int d
     else
         AVAHI_LLIST_PREPEND(AvahiProbeJob, jobs, s->jobs, pj);
 
+    job_index_add(s, pj);
+
     return pj;
 }
 
@@ -87,13 +124,15 @@ static void job_free(AvahiProbeScheduler *s, AvahiProbeJob *pj) {
     if (pj->time_event)
         avahi_time_event_free(pj->time_event);
 
+    job_index_remove(s, pj);
+
     if (pj->done)
         AVAHI_LLIST_REMOVE(AvahiProbeJob, jobs, s->history, pj);
     else
         AVAHI_LLIST_REMOVE(AvahiProbeJob, jobs, s->jobs, pj);
 
     avahi_record_unref(pj->record);
-    avahi_free(pj);
+    avahi_pool_release(s->interface->monitor->server->probe_job_pool, pj);
 }
 
 static void elapse_callback(AvahiTimeEvent *e, void* data);
@@ -118,11 +157,15 @@ static void job_mark_done(AvahiProbeScheduler *s, AvahiProbeJob *pj) {
 
     assert(!pj->done);
 
+    job_index_remove(s, pj);
+
     AVAHI_LLIST_REMOVE(AvahiProbeJob, jobs, s->jobs, pj);
     AVAHI_LLIST_PREPEND(AvahiProbeJob, jobs, s->history, pj);
 
     pj->done = 1;
 
+    job_index_add(s, pj);
+
     job_set_elapse_time(s, pj, AVAHI_PROBE_HISTORY_MSEC, 0);
     gettimeofday(&pj->delivery, NULL);
 }
@@ -132,10 +175,8 @@ AvahiProbeScheduler *avahi_probe_scheduler_new(AvahiInterface *i) {
 
     assert(i);
 
-    if (!(s = avahi_new(AvahiProbeScheduler, 1))) {
-        avahi_log_error(__FILE__": Out of memory");
-        return NULL;
-    }
+    if (!(s = avahi_new0(AvahiProbeScheduler, 1)))
+        goto oom;
 
     s->interface = i;
     s->time_event_queue = i->monitor->server->time_event_queue;
@@ -143,13 +184,33 @@ AvahiProbeScheduler *avahi_probe_scheduler_new(AvahiInterface *i) {
     AVAHI_LLIST_HEAD_INIT(AvahiProbeJob, s->jobs);
     AVAHI_LLIST_HEAD_INIT(AvahiProbeJob, s->history);
 
+    if (!(s->jobs_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL)) ||
+        !(s->history_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL)))
+        goto oom;
+
     return s;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+
+    if (s) {
+        if (s->jobs_by_record)
+            avahi_hashmap_free(s->jobs_by_record);
+
+        avahi_free(s);
+    }
+
+    return NULL;
 }
 
 void avahi_probe_scheduler_free(AvahiProbeScheduler *s) {
     assert(s);
 
     avahi_probe_scheduler_clear(s);
+
+    avahi_hashmap_free(s->jobs_by_record);
+    avahi_hashmap_free(s->history_by_record);
+
     avahi_free(s);
 }
 
@@ -201,7 +262,7 @@ static int packet_add_probe_query(AvahiProbeScheduler *s, AvahiDnsPacket *p, Ava
             continue;
 
         /* Does the record match the probe? */
-        if (k->clazz != pj->record->key->clazz || !avahi_domain_equal(k->name, pj->record->key->name))
+        if (k->clazz != pj->record->key->clazz || !avahi_key_name_equal(k, pj->record->key))
             continue;
 
         /* This job wouldn't fit in */
@@ -330,14 +391,10 @@ static AvahiProbeJob* find_scheduled_job(AvahiProbeScheduler *s, AvahiRecord *re
     assert(s);
     assert(record);
 
-    for (pj = s->jobs; pj; pj = pj->jobs_next) {
+    if ((pj = avahi_hashmap_lookup(s->jobs_by_record, record)))
         assert(!pj->done);
 
-        if (avahi_record_equal_no_ttl(pj->record, record))
-            return pj;
-    }
-
-    return NULL;
+    return pj;
 }
 
 static AvahiProbeJob* find_history_job(AvahiProbeScheduler *s, AvahiRecord *record) {
@@ -346,23 +403,20 @@ static AvahiProbeJob* find_history_job(AvahiProbeScheduler *s, AvahiRecord *reco
     assert(s);
     assert(record);
 
-    for (pj = s->history; pj; pj = pj->jobs_next) {
-        assert(pj->done);
+    if (!(pj = avahi_hashmap_lookup(s->history_by_record, record)))
+        return NULL;
 
-        if (avahi_record_equal_no_ttl(pj->record, record)) {
-            /* Check whether this entry is outdated */
+    assert(pj->done);
 
-            if (avahi_age(&pj->delivery) > AVAHI_PROBE_HISTORY_MSEC*1000) {
-                /* it is outdated, so let's remove it */
-                job_free(s, pj);
-                return NULL;
-            }
+    /* Check whether this entry is outdated */
 
-            return pj;
-        }
+    if (avahi_age(&pj->delivery) > AVAHI_PROBE_HISTORY_MSEC*1000) {
+        /* it is outdated, so let's remove it */
+        job_free(s, pj);
+        return NULL;
     }
 
-    return NULL;
+    return pj;
 }
 
 int avahi_probe_scheduler_post(AvahiProbeScheduler *s, AvahiRecord *record, int immediately) {
@@ -401,3 +455,7 @@ int avahi_probe_scheduler_post(AvahiProbeScheduler *s, AvahiRecord *record, int
         return 1;
     }
 }
+
+AvahiPool *avahi_probe_job_pool_new(void) {
+    return avahi_pool_new("probe-job", sizeof(AvahiProbeJob), 0);
+}
@@ -23,6 +23,7 @@
 typedef struct AvahiProbeScheduler AvahiProbeScheduler;
 
 #include <avahi-common/address.h>
+#include <avahi-common/pool.h>
 #include "iface.h"
 
 AvahiProbeScheduler *avahi_probe_scheduler_new(AvahiInterface *i);
@@ -31,4 +32,6 @@ void avahi_probe_scheduler_clear(AvahiProbeScheduler *s);
 
 int avahi_probe_scheduler_post(AvahiProbeScheduler *s, AvahiRecord *record, int immediately);
 
+AvahiPool *avahi_probe_job_pool_new(void);
+
 #endif
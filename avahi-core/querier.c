@@ -260,6 +260,19 @@ int avahi_querier_shall_refresh_cache(AvahiInterface *i, AvahiKey *key) {
     }
 }
 
+int avahi_querier_is_subscribed(AvahiInterface *i, AvahiKey *key) {
+    AvahiQuerier *q;
+
+    assert(i);
+    assert(key);
+
+    /* Unlike avahi_querier_shall_refresh_cache() this has no side
+     * effects, so that the cache may call it while looking for an
+     * entry to evict */
+
+    return (q = avahi_hashmap_lookup(i->queriers_by_key, key)) && q->n_used > 0;
+}
+
 void avahi_querier_free_all(AvahiInterface *i) {
     assert(i);
 
@@ -45,4 +45,7 @@ void avahi_querier_free_all(AvahiInterface *i);
 /** Return 1 if there is a querier for the specified key on the specified interface */
 int avahi_querier_shall_refresh_cache(AvahiInterface *i, AvahiKey *key);
 
+/** Return 1 if someone is currently browsing for this key on the interface */
+int avahi_querier_is_subscribed(AvahiInterface *i, AvahiKey *key);
+
 #endif
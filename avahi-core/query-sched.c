@@ -27,6 +27,7 @@
 #include <avahi-common/malloc.h>
 
 #include "query-sched.h"
+#include "hashmap.h"
 #include "log.h"
 
 #define AVAHI_QUERY_HISTORY_MSEC 100
@@ -47,15 +48,14 @@ struct AvahiQueryJob {
 
     AvahiKey *key;
 
-    /* Jobs are stored in a simple linked list. It might turn out in
-     * the future that this list grows too long and we must switch to
-     * some other kind of data structure. This needs further
-     * investigation. I expect the list to be very short (< 20
-     * entries) most of the time, but this might be a wrong
-     * assumption, especially on setups where traffic reflection is
-     * involved. */
+    /* Jobs are stored in a simple linked list, which defines the
+     * order in which they are packed into packets. Since the list
+     * may grow long on setups where traffic reflection is involved,
+     * the jobs are additionally indexed by their key, and scheduled
+     * jobs by their id. */
 
     AVAHI_LLIST_FIELDS(AvahiQueryJob, jobs);
+    AVAHI_LLIST_FIELDS(AvahiQueryJob, by_key);
 };
 
 struct AvahiKnownAnswer {
@@ -74,15 +74,57 @@ struct AvahiQueryScheduler {
     AVAHI_LLIST_HEAD(AvahiQueryJob, jobs);
     AVAHI_LLIST_HEAD(AvahiQueryJob, history);
     AVAHI_LLIST_HEAD(AvahiKnownAnswer, known_answers);
+
+    AvahiHashmap *jobs_by_key;
+    AvahiHashmap *history_by_key;
+    AvahiHashmap *jobs_by_id;
 };
 
+static void job_index_add(AvahiQueryScheduler *s, AvahiQueryJob *qj) {
+    AvahiHashmap *m;
+    AvahiQueryJob *first;
+
+    assert(s);
+    assert(qj);
+
+    m = qj->done ? s->history_by_key : s->jobs_by_key;
+    first = avahi_hashmap_lookup(m, qj->key);
+    AVAHI_LLIST_PREPEND(AvahiQueryJob, by_key, first, qj);
+    avahi_hashmap_replace(m, qj->key, first);
+
+    if (!qj->done)
+        avahi_hashmap_replace(s->jobs_by_id, &qj->id, qj);
+}
+
+static void job_index_remove(AvahiQueryScheduler *s, AvahiQueryJob *qj) {
+    AvahiHashmap *m;
+    AvahiQueryJob *first;
+
+    assert(s);
+    assert(qj);
+
+    m = qj->done ? s->history_by_key : s->jobs_by_key;
+    first = avahi_hashmap_lookup(m, qj->key);
+    AVAHI_LLIST_REMOVE(AvahiQueryJob, by_key, first, qj);
+
+    if (first)
+        avahi_hashmap_replace(m, first->key, first);
+    else
+        avahi_hashmap_remove(m, qj->key);
+
+    /* Ids may be reused after a wrap-around, so make sure we don't
+     * remove somebody else's entry */
+    if (!qj->done && avahi_hashmap_lookup(s->jobs_by_id, &qj->id) == qj)
+        avahi_hashmap_remove(s->jobs_by_id, &qj->id);
+}
+
 static AvahiQueryJob* job_new(AvahiQueryScheduler *s, AvahiKey *key, int done) {
     AvahiQueryJob *qj;
 
     assert(s);
     assert(key);
 
-    if (!(qj = avahi_new(AvahiQueryJob, 1))) {
+    if (!(qj = avahi_pool_alloc(s->interface->monitor->server->query_job_pool))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL;
     }
@@ -98,6 +140,8 @@ static AvahiQueryJob* job_new(AvahiQueryScheduler *s, AvahiKey *key, int done) {
     else
         AVAHI_LLIST_PREPEND(AvahiQueryJob, jobs, s->jobs, qj);
 
+    job_index_add(s, qj);
+
     return qj;
 }
 
@@ -108,13 +152,15 @@ static void job_free(AvahiQueryScheduler *s, AvahiQueryJob *qj) {
     if (qj->time_event)
         avahi_time_event_free(qj->time_event);
 
+    job_index_remove(s, qj);
+
     if (qj->done)
         AVAHI_LLIST_REMOVE(AvahiQueryJob, jobs, s->history, qj);
     else
         AVAHI_LLIST_REMOVE(AvahiQueryJob, jobs, s->jobs, qj);
 
     avahi_key_unref(qj->key);
-    avahi_free(qj);
+    avahi_pool_release(s->interface->monitor->server->query_job_pool, qj);
 }
 
 static void elapse_callback(AvahiTimeEvent *e, void* data);
@@ -139,11 +185,15 @@ static void job_mark_done(AvahiQueryScheduler *s, AvahiQueryJob *qj) {
 
     assert(!qj->done);
 
+    job_index_remove(s, qj);
+
     AVAHI_LLIST_REMOVE(AvahiQueryJob, jobs, s->jobs, qj);
     AVAHI_LLIST_PREPEND(AvahiQueryJob, jobs, s->history, qj);
 
     qj->done = 1;
 
+    job_index_add(s, qj);
+
     job_set_elapse_time(s, qj, AVAHI_QUERY_HISTORY_MSEC, 0);
     gettimeofday(&qj->delivery, NULL);
 }
@@ -152,10 +202,8 @@ AvahiQueryScheduler *avahi_query_scheduler_new(AvahiInterface *i) {
     AvahiQueryScheduler *s;
     assert(i);
 
-    if (!(s = avahi_new(AvahiQueryScheduler, 1))) {
-        avahi_log_error(__FILE__": Out of memory");
-        return NULL; /* OOM */
-    }
+    if (!(s = avahi_new0(AvahiQueryScheduler, 1)))
+        goto oom;
 
     s->interface = i;
     s->time_event_queue = i->monitor->server->time_event_queue;
@@ -165,7 +213,26 @@ AvahiQueryScheduler *avahi_query_scheduler_new(AvahiInterface *i) {
     AVAHI_LLIST_HEAD_INIT(AvahiQueryJob, s->history);
     AVAHI_LLIST_HEAD_INIT(AvahiKnownAnswer, s->known_answers);
 
+    if (!(s->jobs_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL)) ||
+        !(s->history_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL)) ||
+        !(s->jobs_by_id = avahi_hashmap_new(avahi_int_hash, avahi_int_equal, NULL, NULL)))
+        goto oom;
+
     return s;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+
+    if (s) {
+        if (s->jobs_by_key)
+            avahi_hashmap_free(s->jobs_by_key);
+        if (s->history_by_key)
+            avahi_hashmap_free(s->history_by_key);
+
+        avahi_free(s);
+    }
+
+    return NULL; /* OOM */
 }
 
 void avahi_query_scheduler_free(AvahiQueryScheduler *s) {
@@ -173,6 +240,10 @@ void avahi_query_scheduler_free(AvahiQueryScheduler *s) {
 
     assert(!s->known_answers);
     avahi_query_scheduler_clear(s);
+
+    avahi_hashmap_free(s->jobs_by_key);
+    avahi_hashmap_free(s->history_by_key);
+    avahi_hashmap_free(s->jobs_by_id);
     avahi_free(s);
 }
 
@@ -197,6 +268,11 @@ static void* known_answer_walk_callback(AvahiCache *c, AvahiKey *pattern, AvahiC
     if (avahi_cache_entry_half_ttl(c, e))
         return NULL;
 
+    /* Records from a cache snapshot need to be confirmed by a
+     * response, hence we must not suppress it */
+    if (e->unverified)
+        return NULL;
+
     if (!(ka = avahi_new0(AvahiKnownAnswer, 1))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL;
@@ -316,14 +392,10 @@ static AvahiQueryJob* find_scheduled_job(AvahiQueryScheduler *s, AvahiKey *key)
     assert(s);
     assert(key);
 
-    for (qj = s->jobs; qj; qj = qj->jobs_next) {
+    if ((qj = avahi_hashmap_lookup(s->jobs_by_key, key)))
         assert(!qj->done);
 
-        if (avahi_key_equal(qj->key, key))
-            return qj;
-    }
-
-    return NULL;
+    return qj;
 }
 
 static AvahiQueryJob* find_history_job(AvahiQueryScheduler *s, AvahiKey *key) {
@@ -332,23 +404,20 @@ static AvahiQueryJob* find_history_job(AvahiQueryScheduler *s, AvahiKey *key) {
     assert(s);
     assert(key);
 
-    for (qj = s->history; qj; qj = qj->jobs_next) {
-        assert(qj->done);
+    if (!(qj = avahi_hashmap_lookup(s->history_by_key, key)))
+        return NULL;
 
-        if (avahi_key_equal(qj->key, key)) {
-            /* Check whether this entry is outdated */
+    assert(qj->done);
 
-            if (avahi_age(&qj->delivery) > AVAHI_QUERY_HISTORY_MSEC*1000) {
-                /* it is outdated, so let's remove it */
-                job_free(s, qj);
-                return NULL;
-            }
+    /* Check whether this entry is outdated */
 
-            return qj;
-        }
+    if (avahi_age(&qj->delivery) > AVAHI_QUERY_HISTORY_MSEC*1000) {
+        /* it is outdated, so let's remove it */
+        job_free(s, qj);
+        return NULL;
     }
 
-    return NULL;
+    return qj;
 }
 
 int avahi_query_scheduler_post(AvahiQueryScheduler *s, AvahiKey *key, int immediately, unsigned *ret_id) {
@@ -424,27 +493,26 @@ int avahi_query_scheduler_withdraw_by_id(AvahiQueryScheduler *s, unsigned id) {
      * from the queue using this function, simply by passing the id
      * returned by avahi_query_scheduler_post(). */
 
-    for (qj = s->jobs; qj; qj = qj->jobs_next) {
-        assert(!qj->done);
-
-        if (qj->id == id) {
-            /* Entry found */
+    if (!(qj = avahi_hashmap_lookup(s->jobs_by_id, &id)))
+        return 0;
 
-            assert(qj->n_posted >= 1);
+    assert(!qj->done);
+    assert(qj->n_posted >= 1);
 
-            if (--qj->n_posted <= 0) {
+    if (--qj->n_posted <= 0) {
 
-                /* We withdraw this job only if the calling object was
-                 * the only remaining poster. (Usually this is the
-                 * case since there should exist only one querier per
-                 * key, but there are exceptions, notably reflected
-                 * traffic.) */
+        /* We withdraw this job only if the calling object was the
+         * only remaining poster. (Usually this is the case since
+         * there should exist only one querier per key, but there are
+         * exceptions, notably reflected traffic.) */
 
-                job_free(s, qj);
-                return 1;
-            }
-        }
+        job_free(s, qj);
+        return 1;
     }
 
     return 0;
 }
+
+AvahiPool *avahi_query_job_pool_new(void) {
+    return avahi_pool_new("query-job", sizeof(AvahiQueryJob), 0);
+}
@@ -23,6 +23,7 @@
 typedef struct AvahiQueryScheduler AvahiQueryScheduler;
 
 #include <avahi-common/address.h>
+#include <avahi-common/pool.h>
 #include "iface.h"
 
 AvahiQueryScheduler *avahi_query_scheduler_new(AvahiInterface *i);
@@ -33,4 +34,6 @@ int avahi_query_scheduler_post(AvahiQueryScheduler *s, AvahiKey *key, int immedi
 int avahi_query_scheduler_withdraw_by_id(AvahiQueryScheduler *s, unsigned id);
 void avahi_query_scheduler_incoming(AvahiQueryScheduler *s, AvahiKey *key);
 
+AvahiPool *avahi_query_job_pool_new(void);
+
 #endif
@@ -0,0 +1,208 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <sys/time.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/defs.h>
+
+#include "dns.h"
+#include "response-memo.h"
+
+static AvahiDnsPacket *make_query(uint16_t id, const char *name, uint16_t type, int unicast_response) {
+    AvahiDnsPacket *p;
+    AvahiKey *k;
+    uint8_t *r;
+
+    p = avahi_dns_packet_new_query(512 + AVAHI_DNS_PACKET_EXTRA_SIZE);
+    assert(p);
+    avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ID, id);
+
+    k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, type);
+    r = avahi_dns_packet_append_key(p, k, unicast_response);
+    assert(r);
+    avahi_dns_packet_inc_field(p, AVAHI_DNS_FIELD_QDCOUNT);
+    avahi_key_unref(k);
+
+    /* Same name again, compressed */
+    k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_TXT);
+    r = avahi_dns_packet_append_key(p, k, unicast_response);
+    assert(r);
+    avahi_dns_packet_inc_field(p, AVAHI_DNS_FIELD_QDCOUNT);
+    avahi_key_unref(k);
+
+    return p;
+}
+
+/* Build the reply like avahi_server_generate_response() does */
+static AvahiDnsPacket *make_reply(AvahiDnsPacket *p, unsigned n_answers) {
+    AvahiDnsPacket *reply;
+    unsigned i;
+
+    reply = avahi_dns_packet_new_reply(p, 512 + AVAHI_DNS_PACKET_EXTRA_SIZE, 1, 1);
+    assert(reply);
+
+    for (i = 0; i < n_answers; i++) {
+        AvahiRecord *r;
+        char name[64];
+        uint8_t *d;
+
+        snprintf(name, sizeof(name), "Service %u._http._tcp.local", i);
+
+        r = avahi_record_new_full("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL);
+        r->data.ptr.name = avahi_strdup(name);
+
+        d = avahi_dns_packet_append_record(reply, r, 0, 10);
+        assert(d);
+        avahi_dns_packet_inc_field(reply, AVAHI_DNS_FIELD_ANCOUNT);
+
+        avahi_record_unref(r);
+    }
+
+    return reply;
+}
+
+static void assert_same_reply(AvahiDnsPacket *a, AvahiDnsPacket *b) {
+    assert(a->size == b->size);
+    assert(memcmp(AVAHI_DNS_PACKET_DATA(a), AVAHI_DNS_PACKET_DATA(b), a->size) == 0);
+}
+
+static void check_memo(void) {
+    AvahiResponseMemo *m;
+    AvahiDnsPacket *q, *q2, *reply, *r;
+    size_t size;
+    unsigned i;
+
+    m = avahi_response_memo_new();
+    assert(m);
+
+    q = make_query(1, "_http._tcp.local", AVAHI_DNS_TYPE_PTR, 0);
+
+    /* Header, two labels plus the root label for the first name, a
+     * pointer for the second, type and class for each */
+    assert(avahi_dns_packet_question_section_size(q, &size) == 0);
+    assert(size == (1+5 + 1+4 + 1+5 + 1) + 4 + 2 + 4);
+
+    assert(!avahi_response_memo_lookup(m, q, 0));
+
+    reply = make_reply(q, 5);
+    avahi_response_memo_store(m, q, reply, 0);
+
+    /* Same questions, different ID */
+    q2 = make_query(4711, "_http._tcp.local", AVAHI_DNS_TYPE_PTR, 0);
+    r = avahi_response_memo_lookup(m, q2, 0);
+    assert(r);
+    assert(avahi_dns_packet_get_field(r, AVAHI_DNS_FIELD_ID) == 4711);
+    avahi_dns_packet_set_field(r, AVAHI_DNS_FIELD_ID, 1);
+    assert_same_reply(r, reply);
+    avahi_dns_packet_free(r);
+    avahi_dns_packet_free(q2);
+
+    /* Different questions */
+    q2 = make_query(1, "_http._tcp.local", AVAHI_DNS_TYPE_PTR, 1);
+    assert(!avahi_response_memo_lookup(m, q2, 0));
+    avahi_dns_packet_free(q2);
+
+    q2 = make_query(1, "_ftp._tcp.local", AVAHI_DNS_TYPE_PTR, 0);
+    assert(!avahi_response_memo_lookup(m, q2, 0));
+    avahi_dns_packet_free(q2);
+
+    /* Something was published or withdrawn */
+    assert(!avahi_response_memo_lookup(m, q, 1));
+    assert(!avahi_response_memo_lookup(m, q, 0));
+
+    /* Keep storing more different questions than we remember */
+    avahi_response_memo_store(m, q, reply, 0);
+    for (i = 0; i < 1000; i++) {
+        AvahiDnsPacket *t;
+        char name[64];
+
+        snprintf(name, sizeof(name), "host-%u.local", i);
+        q2 = make_query(1, name, AVAHI_DNS_TYPE_A, 0);
+        t = make_reply(q2, 1);
+
+        avahi_response_memo_store(m, q2, t, 0);
+
+        r = avahi_response_memo_lookup(m, q2, 0);
+        assert(r);
+        assert_same_reply(r, t);
+        avahi_dns_packet_free(r);
+
+        avahi_dns_packet_free(t);
+        avahi_dns_packet_free(q2);
+    }
+
+    avahi_dns_packet_free(reply);
+    avahi_dns_packet_free(q);
+    avahi_response_memo_free(m);
+}
+
+static void benchmark(unsigned n) {
+    AvahiResponseMemo *m;
+    AvahiDnsPacket *q, *reply;
+    struct timeval start;
+    unsigned i;
+
+    m = avahi_response_memo_new();
+    assert(m);
+
+    q = make_query(1, "_http._tcp.local", AVAHI_DNS_TYPE_PTR, 0);
+
+    /* This doesn't include looking up the entries, so it is a lower
+     * bound on what the memo saves */
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        reply = make_reply(q, 10);
+        avahi_dns_packet_free(reply);
+    }
+    printf("serialize %u replies: %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    reply = make_reply(q, 10);
+    avahi_response_memo_store(m, q, reply, 0);
+    avahi_dns_packet_free(reply);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        reply = avahi_response_memo_lookup(m, q, 0);
+        assert(reply);
+        avahi_dns_packet_free(reply);
+    }
+    printf("memo %u replies:      %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    avahi_dns_packet_free(q);
+    avahi_response_memo_free(m);
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+
+    check_memo();
+    benchmark(10000);
+
+    return 0;
+}
@@ -0,0 +1,220 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include <avahi-common/malloc.h>
+#include <avahi-common/llist.h>
+
+#include "hashmap.h"
+#include "response-memo.h"
+
+/* A bound on the number of different question sets we remember per
+ * interface. When it is reached we start over, so that a client
+ * asking random questions can't make us grow without limit. */
+#define AVAHI_RESPONSE_MEMO_ENTRIES_MAX 64
+
+typedef struct Entry Entry;
+
+struct Entry {
+    /* The question section of the query, which is the key */
+    uint8_t *questions;
+    size_t questions_size;
+
+    /* Everything following the header of the reply */
+    uint8_t *body;
+    size_t body_size;
+
+    uint16_t qdcount, ancount;
+
+    AVAHI_LLIST_FIELDS(Entry, entries);
+};
+
+struct AvahiResponseMemo {
+    AvahiHashmap *hashmap;
+    AVAHI_LLIST_HEAD(Entry, entries);
+    unsigned n_entries;
+    unsigned generation;
+};
+
+static unsigned entry_hash(const void *data) {
+    const Entry *e = data;
+    unsigned hash = 0;
+    size_t i;
+
+    for (i = 0; i < e->questions_size; i++)
+        hash = 31 * hash + e->questions[i];
+
+    return hash;
+}
+
+static int entry_equal(const void *a, const void *b) {
+    const Entry *x = a, *y = b;
+
+    return x->questions_size == y->questions_size && memcmp(x->questions, y->questions, x->questions_size) == 0;
+}
+
+static void entry_free(Entry *e) {
+    assert(e);
+
+    avahi_free(e->questions);
+    avahi_free(e->body);
+    avahi_free(e);
+}
+
+AvahiResponseMemo *avahi_response_memo_new(void) {
+    AvahiResponseMemo *m;
+
+    if (!(m = avahi_new(AvahiResponseMemo, 1)))
+        return NULL; /* OOM */
+
+    /* The entries are their own keys */
+    if (!(m->hashmap = avahi_hashmap_new(entry_hash, entry_equal, NULL, NULL))) {
+        avahi_free(m);
+        return NULL; /* OOM */
+    }
+
+    AVAHI_LLIST_HEAD_INIT(Entry, m->entries);
+    m->n_entries = 0;
+    m->generation = 0;
+
+    return m;
+}
+
+static void flush(AvahiResponseMemo *m) {
+    assert(m);
+
+    while (m->entries) {
+        Entry *e = m->entries;
+
+        avahi_hashmap_remove(m->hashmap, e);
+        AVAHI_LLIST_REMOVE(Entry, entries, m->entries, e);
+        entry_free(e);
+    }
+
+    m->n_entries = 0;
+}
+
+void avahi_response_memo_free(AvahiResponseMemo *m) {
+    assert(m);
+
+    flush(m);
+    avahi_hashmap_free(m->hashmap);
+    avahi_free(m);
+}
+
+static int get_questions(AvahiDnsPacket *p, Entry *key) {
+    assert(p);
+    assert(key);
+
+    if (avahi_dns_packet_question_section_size(p, &key->questions_size) < 0)
+        return -1;
+
+    key->questions = AVAHI_DNS_PACKET_DATA(p) + AVAHI_DNS_PACKET_HEADER_SIZE;
+    return 0;
+}
+
+AvahiDnsPacket *avahi_response_memo_lookup(AvahiResponseMemo *m, AvahiDnsPacket *p, unsigned generation) {
+    AvahiDnsPacket *reply;
+    Entry key, *e;
+    uint8_t *d;
+
+    assert(m);
+    assert(p);
+
+    if (m->generation != generation) {
+        flush(m);
+        m->generation = generation;
+        return NULL;
+    }
+
+    if (get_questions(p, &key) < 0)
+        return NULL;
+
+    if (!(e = avahi_hashmap_lookup(m->hashmap, &key)))
+        return NULL;
+
+    if (!(reply = avahi_dns_packet_new_reply(p, AVAHI_DNS_PACKET_HEADER_SIZE + e->body_size + AVAHI_DNS_PACKET_EXTRA_SIZE, 0, 1)))
+        return NULL; /* OOM */
+
+    if (!(d = avahi_dns_packet_extend(reply, e->body_size))) {
+        avahi_dns_packet_free(reply);
+        return NULL;
+    }
+
+    /* The name compression pointers in the body stay valid since it
+     * ends up at the same offset as before */
+    memcpy(d, e->body, e->body_size);
+
+    avahi_dns_packet_set_field(reply, AVAHI_DNS_FIELD_QDCOUNT, e->qdcount);
+    avahi_dns_packet_set_field(reply, AVAHI_DNS_FIELD_ANCOUNT, e->ancount);
+
+    return reply;
+}
+
+void avahi_response_memo_store(AvahiResponseMemo *m, AvahiDnsPacket *p, AvahiDnsPacket *reply, unsigned generation) {
+    Entry key, *e;
+
+    assert(m);
+    assert(p);
+    assert(reply);
+
+    if (m->generation != generation) {
+        flush(m);
+        m->generation = generation;
+    }
+
+    if (get_questions(p, &key) < 0)
+        return;
+
+    if (avahi_hashmap_lookup(m->hashmap, &key))
+        return;
+
+    if (m->n_entries >= AVAHI_RESPONSE_MEMO_ENTRIES_MAX)
+        flush(m);
+
+    if (!(e = avahi_new(Entry, 1)))
+        return; /* OOM */
+
+    e->questions_size = key.questions_size;
+    e->body_size = reply->size - AVAHI_DNS_PACKET_HEADER_SIZE;
+    e->qdcount = avahi_dns_packet_get_field(reply, AVAHI_DNS_FIELD_QDCOUNT);
+    e->ancount = avahi_dns_packet_get_field(reply, AVAHI_DNS_FIELD_ANCOUNT);
+
+    e->questions = avahi_memdup(key.questions, key.questions_size);
+    e->body = avahi_memdup(AVAHI_DNS_PACKET_DATA(reply) + AVAHI_DNS_PACKET_HEADER_SIZE, e->body_size);
+
+    if ((key.questions_size > 0 && !e->questions) || (e->body_size > 0 && !e->body)) {
+        entry_free(e);
+        return; /* OOM */
+    }
+
+    if (avahi_hashmap_insert(m->hashmap, e, e) < 0) {
+        entry_free(e);
+        return; /* OOM */
+    }
+
+    AVAHI_LLIST_PREPEND(Entry, entries, m->entries, e);
+    m->n_entries++;
+}
@@ -0,0 +1,51 @@
+#ifndef fooresponsememohfoo
+#define fooresponsememohfoo
+
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#include <avahi-common/cdecl.h>
+
+#include "dns.h"
+
+AVAHI_C_DECL_BEGIN
+
+/* Legacy unicast replies only depend on the questions of the query
+ * and on what we publish on the interface. This keeps the serialized
+ * replies to the questions we were asked recently, so that answering
+ * the same questions again is a copy plus a new header. The caller
+ * passes a generation number which it changes whenever the published
+ * records might have changed; replies stored in an older generation
+ * are never returned. */
+typedef struct AvahiResponseMemo AvahiResponseMemo;
+
+AvahiResponseMemo *avahi_response_memo_new(void);
+void avahi_response_memo_free(AvahiResponseMemo *m);
+
+/* Returns a reply to the query p if one was stored for the same
+ * questions in this generation, NULL otherwise */
+AvahiDnsPacket *avahi_response_memo_lookup(AvahiResponseMemo *m, AvahiDnsPacket *p, unsigned generation);
+
+/* Remember reply, which must have been created with
+ * avahi_dns_packet_new_reply() from p, copying the queries */
+void avahi_response_memo_store(AvahiResponseMemo *m, AvahiDnsPacket *p, AvahiDnsPacket *reply, unsigned generation);
+
+AVAHI_C_DECL_END
+
+#endif
@@ -29,6 +29,7 @@
 #include "response-sched.h"
 #include "log.h"
 #include "rr-util.h"
+#include "hashmap.h"
 
 /* Local packets are suppressed this long after sending them */
 #define AVAHI_RESPONSE_HISTORY_MSEC 500
@@ -63,6 +64,7 @@ struct AvahiResponseJob {
     int querier_valid;
 
     AVAHI_LLIST_FIELDS(AvahiResponseJob, jobs);
+    AVAHI_LLIST_FIELDS(AvahiResponseJob, by_record);
 };
 
 struct AvahiResponseScheduler {
@@ -72,15 +74,80 @@ struct AvahiResponseScheduler {
     AVAHI_LLIST_HEAD(AvahiResponseJob, jobs);
     AVAHI_LLIST_HEAD(AvahiResponseJob, history);
     AVAHI_LLIST_HEAD(AvahiResponseJob, suppressed);
+
+    /* One index per list, mapping a record to the jobs of that list
+     * with an equal record (ignoring the TTL). Only the suppressed
+     * list may contain more than one of those, one per querier. */
+    AvahiHashmap *jobs_by_record;
+    AvahiHashmap *history_by_record;
+    AvahiHashmap *suppressed_by_record;
 };
 
+static AvahiHashmap *job_index(AvahiResponseScheduler *s, AvahiResponseJobState state) {
+    assert(s);
+
+    if (state == AVAHI_SCHEDULED)
+        return s->jobs_by_record;
+    else if (state == AVAHI_DONE)
+        return s->history_by_record;
+    else /* state == AVAHI_SUPPRESSED */
+        return s->suppressed_by_record;
+}
+
+static void job_index_add(AvahiResponseScheduler *s, AvahiResponseJob *rj) {
+    AvahiHashmap *m;
+    AvahiResponseJob *first;
+
+    assert(s);
+    assert(rj);
+
+    m = job_index(s, rj->state);
+    first = avahi_hashmap_lookup(m, rj->record);
+    AVAHI_LLIST_PREPEND(AvahiResponseJob, by_record, first, rj);
+    avahi_hashmap_replace(m, rj->record, first);
+}
+
+static void job_index_remove(AvahiResponseScheduler *s, AvahiResponseJob *rj) {
+    AvahiHashmap *m;
+    AvahiResponseJob *first;
+
+    assert(s);
+    assert(rj);
+
+    m = job_index(s, rj->state);
+    first = avahi_hashmap_lookup(m, rj->record);
+    AVAHI_LLIST_REMOVE(AvahiResponseJob, by_record, first, rj);
+
+    if (first)
+        avahi_hashmap_replace(m, first->record, first);
+    else
+        avahi_hashmap_remove(m, rj->record);
+}
+
+static void job_set_record(AvahiResponseScheduler *s, AvahiResponseJob *rj, AvahiRecord *record) {
+    assert(s);
+    assert(rj);
+    assert(record);
+    assert(avahi_record_equal_no_ttl(rj->record, record));
+
+    record = avahi_record_ref(record);
+
+    /* We need to update the hash table key if we replace the
+     * record */
+    if (!rj->by_record_prev)
+        avahi_hashmap_replace(job_index(s, rj->state), record, rj);
+
+    avahi_record_unref(rj->record);
+    rj->record = record;
+}
+
 static AvahiResponseJob* job_new(AvahiResponseScheduler *s, AvahiRecord *record, AvahiResponseJobState state) {
     AvahiResponseJob *rj;
 
     assert(s);
     assert(record);
 
-    if (!(rj = avahi_new(AvahiResponseJob, 1))) {
+    if (!(rj = avahi_pool_alloc(s->interface->monitor->server->response_job_pool))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL;
     }
@@ -98,6 +165,8 @@ static AvahiResponseJob* job_new(AvahiResponseScheduler *s, AvahiRecord *record,
     else  /* rj->state == AVAHI_SUPPRESSED */
         AVAHI_LLIST_PREPEND(AvahiResponseJob, jobs, s->suppressed, rj);
 
+    job_index_add(s, rj);
+
     return rj;
 }
 
@@ -115,8 +184,10 @@ static void job_free(AvahiResponseScheduler *s, AvahiResponseJob *rj) {
     else /* rj->state == AVAHI_SUPPRESSED */
         AVAHI_LLIST_REMOVE(AvahiResponseJob, jobs, s->suppressed, rj);
 
+    job_index_remove(s, rj);
+
     avahi_record_unref(rj->record);
-    avahi_free(rj);
+    avahi_pool_release(s->interface->monitor->server->response_job_pool, rj);
 }
 
 static void elapse_callback(AvahiTimeEvent *e, void* data);
@@ -142,10 +213,13 @@ static void job_mark_done(AvahiResponseScheduler *s, AvahiResponseJob *rj) {
     assert(rj->state == AVAHI_SCHEDULED);
 
     AVAHI_LLIST_REMOVE(AvahiResponseJob, jobs, s->jobs, rj);
-    AVAHI_LLIST_PREPEND(AvahiResponseJob, jobs, s->history, rj);
+    job_index_remove(s, rj);
 
     rj->state = AVAHI_DONE;
 
+    AVAHI_LLIST_PREPEND(AvahiResponseJob, jobs, s->history, rj);
+    job_index_add(s, rj);
+
     job_set_elapse_time(s, rj, AVAHI_RESPONSE_HISTORY_MSEC, 0);
 
     gettimeofday(&rj->delivery, NULL);
@@ -155,10 +229,8 @@ AvahiResponseScheduler *avahi_response_scheduler_new(AvahiInterface *i) {
     AvahiResponseScheduler *s;
     assert(i);
 
-    if (!(s = avahi_new(AvahiResponseScheduler, 1))) {
-        avahi_log_error(__FILE__": Out of memory");
-        return NULL;
-    }
+    if (!(s = avahi_new0(AvahiResponseScheduler, 1)))
+        goto oom;
 
     s->interface = i;
     s->time_event_queue = i->monitor->server->time_event_queue;
@@ -167,13 +239,36 @@ AvahiResponseScheduler *avahi_response_scheduler_new(AvahiInterface *i) {
     AVAHI_LLIST_HEAD_INIT(AvahiResponseJob, s->history);
     AVAHI_LLIST_HEAD_INIT(AvahiResponseJob, s->suppressed);
 
+    if (!(s->jobs_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL)) ||
+        !(s->history_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL)) ||
+        !(s->suppressed_by_record = avahi_hashmap_new((AvahiHashFunc) avahi_record_hash_no_ttl, (AvahiEqualFunc) avahi_record_equal_no_ttl, NULL, NULL)))
+        goto oom;
+
     return s;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+
+    if (s) {
+        if (s->jobs_by_record)
+            avahi_hashmap_free(s->jobs_by_record);
+        if (s->history_by_record)
+            avahi_hashmap_free(s->history_by_record);
+        avahi_free(s);
+    }
+
+    return NULL;
 }
 
 void avahi_response_scheduler_free(AvahiResponseScheduler *s) {
     assert(s);
 
     avahi_response_scheduler_clear(s);
+
+    avahi_hashmap_free(s->jobs_by_record);
+    avahi_hashmap_free(s->history_by_record);
+    avahi_hashmap_free(s->suppressed_by_record);
+
     avahi_free(s);
 }
 
@@ -279,14 +374,11 @@ static AvahiResponseJob* find_scheduled_job(AvahiResponseScheduler *s, AvahiReco
     assert(s);
     assert(record);
 
-    for (rj = s->jobs; rj; rj = rj->jobs_next) {
+    if ((rj = avahi_hashmap_lookup(s->jobs_by_record, record))) {
         assert(rj->state == AVAHI_SCHEDULED);
-
-        if (avahi_record_equal_no_ttl(rj->record, record))
-            return rj;
     }
 
-    return NULL;
+    return rj;
 }
 
 static AvahiResponseJob* find_history_job(AvahiResponseScheduler *s, AvahiRecord *record) {
@@ -295,25 +387,21 @@ static AvahiResponseJob* find_history_job(AvahiResponseScheduler *s, AvahiRecord
     assert(s);
     assert(record);
 
-    for (rj = s->history; rj; rj = rj->jobs_next) {
+    if ((rj = avahi_hashmap_lookup(s->history_by_record, record))) {
         assert(rj->state == AVAHI_DONE);
 
-        if (avahi_record_equal_no_ttl(rj->record, record)) {
-            /* Check whether this entry is outdated */
+        /* Check whether this entry is outdated */
 
-/*             avahi_log_debug("history age: %u", (unsigned) (avahi_age(&rj->delivery)/1000)); */
+/*         avahi_log_debug("history age: %u", (unsigned) (avahi_age(&rj->delivery)/1000)); */
 
-            if (avahi_age(&rj->delivery)/1000 > AVAHI_RESPONSE_HISTORY_MSEC) {
-                /* it is outdated, so let's remove it */
-                job_free(s, rj);
-                return NULL;
-            }
-
-            return rj;
+        if (avahi_age(&rj->delivery)/1000 > AVAHI_RESPONSE_HISTORY_MSEC) {
+            /* it is outdated, so let's remove it */
+            job_free(s, rj);
+            return NULL;
         }
     }
 
-    return NULL;
+    return rj;
 }
 
 static AvahiResponseJob* find_suppressed_job(AvahiResponseScheduler *s, AvahiRecord *record, const AvahiAddress *querier) {
@@ -323,12 +411,11 @@ static AvahiResponseJob* find_suppressed_job(AvahiResponseScheduler *s, AvahiRec
     assert(record);
     assert(querier);
 
-    for (rj = s->suppressed; rj; rj = rj->jobs_next) {
+    for (rj = avahi_hashmap_lookup(s->suppressed_by_record, record); rj; rj = rj->by_record_next) {
         assert(rj->state == AVAHI_SUPPRESSED);
         assert(rj->querier_valid);
 
-        if (avahi_record_equal_no_ttl(rj->record, record) &&
-            avahi_address_cmp(&rj->querier, querier) == 0) {
+        if (avahi_address_cmp(&rj->querier, querier) == 0) {
             /* Check whether this entry is outdated */
 
             if (avahi_age(&rj->delivery) > AVAHI_RESPONSE_SUPPRESS_MSEC*1000) {
@@ -404,8 +491,7 @@ int avahi_response_scheduler_post(AvahiResponseScheduler *s, AvahiRecord *record
             rj->querier_valid = 0;
 
         /* Update record data (just for the TTL) */
-        avahi_record_unref(rj->record);
-        rj->record = avahi_record_ref(record);
+        job_set_record(s, rj, record);
 
         return 1;
     } else {
@@ -450,8 +536,7 @@ void avahi_response_scheduler_incoming(AvahiResponseScheduler *s, AvahiRecord *r
 
     if ((rj = find_history_job(s, record))) {
         /* Found a history job, let's update it */
-        avahi_record_unref(rj->record);
-        rj->record = avahi_record_ref(record);
+        job_set_record(s, rj, record);
     } else
         /* Found no existing history job, so let's create a new one */
         if (!(rj = job_new(s, record, AVAHI_DONE)))
@@ -486,8 +571,7 @@ void avahi_response_scheduler_suppress(AvahiResponseScheduler *s, AvahiRecord *r
     if ((rj = find_suppressed_job(s, record, querier))) {
 
         /* Let's update the old entry */
-        avahi_record_unref(rj->record);
-        rj->record = avahi_record_ref(record);
+        job_set_record(s, rj, record);
 
     } else {
 
@@ -509,3 +593,7 @@ void avahi_response_scheduler_force(AvahiResponseScheduler *s) {
     while (s->jobs)
         send_response_packet(s, s->jobs);
 }
+
+AvahiPool *avahi_response_job_pool_new(void) {
+    return avahi_pool_new("response-job", sizeof(AvahiResponseJob), 0);
+}
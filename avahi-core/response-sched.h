@@ -23,6 +23,7 @@
 typedef struct AvahiResponseScheduler AvahiResponseScheduler;
 
 #include <avahi-common/address.h>
+#include <avahi-common/pool.h>
 #include "iface.h"
 
 AvahiResponseScheduler *avahi_response_scheduler_new(AvahiInterface *i);
@@ -34,4 +35,6 @@ int avahi_response_scheduler_post(AvahiResponseScheduler *s, AvahiRecord *record
 void avahi_response_scheduler_incoming(AvahiResponseScheduler *s, AvahiRecord *record, int flush_cache);
 void avahi_response_scheduler_suppress(AvahiResponseScheduler *s, AvahiRecord *record, const AvahiAddress *querier);
 
+AvahiPool *avahi_response_job_pool_new(void);
+
 #endif
@@ -38,6 +38,14 @@ int avahi_key_pattern_match(const AvahiKey *pattern, const AvahiKey *k);
  * value of AVAHI_DNS_CLASS_ANY/AVAHI_DNS_TYPE_ANY */
 int avahi_key_is_pattern(const AvahiKey *k);
 
+/** Check whether two keys have the same name, ignoring case,
+ * regardless of their class and type */
+int avahi_key_name_equal(const AvahiKey *a, const AvahiKey *b);
+
+/** Return a hash value for the name of a key, consistent with
+ * avahi_key_name_equal() */
+unsigned avahi_key_name_hash(const AvahiKey *k);
+
 /** Returns a maximum estimate for the space that is needed to store
  * this key in a DNS packet. */
 size_t avahi_key_get_estimate_size(AvahiKey *k);
@@ -54,9 +62,29 @@ int avahi_record_lexicographical_compare(AvahiRecord *a, AvahiRecord *b);
 /** Return 1 if the specified record is an mDNS goodbye record. i.e. TTL is zero. */
 int avahi_record_is_goodbye(AvahiRecord *r);
 
+/** Return a numeric hash value for a record for usage in hash
+ * tables. Records that are equal according to
+ * avahi_record_equal_no_ttl() have the same hash value. */
+unsigned avahi_record_hash_no_ttl(const AvahiRecord *r);
+
 /** Make a deep copy of an AvahiRecord object */
 AvahiRecord *avahi_record_copy(AvahiRecord *r);
 
+/** A table of interned keys. Keys with the same name, class and
+ * type share a single AvahiKey object, so that parsing the names that
+ * come up over and over again doesn't allocate new keys each time. */
+typedef struct AvahiKeyTable AvahiKeyTable;
+
+/** Create a new key table */
+AvahiKeyTable *avahi_key_table_new(void);
+
+/** Free a key table. Keys still referenced elsewhere stay valid. */
+void avahi_key_table_free(AvahiKeyTable *t);
+
+/** Return a new reference to the interned key for the specified
+ * name, class and type, creating it if necessary */
+AvahiKey *avahi_key_table_get(AvahiKeyTable *t, const char *name, uint16_t class, uint16_t type);
+
 AVAHI_C_DECL_END
 
 #endif
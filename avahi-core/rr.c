@@ -41,25 +41,104 @@
 #include "rr-util.h"
 #include "addr-util.h"
 
+/* The canonical name is at most one byte longer than the escaped
+ * name, plus the terminating root label */
+#define AVAHI_CANONICAL_NAME_MAX (AVAHI_DOMAIN_NAME_MAX+2)
+
+/* What avahi_key_new() actually allocates: the public part of the
+ * key, followed by what speeds up hashing and comparing keys. The
+ * canonical name itself follows this structure. */
+typedef struct KeyPrivate {
+    AvahiKey key;
+    unsigned hash;           /* The value returned by avahi_key_hash() */
+    uint16_t canonical_size;
+    uint8_t *canonical;      /* Lower case name in DNS wire format, without compression */
+} KeyPrivate;
+
+#define KEY_PRIVATE(k) ((const KeyPrivate*) (k))
+
+/* Convert a normalized name into lower case, uncompressed DNS wire
+ * format. Two names are equal according to avahi_domain_equal() iff
+ * their canonical forms are identical. Also calculates
+ * avahi_domain_hash() for the name on the way. */
+static size_t canonicalize_name(const char *name, uint8_t *c, size_t size, unsigned *ret_hash) {
+    unsigned hash = 0;
+    size_t n = 0;
+
+    assert(name);
+    assert(c);
+    assert(ret_hash);
+
+    while (*name) {
+        char label[AVAHI_LABEL_MAX], *p;
+        size_t l;
+
+        if (!avahi_unescape_label(&name, label, sizeof(label)))
+            return 0;
+
+        l = strlen(label);
+
+        if (n + 1 + l + 1 > size)
+            return 0;
+
+        c[n++] = (uint8_t) l;
+
+        for (p = label; *p; p++) {
+            uint8_t t = (uint8_t) *p;
+
+            /* Only ASCII is case insensitive, like in avahi_domain_equal() */
+            if (t >= 'A' && t <= 'Z')
+                t = (uint8_t) (t - 'A' + 'a');
+
+            c[n++] = t;
+            hash = 31 * hash + t;
+        }
+    }
+
+    c[n++] = 0;
+
+    *ret_hash = hash;
+    return n;
+}
+
 AvahiKey *avahi_key_new(const char *name, uint16_t class, uint16_t type) {
+    uint8_t canonical[AVAHI_CANONICAL_NAME_MAX];
+    unsigned hash;
+    size_t size;
+    KeyPrivate *p;
     AvahiKey *k;
+    char *n;
+
     assert(name);
 
-    if (!(k = avahi_new(AvahiKey, 1))) {
-        avahi_log_error("avahi_new() failed.");
+    if (!(n = avahi_normalize_name_strdup(name))) {
+        avahi_log_error("avahi_normalize_name() failed.");
         return NULL;
     }
 
-    if (!(k->name = avahi_normalize_name_strdup(name))) {
-        avahi_log_error("avahi_normalize_name() failed.");
-        avahi_free(k);
+    if (!(size = canonicalize_name(n, canonical, sizeof(canonical), &hash))) {
+        avahi_log_error("Failed to canonicalize name.");
+        avahi_free(n);
         return NULL;
     }
 
+    if (!(p = avahi_malloc(sizeof(KeyPrivate) + size))) {
+        avahi_log_error("avahi_new() failed.");
+        avahi_free(n);
+        return NULL;
+    }
+
+    k = &p->key;
     k->ref = 1;
+    k->name = n;
     k->clazz = class;
     k->type = type;
 
+    p->hash = hash + type + class;
+    p->canonical_size = (uint16_t) size;
+    p->canonical = (uint8_t*) (p + 1);
+    memcpy(p->canonical, canonical, size);
+
     return k;
 }
 
@@ -321,6 +400,22 @@ char *avahi_record_to_string(const AvahiRecord *r) {
     return s;
 }
 
+int avahi_key_name_equal(const AvahiKey *a, const AvahiKey *b) {
+    assert(a);
+    assert(b);
+
+    return
+        KEY_PRIVATE(a)->canonical_size == KEY_PRIVATE(b)->canonical_size &&
+        memcmp(KEY_PRIVATE(a)->canonical, KEY_PRIVATE(b)->canonical, KEY_PRIVATE(a)->canonical_size) == 0;
+}
+
+unsigned avahi_key_name_hash(const AvahiKey *k) {
+    assert(k);
+
+    /* Undo what avahi_key_new() added */
+    return KEY_PRIVATE(k)->hash - k->type - k->clazz;
+}
+
 int avahi_key_equal(const AvahiKey *a, const AvahiKey *b) {
     assert(a);
     assert(b);
@@ -328,9 +423,11 @@ int avahi_key_equal(const AvahiKey *a, const AvahiKey *b) {
     if (a == b)
         return 1;
 
-    return avahi_domain_equal(a->name, b->name) &&
+    return
+        KEY_PRIVATE(a)->hash == KEY_PRIVATE(b)->hash &&
         a->type == b->type &&
-        a->clazz == b->clazz;
+        a->clazz == b->clazz &&
+        avahi_key_name_equal(a, b);
 }
 
 int avahi_key_pattern_match(const AvahiKey *pattern, const AvahiKey *k) {
@@ -342,7 +439,7 @@ int avahi_key_pattern_match(const AvahiKey *pattern, const AvahiKey *k) {
     if (pattern == k)
         return 1;
 
-    return avahi_domain_equal(pattern->name, k->name) &&
+    return avahi_key_name_equal(pattern, k) &&
         (pattern->type == k->type || pattern->type == AVAHI_DNS_TYPE_ANY) &&
         (pattern->clazz == k->clazz || pattern->clazz == AVAHI_DNS_CLASS_ANY);
 }
@@ -358,10 +455,7 @@ int avahi_key_is_pattern(const AvahiKey *k) {
 unsigned avahi_key_hash(const AvahiKey *k) {
     assert(k);
 
-    return
-        avahi_domain_hash(k->name) +
-        k->type +
-        k->clazz;
+    return KEY_PRIVATE(k)->hash;
 }
 
 static int rdata_equal(const AvahiRecord *a, const AvahiRecord *b) {
@@ -415,6 +509,56 @@ int avahi_record_equal_no_ttl(const AvahiRecord *a, const AvahiRecord *b) {
         rdata_equal(a, b);
 }
 
+static unsigned hash_data(unsigned hash, const void *data, size_t size) {
+    const uint8_t *p = data;
+
+    for (; size > 0; size--, p++)
+        hash = 31 * hash + *p;
+
+    return hash;
+}
+
+unsigned avahi_record_hash_no_ttl(const AvahiRecord *r) {
+    unsigned hash;
+
+    assert(r);
+
+    hash = avahi_key_hash(r->key);
+
+    switch (r->key->type) {
+        case AVAHI_DNS_TYPE_SRV:
+            return hash +
+                31 * (r->data.srv.priority + 31 * (r->data.srv.weight + 31 * (unsigned) r->data.srv.port)) +
+                avahi_domain_hash(r->data.srv.name);
+
+        case AVAHI_DNS_TYPE_PTR:
+        case AVAHI_DNS_TYPE_CNAME:
+        case AVAHI_DNS_TYPE_NS:
+            return hash + avahi_domain_hash(r->data.ptr.name);
+
+        case AVAHI_DNS_TYPE_HINFO:
+            hash = hash_data(hash, r->data.hinfo.cpu, strlen(r->data.hinfo.cpu));
+            return hash_data(hash, r->data.hinfo.os, strlen(r->data.hinfo.os));
+
+        case AVAHI_DNS_TYPE_TXT: {
+            const AvahiStringList *l;
+
+            for (l = r->data.txt.string_list; l; l = l->next)
+                hash = hash_data(31 * hash + (unsigned) l->size, l->text, l->size);
+
+            return hash;
+        }
+
+        case AVAHI_DNS_TYPE_A:
+            return hash_data(hash, &r->data.a.address, sizeof(AvahiIPv4Address));
+
+        case AVAHI_DNS_TYPE_AAAA:
+            return hash_data(hash, &r->data.aaaa.address, sizeof(AvahiIPv6Address));
+
+        default:
+            return hash_data(hash, r->data.generic.data, r->data.generic.size);
+    }
+}
 
 AvahiRecord *avahi_record_copy(AvahiRecord *r) {
     AvahiRecord *copy;
@@ -754,3 +898,135 @@ int avahi_record_is_link_local_address(const AvahiRecord *r) {
 
     return avahi_address_is_link_local(&a);
 }
+
+/* Don't bother collecting unused keys in tables smaller than this */
+#define AVAHI_KEY_TABLE_SWEEP_MIN 256
+
+struct AvahiKeyTable {
+    AvahiHashmap *keys;
+    unsigned n_keys;
+
+    /* Drop the keys only the table refers to when n_keys reaches this */
+    unsigned n_sweep;
+};
+
+/* Unlike avahi_key_equal() this doesn't ignore case, interning must
+ * not change the names we pass on */
+static int key_identical(const AvahiKey *a, const AvahiKey *b) {
+    assert(a);
+    assert(b);
+
+    return a == b ||
+        (a->type == b->type &&
+         a->clazz == b->clazz &&
+         strcmp(a->name, b->name) == 0);
+}
+
+AvahiKeyTable *avahi_key_table_new(void) {
+    AvahiKeyTable *t;
+
+    if (!(t = avahi_new(AvahiKeyTable, 1))) {
+        avahi_log_error(__FILE__": Out of memory");
+        return NULL;
+    }
+
+    /* The table holds one reference to each key */
+    if (!(t->keys = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) key_identical, NULL, (AvahiFreeFunc) avahi_key_unref))) {
+        avahi_log_error(__FILE__": Out of memory");
+        avahi_free(t);
+        return NULL;
+    }
+
+    t->n_keys = 0;
+    t->n_sweep = AVAHI_KEY_TABLE_SWEEP_MIN;
+
+    return t;
+}
+
+void avahi_key_table_free(AvahiKeyTable *t) {
+    assert(t);
+
+    avahi_hashmap_free(t->keys);
+    avahi_free(t);
+}
+
+struct sweep_data {
+    AvahiKey **unused;
+    unsigned n_unused;
+};
+
+static void sweep_callback(AVAHI_GCC_UNUSED void *key, void *value, void *userdata) {
+    AvahiKey *k = value;
+    struct sweep_data *d = userdata;
+
+    if (k->ref <= 1)
+        d->unused[d->n_unused++] = k;
+}
+
+static void key_table_sweep(AvahiKeyTable *t) {
+    struct sweep_data d;
+    unsigned i;
+
+    assert(t);
+
+    if (!(d.unused = avahi_new(AvahiKey*, t->n_keys)))
+        return; /* OOM, try again next time */
+
+    d.n_unused = 0;
+    avahi_hashmap_foreach(t->keys, sweep_callback, &d);
+
+    for (i = 0; i < d.n_unused; i++)
+        avahi_hashmap_remove(t->keys, d.unused[i]);
+
+    avahi_free(d.unused);
+
+    assert(t->n_keys >= d.n_unused);
+    t->n_keys -= d.n_unused;
+
+    /* Make sure the sweeps are amortized over the insertions */
+    t->n_sweep = t->n_keys * 2;
+    if (t->n_sweep < AVAHI_KEY_TABLE_SWEEP_MIN)
+        t->n_sweep = AVAHI_KEY_TABLE_SWEEP_MIN;
+}
+
+AvahiKey *avahi_key_table_get(AvahiKeyTable *t, const char *name, uint16_t class, uint16_t type) {
+    char normalized[AVAHI_DOMAIN_NAME_MAX];
+    uint8_t canonical[AVAHI_CANONICAL_NAME_MAX];
+    KeyPrivate lookup;
+    AvahiKey *k;
+    unsigned hash;
+    size_t size;
+
+    assert(t);
+    assert(name);
+
+    if (!avahi_normalize_name(name, normalized, sizeof(normalized)))
+        return NULL;
+
+    if (!(size = canonicalize_name(normalized, canonical, sizeof(canonical), &hash)))
+        return NULL;
+
+    lookup.key.ref = 1;
+    lookup.key.name = normalized;
+    lookup.key.clazz = class;
+    lookup.key.type = type;
+    lookup.hash = hash + type + class;
+    lookup.canonical_size = (uint16_t) size;
+    lookup.canonical = canonical;
+
+    if ((k = avahi_hashmap_lookup(t->keys, &lookup.key)))
+        return avahi_key_ref(k);
+
+    if (t->n_keys >= t->n_sweep)
+        key_table_sweep(t);
+
+    if (!(k = avahi_key_new(normalized, class, type)))
+        return NULL;
+
+    /* If we cannot add it to the table the key is still usable, it
+     * just isn't shared */
+    if (avahi_hashmap_insert(t->keys, k, avahi_key_ref(k)) == 0)
+        t->n_keys++;
+
+    return k;
+}
@@ -51,7 +51,8 @@ enum {
 /** Encapsulates a DNS query key consisting of class, type and
     name. Use avahi_key_ref()/avahi_key_unref() for manipulating the
     reference counter. The structure is intended to be treated as "immutable", no
-    changes should be imposed after creation */
+    changes should be imposed after creation. Keys need to be created
+    with avahi_key_new(), which allocates some private data along with them. */
 typedef struct AvahiKey {
     int ref;           /**< Reference counter */
     char *name;        /**< Record name */
@@ -26,6 +26,7 @@
 
 #include <avahi-common/llist.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/pool.h>
 
 #include "rrlist.h"
 #include "log.h"
@@ -45,6 +46,8 @@ struct AvahiRecordList {
     AVAHI_LLIST_HEAD(AvahiRecordListItem, read);
     AVAHI_LLIST_HEAD(AvahiRecordListItem, unread);
 
+    AvahiPool *item_pool;
+
     int all_flush_cache;
 };
 
@@ -56,6 +59,12 @@ AvahiRecordList *avahi_record_list_new(void) {
         return NULL;
     }
 
+    if (!(l->item_pool = avahi_pool_new("record-list-item", sizeof(AvahiRecordListItem), 0))) {
+        avahi_log_error("avahi_pool_new() failed.");
+        avahi_free(l);
+        return NULL;
+    }
+
     AVAHI_LLIST_HEAD_INIT(AvahiRecordListItem, l->read);
     AVAHI_LLIST_HEAD_INIT(AvahiRecordListItem, l->unread);
 
@@ -67,6 +76,7 @@ void avahi_record_list_free(AvahiRecordList *l) {
     assert(l);
 
     avahi_record_list_flush(l);
+    avahi_pool_free(l->item_pool);
     avahi_free(l);
 }
 
@@ -80,7 +90,7 @@ static void item_free(AvahiRecordList *l, AvahiRecordListItem *i) {
         AVAHI_LLIST_REMOVE(AvahiRecordListItem, items, l->unread, i);
 
     avahi_record_unref(i->record);
-    avahi_free(i);
+    avahi_pool_release(l->item_pool, i);
 }
 
 void avahi_record_list_flush(AvahiRecordList *l) {
@@ -145,8 +155,8 @@ void avahi_record_list_push(AvahiRecordList *l, AvahiRecord *r, int flush_cache,
     if (get(l, r))
         return;
 
-    if (!(i = avahi_new(AvahiRecordListItem, 1))) {
-        avahi_log_error("avahi_new() failed.");
+    if (!(i = avahi_pool_alloc(l->item_pool))) {
+        avahi_log_error("avahi_pool_alloc() failed.");
         return;
     }
 
@@ -0,0 +1,269 @@
+/***
+  This file is part of avahi.
+
+  avahi is free software; you can redistribute it and/or modify it
+  under the terms of the GNU Lesser General Public License as
+  published by the Free Software Foundation; either version 2.1 of the
+  License, or (at your option) any later version.
+
+  avahi is distributed in the hope that it will be useful, but WITHOUT
+  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+  or FITNESS FOR A PARTICULAR PURPOSE. See the GNU Lesser General
+  Public License for more details.
+
+  You should have received a copy of the GNU Lesser General Public
+  License along with avahi; if not, write to the Free Software
+  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307
+  USA.
+***/
+
+#ifdef HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <sys/time.h>
+
+#include <avahi-common/gccmacro.h>
+#include <avahi-common/malloc.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/simple-watch.h>
+#include <avahi-common/address.h>
+#include <avahi-common/defs.h>
+
+#include "internal.h"
+#include "iface.h"
+#include "response-sched.h"
+#include "query-sched.h"
+#include "probe-sched.h"
+
+/* The schedulers only need a small part of the server and the
+ * interface objects, so we fake them here instead of setting up a
+ * real server with sockets. Nothing is ever sent since we never run
+ * the main loop. */
+
+static AvahiServer server;
+static AvahiInterfaceMonitor monitor;
+static AvahiHwInterface hardware;
+static AvahiInterface interface;
+
+static void setup(AvahiSimplePoll *simple_poll) {
+    memset(&server, 0, sizeof(server));
+    memset(&monitor, 0, sizeof(monitor));
+    memset(&hardware, 0, sizeof(hardware));
+    memset(&interface, 0, sizeof(interface));
+
+    server.time_event_queue = avahi_time_event_queue_new(avahi_simple_poll_get(simple_poll), AVAHI_TIME_EVENT_QUEUE_PRIOQ);
+    server.response_job_pool = avahi_response_job_pool_new();
+    server.query_job_pool = avahi_query_job_pool_new();
+    server.probe_job_pool = avahi_probe_job_pool_new();
+
+    monitor.server = &server;
+
+    hardware.monitor = &monitor;
+    hardware.index = 1;
+    hardware.mtu = 1500;
+
+    interface.monitor = &monitor;
+    interface.hardware = &hardware;
+    interface.protocol = AVAHI_PROTO_INET;
+    interface.announcing = 1;
+}
+
+static void teardown(void) {
+    avahi_time_event_queue_free(server.time_event_queue);
+    avahi_pool_free(server.response_job_pool);
+    avahi_pool_free(server.query_job_pool);
+    avahi_pool_free(server.probe_job_pool);
+}
+
+static AvahiRecord **make_ptr_records(unsigned n) {
+    AvahiRecord **records;
+    unsigned i;
+
+    records = avahi_new(AvahiRecord*, n);
+
+    /* Like the answers to a browse for a popular service type: all
+     * records share the same key */
+    for (i = 0; i < n; i++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "Service %u._http._tcp.local", i);
+
+        records[i] = avahi_record_new_full("_http._tcp.local", AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_PTR, AVAHI_DEFAULT_TTL);
+        records[i]->data.ptr.name = avahi_strdup(name);
+    }
+
+    return records;
+}
+
+static void free_records(AvahiRecord **records, unsigned n) {
+    unsigned i;
+
+    for (i = 0; i < n; i++)
+        avahi_record_unref(records[i]);
+
+    avahi_free(records);
+}
+
+static void benchmark_response(unsigned n) {
+    AvahiResponseScheduler *s;
+    AvahiRecord **records;
+    AvahiAddress querier;
+    struct timeval start;
+    unsigned i, n_accepted;
+    int r;
+
+    records = make_ptr_records(n);
+    s = avahi_response_scheduler_new(&interface);
+    assert(s);
+
+    avahi_address_parse("192.168.50.1", AVAHI_PROTO_INET, &querier);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        r = avahi_response_scheduler_post(s, records[i], 0, &querier, 0);
+        assert(r);
+    }
+    printf("response: post %u:       %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        /* Already scheduled, hence merged */
+        r = avahi_response_scheduler_post(s, records[i], 1, &querier, 0);
+        assert(r);
+    }
+    printf("response: repost %u:     %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i += 2)
+        avahi_response_scheduler_suppress(s, records[i], &querier);
+    printf("response: suppress %u:   %8llu usec\n", n/2, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 1; i < n; i += 2)
+        avahi_response_scheduler_incoming(s, records[i], 1);
+    printf("response: incoming %u:   %8llu usec\n", n/2, (unsigned long long) avahi_age(&start));
+
+    /* Everything is either suppressed or in the history now, unless
+     * the steps above took longer than the suppression intervals */
+    gettimeofday(&start, NULL);
+    for (i = 0, n_accepted = 0; i < n; i++)
+        if (avahi_response_scheduler_post(s, records[i], 1, &querier, 0))
+            n_accepted++;
+    printf("response: suppressed %u: %8llu usec (%u accepted)\n", n, (unsigned long long) avahi_age(&start), n_accepted);
+
+    avahi_response_scheduler_free(s);
+    free_records(records, n);
+}
+
+static void benchmark_query(unsigned n) {
+    AvahiQueryScheduler *s;
+    AvahiKey **keys;
+    unsigned *ids;
+    struct timeval start;
+    unsigned i, n_withdrawn;
+    int r;
+
+    keys = avahi_new(AvahiKey*, n);
+    ids = avahi_new(unsigned, n);
+
+    for (i = 0; i < n; i++) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "host-%u.local", i);
+        keys[i] = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_A);
+    }
+
+    s = avahi_query_scheduler_new(&interface);
+    assert(s);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        r = avahi_query_scheduler_post(s, keys[i], 0, &ids[i]);
+        assert(r);
+    }
+    printf("query: post %u:          %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        unsigned id;
+
+        /* Duplicate questions are merged into the scheduled job */
+        r = avahi_query_scheduler_post(s, keys[i], 0, &id);
+        assert(r);
+        assert(id == ids[i]);
+    }
+    printf("query: repost %u:        %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i += 2)
+        avahi_query_scheduler_incoming(s, keys[i]);
+    printf("query: incoming %u:      %8llu usec\n", n/2, (unsigned long long) avahi_age(&start));
+
+    /* Jobs that were posted twice need to be withdrawn twice */
+    gettimeofday(&start, NULL);
+    for (i = 1, n_withdrawn = 0; i < n; i += 2) {
+        avahi_query_scheduler_withdraw_by_id(s, ids[i]);
+        n_withdrawn += avahi_query_scheduler_withdraw_by_id(s, ids[i]);
+    }
+    printf("query: withdraw %u:      %8llu usec\n", n/2, (unsigned long long) avahi_age(&start));
+    assert(n_withdrawn == n/2);
+
+    avahi_query_scheduler_free(s);
+
+    for (i = 0; i < n; i++)
+        avahi_key_unref(keys[i]);
+
+    avahi_free(keys);
+    avahi_free(ids);
+}
+
+static void benchmark_probe(unsigned n) {
+    AvahiProbeScheduler *s;
+    AvahiRecord **records;
+    struct timeval start;
+    unsigned i;
+    int r;
+
+    records = make_ptr_records(n);
+    s = avahi_probe_scheduler_new(&interface);
+    assert(s);
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        r = avahi_probe_scheduler_post(s, records[i], 0);
+        assert(r);
+    }
+    printf("probe: post %u:          %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < n; i++) {
+        /* Already scheduled, hence merged */
+        r = avahi_probe_scheduler_post(s, records[i], 1);
+        assert(r);
+    }
+    printf("probe: repost %u:        %8llu usec\n", n, (unsigned long long) avahi_age(&start));
+
+    avahi_probe_scheduler_free(s);
+    free_records(records, n);
+}
+
+int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+    AvahiSimplePoll *simple_poll;
+
+    simple_poll = avahi_simple_poll_new();
+    setup(simple_poll);
+
+    benchmark_response(10000);
+    benchmark_query(10000);
+    benchmark_probe(10000);
+
+    teardown();
+    avahi_simple_poll_free(simple_poll);
+
+    return 0;
+}
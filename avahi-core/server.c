@@ -59,14 +59,19 @@ static void enum_aux_records(AvahiServer *s, AvahiInterface *i, const char *name
 
     if (type == AVAHI_DNS_TYPE_ANY) {
         AvahiEntry *e;
+        AvahiKey *k;
+
+        if (!(k = avahi_key_new(name, AVAHI_DNS_CLASS_IN, AVAHI_DNS_TYPE_ANY)))
+            return; /** OOM */
 
-        for (e = s->entries; e; e = e->entries_next)
+        for (e = avahi_hashmap_lookup(s->entries_by_name, k); e; e = e->by_name_next)
             if (!e->dead &&
                 avahi_entry_is_registered(s, e, i) &&
-                e->record->key->clazz == AVAHI_DNS_CLASS_IN &&
-                avahi_domain_equal(name, e->record->key->name))
+                e->record->key->clazz == AVAHI_DNS_CLASS_IN)
                 callback(s, e->record, e->flags & AVAHI_PUBLISH_UNIQUE, userdata);
 
+        avahi_key_unref(k);
+
     } else {
         AvahiEntry *e;
         AvahiKey *k;
@@ -122,7 +127,7 @@ void avahi_server_prepare_matching_responses(AvahiServer *s, AvahiInterface *i,
 
         /* Handle ANY query */
 
-        for (e = s->entries; e; e = e->entries_next)
+        for (e = avahi_hashmap_lookup(s->entries_by_name, k); e; e = e->by_name_next)
             if (!e->dead && avahi_key_pattern_match(k, e->record->key) && avahi_entry_is_registered(s, e, i))
                 avahi_server_prepare_response(s, i, e, unicast_response, 0);
 
@@ -167,7 +172,7 @@ static void withdraw_entry(AvahiServer *s, AvahiEntry *e) {
         for (k = e->group->entries; k; k = k->by_group_next)
             if (!k->dead) {
                 avahi_goodbye_entry(s, k, 0, 1);
-                k->dead = 1;
+                avahi_entry_mark_dead(s, k);
             }
 
         e->group->n_probing = 0;
@@ -175,10 +180,8 @@ static void withdraw_entry(AvahiServer *s, AvahiEntry *e) {
         avahi_s_entry_group_change_state(e->group, AVAHI_ENTRY_GROUP_COLLISION);
     } else {
         avahi_goodbye_entry(s, e, 0, 1);
-        e->dead = 1;
+        avahi_entry_mark_dead(s, e);
     }
-
-    s->need_entry_cleanup = 1;
 }
 
 static void withdraw_rrset(AvahiServer *s, AvahiKey *key) {
@@ -388,6 +391,8 @@ void avahi_server_generate_response(AvahiServer *s, AvahiInterface *i, AvahiDnsP
             avahi_record_unref(r);
         }
 
+        avahi_response_memo_store(i->response_memo, p, reply, s->response_generation);
+
         if (avahi_dns_packet_get_field(reply, AVAHI_DNS_FIELD_ANCOUNT) != 0)
             avahi_interface_send_packet_unicast(i, reply, a, port);
 
@@ -527,6 +532,10 @@ static void* reflect_cache_walk_callback(AvahiCache *c, AvahiKey *pattern, Avahi
             (r->data.aaaa.address.address[1] == 0x80))
       return NULL;
 
+    /* Don't spread records we haven't seen on the network ourselves */
+    if (e->unverified)
+        return NULL;
+
     avahi_record_list_push(s->record_list, e->record, e->cache_flush, 0, 0);
     return NULL;
 }
@@ -568,7 +577,26 @@ static void reflect_probe(AvahiServer *s, AvahiInterface *i, AvahiRecord *r) {
             avahi_interface_post_probe(j, r, 1);
 }
 
+static int known_answer_is_relevant(AvahiServer *s, AvahiInterface *i, AvahiKey *k) {
+    assert(s);
+    assert(i);
+    assert(k);
+
+    /* A known answer can only suppress responses for records we
+     * publish or reflect, or stop the POOF algorithm for cached
+     * ones. Everything else doesn't need to be parsed any further. */
+
+    if (avahi_key_is_pattern(k))
+        return 0;
+
+    return
+        s->config.enable_reflector ||
+        avahi_hashmap_lookup(s->entries_by_key, k) ||
+        avahi_cache_is_poofing(i->cache, k);
+}
+
 static void handle_query_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterface *i, const AvahiAddress *a, uint16_t port, int legacy_unicast, int from_local_iface) {
+    AvahiDnsPacket *memo_reply = NULL;
     size_t n;
     int is_probe;
 
@@ -581,6 +609,11 @@ static void handle_query_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterfac
 
     is_probe = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_NSCOUNT) > 0;
 
+    /* Legacy unicast replies contain nothing but what we'd answer to
+     * the questions, so we can reuse the one we sent last time */
+    if (legacy_unicast)
+        memo_reply = avahi_response_memo_lookup(i->response_memo, p, s->response_generation);
+
     /* Handle the questions */
     for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_QDCOUNT); n > 0; n --) {
         AvahiKey *key;
@@ -603,18 +636,41 @@ static void handle_query_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterfac
              * queries only when they do not include known answers */
             avahi_query_scheduler_incoming(i->query_scheduler, key);
 
-        avahi_server_prepare_matching_responses(s, i, key, unicast_response);
+        if (!memo_reply)
+            avahi_server_prepare_matching_responses(s, i, key, unicast_response);
+
         avahi_key_unref(key);
     }
 
+    if (memo_reply) {
+        if (avahi_dns_packet_get_field(memo_reply, AVAHI_DNS_FIELD_ANCOUNT) != 0)
+            avahi_interface_send_packet_unicast(i, memo_reply, a, port);
+
+        avahi_dns_packet_free(memo_reply);
+        return;
+    }
+
     if (!legacy_unicast) {
 
         /* Known Answer Suppression */
         for (n = avahi_dns_packet_get_field(p, AVAHI_DNS_FIELD_ANCOUNT); n > 0; n --) {
+            AvahiRecordView view;
             AvahiRecord *record;
-            int unique = 0;
 
-            if (!(record = avahi_dns_packet_consume_record(p, &unique))) {
+            if (avahi_dns_packet_consume_record_view(p, &view) < 0) {
+                avahi_log_debug(__FILE__": Packet too short or invalid while reading known answer record. (Maybe a UTF-8 problem?)");
+                goto fail;
+            }
+
+            if (!known_answer_is_relevant(s, i, view.key)) {
+                avahi_record_view_done(&view);
+                continue;
+            }
+
+            record = avahi_record_view_materialize(&view);
+            avahi_record_view_done(&view);
+
+            if (!record) {
                 avahi_log_debug(__FILE__": Packet too short or invalid while reading known answer record. (Maybe a UTF-8 problem?)");
                 goto fail;
             }
@@ -652,6 +708,9 @@ static void handle_query_packet(AvahiServer *s, AvahiDnsPacket *p, AvahiInterfac
     return;
 
 fail:
+    if (memo_reply)
+        avahi_dns_packet_free(memo_reply);
+
     avahi_record_list_flush(s->record_list);
 }
 
@@ -865,9 +924,9 @@ static void reflect_legacy_unicast_query_packet(AvahiServer *s, AvahiDnsPacket *
             (s->config.reflect_ipv || j->protocol == i->protocol)) {
 
             if (j->protocol == AVAHI_PROTO_INET && s->fd_legacy_unicast_ipv4 >= 0) {
-                avahi_send_dns_packet_ipv4(s->fd_legacy_unicast_ipv4, j->hardware->index, p, NULL, NULL, 0);
+                avahi_server_send_dns_packet_ipv4(s, s->fd_legacy_unicast_ipv4, j->hardware->index, p, NULL, NULL, 0);
             } else if (j->protocol == AVAHI_PROTO_INET6 && s->fd_legacy_unicast_ipv6 >= 0)
-                avahi_send_dns_packet_ipv6(s->fd_legacy_unicast_ipv6, j->hardware->index, p, NULL, NULL, 0);
+                avahi_server_send_dns_packet_ipv6(s, s->fd_legacy_unicast_ipv6, j->hardware->index, p, NULL, NULL, 0);
         }
 
     /* Reset the id */
@@ -940,6 +999,8 @@ static void dispatch_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddres
     assert(iface > 0);
     assert(src_address->proto == dst_address->proto);
 
+    p->key_table = s->key_table;
+
     if (!(i = avahi_interface_monitor_get_interface(s->monitor, iface, src_address->proto)) ||
         !i->announcing) {
         avahi_log_debug("Received packet from invalid interface.");
@@ -1064,65 +1125,132 @@ static void dispatch_legacy_unicast_packet(AvahiServer *s, AvahiDnsPacket *p) {
     avahi_dns_packet_set_field(p, AVAHI_DNS_FIELD_ID, slot->id);
 }
 
+static void dispatch_mcast_packet(AvahiServer *s, AvahiDnsPacket *p, const AvahiAddress *src, uint16_t port, const AvahiAddress *dest, AvahiIfIndex iface, uint8_t ttl) {
+    assert(s);
+    assert(p);
+
+    if (iface == AVAHI_IF_UNSPEC)
+        iface = avahi_find_interface_for_address(s->monitor, dest);
+
+    if (iface != AVAHI_IF_UNSPEC)
+        dispatch_packet(s, p, src, port, dest, iface, ttl);
+    else
+        avahi_log_error("Incoming packet received on address that isn't local.");
+}
+
 static void mcast_socket_event(AvahiWatch *w, int fd, AvahiWatchEvent events, void *userdata) {
     AvahiServer *s = userdata;
-    AvahiAddress dest, src;
-    AvahiDnsPacket *p = NULL;
-    AvahiIfIndex iface;
-    uint16_t port;
-    uint8_t ttl;
+    int n, i;
 
     assert(w);
     assert(fd >= 0);
     assert(events & AVAHI_WATCH_IN);
 
-    if (fd == s->fd_ipv4) {
-        dest.proto = src.proto = AVAHI_PROTO_INET;
-        p = avahi_recv_dns_packet_ipv4(s->fd_ipv4, &src.data.ipv4, &port, &dest.data.ipv4, &iface, &ttl);
-    } else {
+    if (fd == s->fd_ipv4)
+        n = avahi_recv_dns_packets_ipv4(s->fd_ipv4, s->recv_batch);
+    else {
         assert(fd == s->fd_ipv6);
-        dest.proto = src.proto = AVAHI_PROTO_INET6;
-        p = avahi_recv_dns_packet_ipv6(s->fd_ipv6, &src.data.ipv6, &port, &dest.data.ipv6, &iface, &ttl);
+        n = avahi_recv_dns_packets_ipv6(s->fd_ipv6, s->recv_batch);
     }
 
-    if (p) {
-        if (iface == AVAHI_IF_UNSPEC)
-            iface = avahi_find_interface_for_address(s->monitor, &dest);
-
-        if (iface != AVAHI_IF_UNSPEC)
-            dispatch_packet(s, p, &src, port, &dest, iface, ttl);
-        else
-            avahi_log_error("Incoming packet received on address that isn't local.");
+    if (n <= 0)
+        return;
 
-        avahi_dns_packet_free(p);
+    for (i = 0; i < n; i++) {
+        AvahiAddress dest, src;
+        AvahiDnsPacket *p;
+        AvahiIfIndex iface;
+        uint16_t port;
+        uint8_t ttl;
 
-        avahi_cleanup_dead_entries(s);
+        if ((p = avahi_recv_batch_get(s->recv_batch, (unsigned) i, &src, &port, &dest, &iface, &ttl)))
+            dispatch_mcast_packet(s, p, &src, port, &dest, iface, ttl);
     }
+
+    avahi_cleanup_dead_entries(s);
 }
 
 static void legacy_unicast_socket_event(AvahiWatch *w, int fd, AvahiWatchEvent events, void *userdata) {
     AvahiServer *s = userdata;
-    AvahiDnsPacket *p = NULL;
+    int n, i;
 
     assert(w);
     assert(fd >= 0);
     assert(events & AVAHI_WATCH_IN);
 
     if (fd == s->fd_legacy_unicast_ipv4)
-        p = avahi_recv_dns_packet_ipv4(s->fd_legacy_unicast_ipv4, NULL, NULL, NULL, NULL, NULL);
+        n = avahi_recv_dns_packets_ipv4(s->fd_legacy_unicast_ipv4, s->recv_batch);
     else {
         assert(fd == s->fd_legacy_unicast_ipv6);
-        p = avahi_recv_dns_packet_ipv6(s->fd_legacy_unicast_ipv6, NULL, NULL, NULL, NULL, NULL);
+        n = avahi_recv_dns_packets_ipv6(s->fd_legacy_unicast_ipv6, s->recv_batch);
     }
 
-    if (p) {
-        dispatch_legacy_unicast_packet(s, p);
-        avahi_dns_packet_free(p);
+    if (n <= 0)
+        return;
+
+    /* Responses are forwarded right away, so the packets don't need
+     * to outlive the batch */
+    for (i = 0; i < n; i++) {
+        AvahiDnsPacket *p;
+
+        if ((p = avahi_recv_batch_get(s->recv_batch, (unsigned) i, NULL, NULL, NULL, NULL, NULL)))
+            dispatch_legacy_unicast_packet(s, p);
+    }
+
+    avahi_cleanup_dead_entries(s);
+}
+
+static void send_queue_timeout_callback(AvahiTimeout *t, void *userdata) {
+    AvahiServer *s = userdata;
+
+    assert(s);
+    assert(s->send_queue_timeout == t);
+
+    s->poll_api->timeout_update(t, NULL);
+    avahi_send_queue_flush(s->send_queue);
+}
 
-        avahi_cleanup_dead_entries(s);
+static void send_queue_schedule(AvahiServer *s) {
+    struct timeval tv;
+
+    assert(s);
+
+    /* Flush on the next main loop iteration, i.e. after everything
+     * that is due right now has had its chance to queue packets */
+    if (avahi_send_queue_length(s->send_queue) == 1) {
+        gettimeofday(&tv, NULL);
+        s->poll_api->timeout_update(s->send_queue_timeout, &tv);
     }
 }
 
+int avahi_server_send_dns_packet_ipv4(AvahiServer *s, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv4Address *src_address, const AvahiIPv4Address *dst_address, uint16_t dst_port) {
+    int r;
+
+    assert(s);
+
+    if (!s->send_queue)
+        return avahi_send_dns_packet_ipv4(fd, iface, p, src_address, dst_address, dst_port);
+
+    r = avahi_send_queue_push_ipv4(s->send_queue, fd, iface, p, src_address, dst_address, dst_port);
+    send_queue_schedule(s);
+
+    return r;
+}
+
+int avahi_server_send_dns_packet_ipv6(AvahiServer *s, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv6Address *src_address, const AvahiIPv6Address *dst_address, uint16_t dst_port) {
+    int r;
+
+    assert(s);
+
+    if (!s->send_queue)
+        return avahi_send_dns_packet_ipv6(fd, iface, p, src_address, dst_address, dst_port);
+
+    r = avahi_send_queue_push_ipv6(s->send_queue, fd, iface, p, src_address, dst_address, dst_port);
+    send_queue_schedule(s);
+
+    return r;
+}
+
 static void server_set_state(AvahiServer *s, AvahiServerState state) {
     assert(s);
 
@@ -1387,17 +1515,32 @@ static int valid_server_config(const AvahiServerConfig *sc) {
         if (!avahi_is_valid_domain_name((char*) l->text))
             return AVAHI_ERR_INVALID_DOMAIN_NAME;
 
+    if (sc->timer_slack < 0)
+        return AVAHI_ERR_INVALID_CONFIG;
+
+    if (sc->recv_batch_size > AVAHI_RECV_BATCH_MAX)
+        return AVAHI_ERR_INVALID_CONFIG;
+
+    if (sc->send_batch_size > AVAHI_SEND_QUEUE_MAX)
+        return AVAHI_ERR_INVALID_CONFIG;
+
     return AVAHI_OK;
 }
 
 static int setup_sockets(AvahiServer *s) {
     assert(s);
 
+    /* All sockets are read into the same set of reusable buffers */
+    if (!(s->recv_batch = avahi_recv_batch_new(s->config.recv_batch_size > 1 ? s->config.recv_batch_size : 1)))
+        return AVAHI_ERR_NO_MEMORY;
+
     s->fd_ipv4 = s->config.use_ipv4 ? avahi_open_socket_ipv4(s->config.disallow_other_stacks) : -1;
     s->fd_ipv6 = s->config.use_ipv6 ? avahi_open_socket_ipv6(s->config.disallow_other_stacks) : -1;
 
-    if (s->fd_ipv6 < 0 && s->fd_ipv4 < 0)
+    if (s->fd_ipv6 < 0 && s->fd_ipv4 < 0) {
+        avahi_recv_batch_free(s->recv_batch);
         return AVAHI_ERR_NO_NETWORK;
+    }
 
     if (s->fd_ipv4 < 0 && s->config.use_ipv4)
         avahi_log_notice("Failed to create IPv4 socket, proceeding in IPv6 only mode");
@@ -1407,6 +1550,18 @@ static int setup_sockets(AvahiServer *s) {
     s->fd_legacy_unicast_ipv4 = s->fd_ipv4 >= 0 && s->config.enable_reflector ? avahi_open_unicast_socket_ipv4() : -1;
     s->fd_legacy_unicast_ipv6 = s->fd_ipv6 >= 0 && s->config.enable_reflector ? avahi_open_unicast_socket_ipv6() : -1;
 
+    s->send_queue = NULL;
+    s->send_queue_timeout = NULL;
+
+    if (s->config.send_batch_size > 1) {
+        /* If this fails we simply send every packet right away */
+        if ((s->send_queue = avahi_send_queue_new(s->config.send_batch_size)) &&
+            !(s->send_queue_timeout = s->poll_api->timeout_new(s->poll_api, NULL, send_queue_timeout_callback, s))) {
+            avahi_send_queue_free(s->send_queue);
+            s->send_queue = NULL;
+        }
+    }
+
     s->watch_ipv4 =
         s->watch_ipv6 =
         s->watch_legacy_unicast_ipv4 =
@@ -1460,9 +1615,10 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
     }
 
     s->n_host_rr_pending = 0;
-    s->need_entry_cleanup = 0;
-    s->need_group_cleanup = 0;
-    s->need_browser_cleanup = 0;
+    s->response_generation = 0;
+    AVAHI_LLIST_HEAD_INIT(AvahiEntry, s->dead_entries);
+    AVAHI_LLIST_HEAD_INIT(AvahiSEntryGroup, s->dead_groups);
+    AVAHI_LLIST_HEAD_INIT(AvahiSRecordBrowser, s->dead_record_browsers);
     s->cleanup_time_event = NULL;
     s->hinfo_entry_group = NULL;
     s->browse_domain_entry_group = NULL;
@@ -1472,9 +1628,18 @@ AvahiServer *avahi_server_new(const AvahiPoll *poll_api, const AvahiServerConfig
     s->callback = callback;
     s->userdata = userdata;
 
-    s->time_event_queue = avahi_time_event_queue_new(poll_api);
+    s->cache_entry_pool = avahi_pool_new("cache-entry", sizeof(AvahiCacheEntry), 0);
+    s->response_job_pool = avahi_response_job_pool_new();
+    s->query_job_pool = avahi_query_job_pool_new();
+    s->probe_job_pool = avahi_probe_job_pool_new();
+    s->cache_records = s->config.share_cache_records ? avahi_cache_shared_records_new() : NULL;
+    s->key_table = avahi_key_table_new();
+
+    s->time_event_queue = avahi_time_event_queue_new(poll_api, s->config.use_timer_wheel ? AVAHI_TIME_EVENT_QUEUE_WHEEL : AVAHI_TIME_EVENT_QUEUE_PRIOQ);
+    avahi_time_event_queue_set_slack(s->time_event_queue, s->config.timer_slack);
 
     s->entries_by_key = avahi_hashmap_new((AvahiHashFunc) avahi_key_hash, (AvahiEqualFunc) avahi_key_equal, NULL, NULL);
+    s->entries_by_name = avahi_hashmap_new((AvahiHashFunc) avahi_key_name_hash, (AvahiEqualFunc) avahi_key_name_equal, NULL, NULL);
     AVAHI_LLIST_HEAD_INIT(AvahiEntry, s->entries);
     AVAHI_LLIST_HEAD_INIT(AvahiGroup, s->groups);
 
@@ -1550,12 +1715,20 @@ void avahi_server_free(AvahiServer* s) {
 
     avahi_interface_monitor_free(s->monitor);
 
+    /* The caches are gone now, and with them all shared records */
+    if (s->cache_records)
+        avahi_hashmap_free(s->cache_records);
+
+    if (s->key_table)
+        avahi_key_table_free(s->key_table);
+
     while (s->groups)
         avahi_entry_group_free(s, s->groups);
 
     free_slots(s);
 
     avahi_hashmap_free(s->entries_by_key);
+    avahi_hashmap_free(s->entries_by_name);
     avahi_record_list_free(s->record_list);
     avahi_hashmap_free(s->record_browser_hashmap);
 
@@ -1568,6 +1741,18 @@ void avahi_server_free(AvahiServer* s) {
 
     avahi_time_event_queue_free(s->time_event_queue);
 
+    avahi_pool_free(s->cache_entry_pool);
+    avahi_pool_free(s->response_job_pool);
+    avahi_pool_free(s->query_job_pool);
+    avahi_pool_free(s->probe_job_pool);
+
+    /* Send whatever is still queued, e.g. goodbye packets */
+    if (s->send_queue) {
+        avahi_send_queue_flush(s->send_queue);
+        avahi_send_queue_free(s->send_queue);
+        s->poll_api->timeout_free(s->send_queue_timeout);
+    }
+
     /* Free watches */
 
     if (s->watch_ipv4)
@@ -1580,6 +1765,8 @@ void avahi_server_free(AvahiServer* s) {
     if (s->watch_legacy_unicast_ipv6)
         s->poll_api->watch_free(s->watch_legacy_unicast_ipv6);
 
+    avahi_recv_batch_free(s->recv_batch);
+
     /* Free sockets */
 
     if (s->fd_ipv4 >= 0)
@@ -1670,6 +1857,11 @@ AvahiServerConfig* avahi_server_config_init(AvahiServerConfig *c) {
     c->n_cache_entries_max = AVAHI_DEFAULT_CACHE_ENTRIES_MAX;
     c->ratelimit_interval = 0;
     c->ratelimit_burst = 0;
+    c->use_timer_wheel = 0;
+    c->timer_slack = 0;
+    c->recv_batch_size = 0;
+    c->send_batch_size = 0;
+    c->share_cache_records = 0;
 
     return c;
 }
@@ -28,10 +28,6 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <sys/time.h>
-#include <sys/ioctl.h>
-#ifdef HAVE_SYS_FILIO_H
-#include <sys/filio.h>
-#endif
 #include <assert.h>
 
 #include <sys/types.h>
@@ -45,6 +41,8 @@
 #include <net/if_dl.h>
 #endif
 
+#include <avahi-common/malloc.h>
+
 #include "dns.h"
 #include "fdutil.h"
 #include "socket.h"
@@ -440,6 +438,21 @@ fail:
     return -1;
 }
 
+static void log_send_error(struct msghdr *msg, AvahiIfIndex interface, const char *func) {
+    char where[64];
+    struct sockaddr_storage *ss = msg->msg_name;
+
+    if (ss->ss_family == PF_INET) {
+        inet_ntop(ss->ss_family, &((struct sockaddr_in*)ss)->sin_addr, where, sizeof(where));
+    } else if (ss->ss_family == PF_INET6) {
+        inet_ntop(ss->ss_family, &((struct sockaddr_in6*)ss)->sin6_addr, where, sizeof(where));
+    } else {
+        where[0] = '\0';
+    }
+
+    avahi_log_debug("%s() to %s (iface #%d) failed: %s", func, where, interface, strerror(errno));
+}
+
 static int sendmsg_loop(int fd, struct msghdr *msg, int flags, AvahiIfIndex interface) {
 
     assert(fd >= 0);
@@ -454,21 +467,8 @@ static int sendmsg_loop(int fd, struct msghdr *msg, int flags, AvahiIfIndex inte
             continue;
 
         if (errno != EAGAIN) {
-            char where[64];
-            struct sockaddr_storage *ss = msg->msg_name;
-
-            if (ss->ss_family == PF_INET) {
-                inet_ntop(ss->ss_family, &((struct sockaddr_in*)ss)->sin_addr, where, sizeof(where));
-            } else if (ss->ss_family == PF_INET6) {
-                inet_ntop(ss->ss_family, &((struct sockaddr_in6*)ss)->sin6_addr, where, sizeof(where));
-            } else {
-                where[0] = '\0';
-            }
-
-            avahi_log_debug("sendmsg() to %s (iface #%d) failed: %s", where, interface, strerror(errno));
-
+            log_send_error(msg, interface, "sendmsg");
             return -1;
-
         }
 
         if (avahi_wait_for_write(fd) < 0)
@@ -478,58 +478,64 @@ static int sendmsg_loop(int fd, struct msghdr *msg, int flags, AvahiIfIndex inte
     return 0;
 }
 
-int avahi_send_dns_packet_ipv4(
+/* Large enough for every control message we attach to outgoing
+ * packets */
+typedef union AvahiSendControl {
+#ifdef IP_PKTINFO
+    uint8_t ipv4[CMSG_SPACE(sizeof(struct in_pktinfo))];
+#elif !defined(IP_MULTICAST_IF) && defined(IP_SENDSRCADDR)
+    uint8_t ipv4[CMSG_SPACE(sizeof(struct in_addr))];
+#endif
+    uint8_t ipv6[CMSG_SPACE(sizeof(struct in6_pktinfo))];
+    size_t align; /* for alignment on ia64 ! */
+} AvahiSendControl;
+
+static int ipv4_prepare_msg(
         int fd,
+        struct msghdr *msg,
+        struct sockaddr_in *sa,
+        struct iovec *io,
+        AvahiSendControl *control,
         AvahiIfIndex interface,
-        AvahiDnsPacket *p,
         const AvahiIPv4Address *src_address,
         const AvahiIPv4Address *dst_address,
         uint16_t dst_port) {
 
-    struct sockaddr_in sa;
-    struct msghdr msg;
-    struct iovec io;
-#ifdef IP_PKTINFO
-    struct cmsghdr *cmsg;
-    size_t cmsg_data[( CMSG_SPACE(sizeof(struct in_pktinfo)) / sizeof(size_t)) + 1];
-#elif !defined(IP_MULTICAST_IF) && defined(IP_SENDSRCADDR)
+#if defined(IP_PKTINFO) || (!defined(IP_MULTICAST_IF) && defined(IP_SENDSRCADDR))
     struct cmsghdr *cmsg;
-    size_t cmsg_data[( CMSG_SPACE(sizeof(struct in_addr)) / sizeof(size_t)) + 1];
 #endif
 
     assert(fd >= 0);
-    assert(p);
-    assert(avahi_dns_packet_check_valid(p) >= 0);
+    assert(msg);
+    assert(sa);
+    assert(io);
+    assert(control);
     assert(!dst_address || dst_port > 0);
 
     if (!dst_address)
-        mdns_mcast_group_ipv4(&sa);
+        mdns_mcast_group_ipv4(sa);
     else
-        ipv4_address_to_sockaddr(&sa, dst_address, dst_port);
-
-    memset(&io, 0, sizeof(io));
-    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
-    io.iov_len = p->size;
+        ipv4_address_to_sockaddr(sa, dst_address, dst_port);
 
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sa;
-    msg.msg_namelen = sizeof(sa);
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_flags = 0;
-    msg.msg_control = NULL;
-    msg.msg_controllen = 0;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = sa;
+    msg->msg_namelen = sizeof(*sa);
+    msg->msg_iov = io;
+    msg->msg_iovlen = 1;
+    msg->msg_flags = 0;
+    msg->msg_control = NULL;
+    msg->msg_controllen = 0;
 
 #ifdef IP_PKTINFO
     if (interface > 0 || src_address) {
         struct in_pktinfo *pkti;
 
-        memset(cmsg_data, 0, sizeof(cmsg_data));
-        msg.msg_control = cmsg_data;
-        msg.msg_controllen = CMSG_LEN(sizeof(struct in_pktinfo));
+        memset(control, 0, sizeof(*control));
+        msg->msg_control = control;
+        msg->msg_controllen = CMSG_LEN(sizeof(struct in_pktinfo));
 
-        cmsg = CMSG_FIRSTHDR(&msg);
-        cmsg->cmsg_len = msg.msg_controllen;
+        cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_len = msg->msg_controllen;
         cmsg->cmsg_level = IPPROTO_IP;
         cmsg->cmsg_type = IP_PKTINFO;
 
@@ -553,12 +559,12 @@ int avahi_send_dns_packet_ipv4(
     if (src_address) {
         struct in_addr *addr;
 
-        memset(cmsg_data, 0, sizeof(cmsg_data));
-        msg.msg_control = cmsg_data;
-        msg.msg_controllen = CMSG_LEN(sizeof(struct in_addr));
+        memset(control, 0, sizeof(*control));
+        msg->msg_control = control;
+        msg->msg_controllen = CMSG_LEN(sizeof(struct in_addr));
 
-        cmsg = CMSG_FIRSTHDR(&msg);
-        cmsg->cmsg_len = msg.msg_controllen;
+        cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_len = msg->msg_controllen;
         cmsg->cmsg_level = IPPROTO_IP;
         cmsg->cmsg_type = IP_SENDSRCADDR;
 
@@ -569,58 +575,50 @@ int avahi_send_dns_packet_ipv4(
 #warning "FIXME: We need some code to set the outgoing interface/local address here if IP_PKTINFO/IP_MULTICAST_IF is not available"
 #endif
 
-    return sendmsg_loop(fd, &msg, 0, interface);
+    return 0;
 }
 
-int avahi_send_dns_packet_ipv6(
-        int fd,
+static void ipv6_prepare_msg(
+        struct msghdr *msg,
+        struct sockaddr_in6 *sa,
+        struct iovec *io,
+        AvahiSendControl *control,
         AvahiIfIndex interface,
-        AvahiDnsPacket *p,
         const AvahiIPv6Address *src_address,
         const AvahiIPv6Address *dst_address,
         uint16_t dst_port) {
 
-    struct sockaddr_in6 sa;
-    struct msghdr msg;
-    struct iovec io;
     struct cmsghdr *cmsg;
-    union {
-        uint8_t cmsg_data[CMSG_SPACE(sizeof(struct in6_pktinfo))];
-        struct cmsghdr hdr;
-    } u;
 
-    assert(fd >= 0);
-    assert(p);
-    assert(avahi_dns_packet_check_valid(p) >= 0);
+    assert(msg);
+    assert(sa);
+    assert(io);
+    assert(control);
     assert(!dst_address || dst_port > 0);
 
     if (!dst_address)
-        mdns_mcast_group_ipv6(&sa);
+        mdns_mcast_group_ipv6(sa);
     else {
-        ipv6_address_to_sockaddr(&sa, dst_address, dst_port);
-        if (interface > 0 && IN6_IS_ADDR_LINKLOCAL(&sa.sin6_addr))
-            sa.sin6_scope_id = interface;
+        ipv6_address_to_sockaddr(sa, dst_address, dst_port);
+        if (interface > 0 && IN6_IS_ADDR_LINKLOCAL(&sa->sin6_addr))
+            sa->sin6_scope_id = interface;
     }
 
-    memset(&io, 0, sizeof(io));
-    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
-    io.iov_len = p->size;
-
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sa;
-    msg.msg_namelen = sizeof(sa);
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_flags = 0;
+    memset(msg, 0, sizeof(*msg));
+    msg->msg_name = sa;
+    msg->msg_namelen = sizeof(*sa);
+    msg->msg_iov = io;
+    msg->msg_iovlen = 1;
+    msg->msg_flags = 0;
 
     if (interface > 0 || src_address) {
         struct in6_pktinfo *pkti;
 
-        memset(u.cmsg_data, 0, sizeof(u.cmsg_data));
-        msg.msg_control = u.cmsg_data;
-        msg.msg_controllen = sizeof(u.cmsg_data);
+        memset(control, 0, sizeof(*control));
+        msg->msg_control = control;
+        msg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
 
-        cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg = CMSG_FIRSTHDR(msg);
         cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
         cmsg->cmsg_level = IPPROTO_IPV6;
         cmsg->cmsg_type = IPV6_PKTINFO;
@@ -633,99 +631,327 @@ int avahi_send_dns_packet_ipv6(
         if (src_address)
             memcpy(&pkti->ipi6_addr, src_address->address, sizeof(src_address->address));
     } else {
-        msg.msg_control = NULL;
-        msg.msg_controllen = 0;
+        msg->msg_control = NULL;
+        msg->msg_controllen = 0;
     }
+}
+
+int avahi_send_dns_packet_ipv4(
+        int fd,
+        AvahiIfIndex interface,
+        AvahiDnsPacket *p,
+        const AvahiIPv4Address *src_address,
+        const AvahiIPv4Address *dst_address,
+        uint16_t dst_port) {
+
+    struct sockaddr_in sa;
+    struct msghdr msg;
+    struct iovec io;
+    AvahiSendControl control;
+
+    assert(fd >= 0);
+    assert(p);
+    assert(avahi_dns_packet_check_valid(p) >= 0);
+
+    memset(&io, 0, sizeof(io));
+    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
+    io.iov_len = p->size;
+
+    if (ipv4_prepare_msg(fd, &msg, &sa, &io, &control, interface, src_address, dst_address, dst_port) < 0)
+        return -1;
 
     return sendmsg_loop(fd, &msg, 0, interface);
 }
 
-AvahiDnsPacket *avahi_recv_dns_packet_ipv4(
+int avahi_send_dns_packet_ipv6(
         int fd,
-        AvahiIPv4Address *ret_src_address,
-        uint16_t *ret_src_port,
-        AvahiIPv4Address *ret_dst_address,
-        AvahiIfIndex *ret_iface,
-        uint8_t *ret_ttl) {
+        AvahiIfIndex interface,
+        AvahiDnsPacket *p,
+        const AvahiIPv6Address *src_address,
+        const AvahiIPv6Address *dst_address,
+        uint16_t dst_port) {
 
-    AvahiDnsPacket *p= NULL;
+    struct sockaddr_in6 sa;
     struct msghdr msg;
     struct iovec io;
-    size_t aux[1024 / sizeof(size_t)]; /* for alignment on ia64 ! */
-    ssize_t l;
-    struct cmsghdr *cmsg;
-    int found_addr = 0;
-    int ms;
-    struct sockaddr_in sa;
+    AvahiSendControl control;
 
     assert(fd >= 0);
+    assert(p);
+    assert(avahi_dns_packet_check_valid(p) >= 0);
 
-    if (ioctl(fd, FIONREAD, &ms) < 0) {
-        avahi_log_warn("ioctl(): %s", strerror(errno));
-        goto fail;
+    memset(&io, 0, sizeof(io));
+    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
+    io.iov_len = p->size;
+
+    ipv6_prepare_msg(&msg, &sa, &io, &control, interface, src_address, dst_address, dst_port);
+
+    return sendmsg_loop(fd, &msg, 0, interface);
+}
+
+typedef struct AvahiSendSlot {
+    int fd;
+    AvahiIfIndex interface;
+
+    struct msghdr msg;
+    struct iovec io;
+    union {
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } name;
+    AvahiSendControl control;
+
+    /* A copy of the packet, since the caller may modify or free it
+     * right after queuing it */
+    uint8_t *data;
+    size_t data_allocated;
+} AvahiSendSlot;
+
+struct AvahiSendQueue {
+    AvahiSendSlot *slots;
+    unsigned n_slots, n_queued;
+#ifdef HAVE_SENDMMSG
+    struct mmsghdr *msgs;
+#endif
+};
+
+AvahiSendQueue *avahi_send_queue_new(unsigned n) {
+    AvahiSendQueue *q;
+
+    assert(n > 0);
+
+    if (!(q = avahi_new0(AvahiSendQueue, 1)))
+        goto oom;
+
+    if (!(q->slots = avahi_new0(AvahiSendSlot, n)))
+        goto oom;
+
+#ifdef HAVE_SENDMMSG
+    if (!(q->msgs = avahi_new0(struct mmsghdr, n)))
+        goto oom;
+#endif
+
+    q->n_slots = n;
+    return q;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+
+    if (q) {
+        avahi_free(q->slots);
+        avahi_free(q);
     }
 
-    if (ms < 0) {
-        avahi_log_warn("FIONREAD returned negative value.");
-        goto fail;
+    return NULL;
+}
+
+void avahi_send_queue_free(AvahiSendQueue *q) {
+    unsigned i;
+
+    assert(q);
+    assert(q->n_queued == 0);
+
+    for (i = 0; i < q->n_slots; i++)
+        avahi_free(q->slots[i].data);
+
+    avahi_free(q->slots);
+#ifdef HAVE_SENDMMSG
+    avahi_free(q->msgs);
+#endif
+    avahi_free(q);
+}
+
+unsigned avahi_send_queue_length(AvahiSendQueue *q) {
+    assert(q);
+
+    return q->n_queued;
+}
+
+#ifdef HAVE_SENDMMSG
+
+/* Send the slots [idx, idx+n), which all belong to the same socket,
+ * with as few sendmmsg() calls as possible. Packets that fail are
+ * logged and skipped, like sendmsg_loop() does. */
+static void sendmmsg_loop(AvahiSendQueue *q, unsigned idx, unsigned n) {
+    unsigned i;
+    int fd;
+
+    assert(q);
+    assert(n > 0);
+
+    fd = q->slots[idx].fd;
+
+    for (i = 0; i < n; i++) {
+        q->msgs[i].msg_hdr = q->slots[idx + i].msg;
+        q->msgs[i].msg_len = 0;
     }
 
-    p = avahi_dns_packet_new(ms + AVAHI_DNS_PACKET_EXTRA_SIZE);
+    i = 0;
+    while (i < n) {
+        int r;
 
-    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
-    io.iov_len = p->max_size;
-
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = &sa;
-    msg.msg_namelen = sizeof(sa);
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_control = aux;
-    msg.msg_controllen = sizeof(aux);
-    msg.msg_flags = 0;
-
-    if ((l = recvmsg(fd, &msg, 0)) < 0) {
-        /* Linux returns EAGAIN when an invalid IP packet has been
-        received. We suppress warnings in this case because this might
-        create quite a bit of log traffic on machines with unstable
-        links. (See #60) */
+        if ((r = sendmmsg(fd, q->msgs + i, n - i, 0)) > 0) {
+            i += (unsigned) r;
+            continue;
+        }
 
-        if (errno != EAGAIN)
-            avahi_log_warn("recvmsg(): %s", strerror(errno));
+        if (r == 0)
+            break;
 
-        goto fail;
+        if (errno == EINTR)
+            continue;
+
+        if (errno == EAGAIN) {
+            if (avahi_wait_for_write(fd) < 0)
+                return;
+
+            continue;
+        }
+
+        /* The first remaining packet failed, skip it and carry on
+         * with the rest */
+        log_send_error(&q->msgs[i].msg_hdr, q->slots[idx + i].interface, "sendmmsg");
+        i++;
     }
+}
 
-    /* For corrupt packets FIONREAD returns zero size (See rhbz #607297). So
-     * fail after having read them. */
-    if (!ms)
-        goto fail;
+#endif
 
-    if (sa.sin_addr.s_addr == INADDR_ANY)
-        /* Linux 2.4 behaves very strangely sometimes! */
-        goto fail;
+void avahi_send_queue_flush(AvahiSendQueue *q) {
+    unsigned i;
 
-    assert(!(msg.msg_flags & MSG_CTRUNC));
-    assert(!(msg.msg_flags & MSG_TRUNC));
+    assert(q);
 
-    p->size = (size_t) l;
+#ifdef HAVE_SENDMMSG
+    i = 0;
+    while (i < q->n_queued) {
+        unsigned j;
 
-    if (ret_src_port)
-        *ret_src_port = avahi_port_from_sockaddr((struct sockaddr*) &sa);
+        /* Consecutive packets for the same socket go out together */
+        for (j = i + 1; j < q->n_queued && q->slots[j].fd == q->slots[i].fd; j++)
+            ;
+
+        sendmmsg_loop(q, i, j - i);
+        i = j;
+    }
+#else
+    for (i = 0; i < q->n_queued; i++)
+        sendmsg_loop(q->slots[i].fd, &q->slots[i].msg, 0, q->slots[i].interface);
+#endif
 
-    if (ret_src_address) {
-        AvahiAddress a;
-        avahi_address_from_sockaddr((struct sockaddr*) &sa, &a);
-        *ret_src_address = a.data.ipv4;
+    q->n_queued = 0;
+}
+
+static AvahiSendSlot *send_queue_slot(AvahiSendQueue *q, int fd, AvahiIfIndex interface, AvahiDnsPacket *p) {
+    AvahiSendSlot *slot;
+
+    assert(q);
+    assert(fd >= 0);
+    assert(p);
+
+    if (q->n_queued >= q->n_slots)
+        avahi_send_queue_flush(q);
+
+    slot = &q->slots[q->n_queued];
+
+    if (slot->data_allocated < p->size) {
+        uint8_t *d;
+
+        if (!(d = avahi_realloc(slot->data, p->size))) {
+            avahi_log_error(__FILE__": Out of memory");
+            return NULL;
+        }
+
+        slot->data = d;
+        slot->data_allocated = p->size;
     }
 
+    memcpy(slot->data, AVAHI_DNS_PACKET_DATA(p), p->size);
+
+    memset(&slot->io, 0, sizeof(slot->io));
+    slot->io.iov_base = slot->data;
+    slot->io.iov_len = p->size;
+
+    slot->fd = fd;
+    slot->interface = interface;
+
+    return slot;
+}
+
+int avahi_send_queue_push_ipv4(
+        AvahiSendQueue *q,
+        int fd,
+        AvahiIfIndex interface,
+        AvahiDnsPacket *p,
+        const AvahiIPv4Address *src_address,
+        const AvahiIPv4Address *dst_address,
+        uint16_t dst_port) {
+
+#ifdef IP_PKTINFO
+    AvahiSendSlot *slot;
+#endif
+
+    assert(q);
+    assert(fd >= 0);
+    assert(p);
+    assert(avahi_dns_packet_check_valid(p) >= 0);
+
+#ifdef IP_PKTINFO
+    if (!(slot = send_queue_slot(q, fd, interface, p)))
+        return avahi_send_dns_packet_ipv4(fd, interface, p, src_address, dst_address, dst_port);
+
+    ipv4_prepare_msg(fd, &slot->msg, &slot->name.in, &slot->io, &slot->control, interface, src_address, dst_address, dst_port);
+    q->n_queued++;
+
+    return 0;
+#else
+    /* Without IP_PKTINFO the outgoing interface may be a socket
+     * option, which would apply to all queued packets. Keep the order
+     * and send this one right away. */
+    avahi_send_queue_flush(q);
+    return avahi_send_dns_packet_ipv4(fd, interface, p, src_address, dst_address, dst_port);
+#endif
+}
+
+int avahi_send_queue_push_ipv6(
+        AvahiSendQueue *q,
+        int fd,
+        AvahiIfIndex interface,
+        AvahiDnsPacket *p,
+        const AvahiIPv6Address *src_address,
+        const AvahiIPv6Address *dst_address,
+        uint16_t dst_port) {
+
+    AvahiSendSlot *slot;
+
+    assert(q);
+    assert(fd >= 0);
+    assert(p);
+    assert(avahi_dns_packet_check_valid(p) >= 0);
+
+    if (!(slot = send_queue_slot(q, fd, interface, p)))
+        return avahi_send_dns_packet_ipv6(fd, interface, p, src_address, dst_address, dst_port);
+
+    ipv6_prepare_msg(&slot->msg, &slot->name.in6, &slot->io, &slot->control, interface, src_address, dst_address, dst_port);
+    q->n_queued++;
+
+    return 0;
+}
+
+static void ipv4_parse_cmsg(struct msghdr *msg, AvahiIPv4Address *ret_dst_address, AvahiIfIndex *ret_iface, uint8_t *ret_ttl) {
+    struct cmsghdr *cmsg;
+    int found_addr = 0;
+
+    assert(msg);
+    assert(!(msg->msg_flags & MSG_CTRUNC));
+
     if (ret_ttl)
         *ret_ttl = 255;
 
     if (ret_iface)
         *ret_iface = AVAHI_IF_UNSPEC;
 
-    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 
         if (cmsg->cmsg_level == IPPROTO_IP) {
 
@@ -791,93 +1017,16 @@ AvahiDnsPacket *avahi_recv_dns_packet_ipv4(
     }
 
     assert(found_addr);
-
-    return p;
-
-fail:
-    if (p)
-        avahi_dns_packet_free(p);
-
-    return NULL;
 }
 
-AvahiDnsPacket *avahi_recv_dns_packet_ipv6(
-        int fd,
-        AvahiIPv6Address *ret_src_address,
-        uint16_t *ret_src_port,
-        AvahiIPv6Address *ret_dst_address,
-        AvahiIfIndex *ret_iface,
-        uint8_t *ret_ttl) {
-
-    AvahiDnsPacket *p = NULL;
-    struct msghdr msg;
-    struct iovec io;
-    size_t aux[1024 / sizeof(size_t)];
-    ssize_t l;
-    int ms;
+static void ipv6_parse_cmsg(struct msghdr *msg, AvahiIPv6Address *ret_dst_address, AvahiIfIndex *ret_iface, uint8_t *ret_ttl) {
     struct cmsghdr *cmsg;
     int found_ttl = 0, found_iface = 0;
-    struct sockaddr_in6 sa;
-
-    assert(fd >= 0);
-
-    if (ioctl(fd, FIONREAD, &ms) < 0) {
-        avahi_log_warn("ioctl(): %s", strerror(errno));
-        goto fail;
-    }
-
-    if (ms < 0) {
-        avahi_log_warn("FIONREAD returned negative value.");
-        goto fail;
-    }
-
-    p = avahi_dns_packet_new(ms + AVAHI_DNS_PACKET_EXTRA_SIZE);
 
-    io.iov_base = AVAHI_DNS_PACKET_DATA(p);
-    io.iov_len = p->max_size;
-
-    memset(&msg, 0, sizeof(msg));
-    msg.msg_name = (struct sockaddr*) &sa;
-    msg.msg_namelen = sizeof(sa);
-
-    msg.msg_iov = &io;
-    msg.msg_iovlen = 1;
-    msg.msg_control = aux;
-    msg.msg_controllen = sizeof(aux);
-    msg.msg_flags = 0;
-
-    if ((l = recvmsg(fd, &msg, 0)) < 0) {
-        /* Linux returns EAGAIN when an invalid IP packet has been
-        received. We suppress warnings in this case because this might
-        create quite a bit of log traffic on machines with unstable
-        links. (See #60) */
-
-        if (errno != EAGAIN)
-            avahi_log_warn("recvmsg(): %s", strerror(errno));
-
-        goto fail;
-    }
-
-    /* For corrupt packets FIONREAD returns zero size (See rhbz #607297). So
-     * fail after having read them. */
-    if (!ms)
-        goto fail;
-
-    assert(!(msg.msg_flags & MSG_CTRUNC));
-    assert(!(msg.msg_flags & MSG_TRUNC));
-
-    p->size = (size_t) l;
-
-    if (ret_src_port)
-        *ret_src_port = avahi_port_from_sockaddr((struct sockaddr*) &sa);
-
-    if (ret_src_address) {
-        AvahiAddress a;
-        avahi_address_from_sockaddr((struct sockaddr*) &sa, &a);
-        *ret_src_address = a.data.ipv6;
-    }
+    assert(msg);
+    assert(!(msg->msg_flags & MSG_CTRUNC));
 
-    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
 
         if (cmsg->cmsg_level == IPPROTO_IPV6) {
 
@@ -914,16 +1063,285 @@ AvahiDnsPacket *avahi_recv_dns_packet_ipv6(
 
     assert(found_iface);
     assert(found_ttl);
+}
 
-    return p;
+typedef struct AvahiRecvSlot {
+    AvahiDnsPacket *packet;
 
-fail:
-    if (p)
-        avahi_dns_packet_free(p);
+    struct msghdr msg;
+    struct iovec io;
+    union {
+        struct sockaddr sa;
+        struct sockaddr_in in;
+        struct sockaddr_in6 in6;
+    } name;
+    size_t aux[1024 / sizeof(size_t)]; /* for alignment on ia64 ! */
+
+    int valid;
+    AvahiAddress src_address, dst_address;
+    uint16_t src_port;
+    AvahiIfIndex iface;
+    uint8_t ttl;
+} AvahiRecvSlot;
+
+struct AvahiRecvBatch {
+    AvahiRecvSlot *slots;
+    unsigned n_slots, n_received;
+#ifdef HAVE_RECVMMSG
+    struct mmsghdr *msgs;
+#endif
+};
+
+AvahiRecvBatch *avahi_recv_batch_new(unsigned n) {
+    AvahiRecvBatch *b;
+    unsigned i;
+
+    assert(n > 0);
+
+    if (!(b = avahi_new0(AvahiRecvBatch, 1)))
+        goto oom;
+
+    if (!(b->slots = avahi_new0(AvahiRecvSlot, n)))
+        goto oom;
+
+#ifdef HAVE_RECVMMSG
+    if (!(b->msgs = avahi_new0(struct mmsghdr, n)))
+        goto oom;
+#endif
+
+    b->n_slots = n;
+
+    for (i = 0; i < n; i++)
+        if (!(b->slots[i].packet = avahi_dns_packet_new(0)))
+            goto oom;
+
+    return b;
+
+oom:
+    avahi_log_error(__FILE__": Out of memory");
+
+    if (b)
+        avahi_recv_batch_free(b);
 
     return NULL;
 }
 
+void avahi_recv_batch_free(AvahiRecvBatch *b) {
+    unsigned i;
+
+    assert(b);
+
+    for (i = 0; i < b->n_slots; i++)
+        if (b->slots[i].packet)
+            avahi_dns_packet_free(b->slots[i].packet);
+
+    avahi_free(b->slots);
+#ifdef HAVE_RECVMMSG
+    avahi_free(b->msgs);
+#endif
+    avahi_free(b);
+}
+
+static void recv_slot_prepare(AvahiRecvSlot *slot) {
+    assert(slot);
+
+    slot->io.iov_base = AVAHI_DNS_PACKET_DATA(slot->packet);
+    slot->io.iov_len = slot->packet->max_size;
+
+    memset(&slot->msg, 0, sizeof(slot->msg));
+    slot->msg.msg_name = &slot->name;
+    slot->msg.msg_namelen = sizeof(slot->name);
+    slot->msg.msg_iov = &slot->io;
+    slot->msg.msg_iovlen = 1;
+    slot->msg.msg_control = slot->aux;
+    slot->msg.msg_controllen = sizeof(slot->aux);
+    slot->msg.msg_flags = 0;
+
+    slot->valid = 0;
+}
+
+static int recv_batch(int fd, AvahiRecvBatch *b) {
+    unsigned i;
+#ifdef HAVE_RECVMMSG
+    int r;
+#endif
+
+    assert(fd >= 0);
+    assert(b);
+
+    b->n_received = 0;
+
+    for (i = 0; i < b->n_slots; i++)
+        recv_slot_prepare(&b->slots[i]);
+
+#ifdef HAVE_RECVMMSG
+    for (i = 0; i < b->n_slots; i++) {
+        b->msgs[i].msg_hdr = b->slots[i].msg;
+        b->msgs[i].msg_len = 0;
+    }
+
+    if ((r = recvmmsg(fd, b->msgs, b->n_slots, MSG_DONTWAIT, NULL)) < 0) {
+        /* Linux returns EAGAIN when an invalid IP packet has been
+        received. We suppress warnings in this case because this might
+        create quite a bit of log traffic on machines with unstable
+        links. (See #60) */
+        if (errno != EAGAIN)
+            avahi_log_warn("recvmmsg(): %s", strerror(errno));
+
+        return -1;
+    }
+
+    for (i = 0; i < (unsigned) r; i++) {
+        b->slots[i].msg = b->msgs[i].msg_hdr;
+        b->slots[i].packet->size = b->msgs[i].msg_len;
+    }
+
+    b->n_received = (unsigned) r;
+#else
+    for (i = 0; i < b->n_slots; i++) {
+        ssize_t l;
+
+        if ((l = recvmsg(fd, &b->slots[i].msg, MSG_DONTWAIT)) < 0) {
+            /* Don't warn about invalid IP packets (See #60) */
+            if (errno != EAGAIN)
+                avahi_log_warn("recvmsg(): %s", strerror(errno));
+
+            break;
+        }
+
+        b->slots[i].packet->size = (size_t) l;
+    }
+
+    if (i <= 0)
+        return -1;
+
+    b->n_received = i;
+#endif
+
+    for (i = 0; i < b->n_received; i++) {
+        AvahiDnsPacket *p = b->slots[i].packet;
+
+        /* The buffers are reused, make sure nothing of the last
+         * packet is left over */
+        p->rindex = AVAHI_DNS_PACKET_HEADER_SIZE;
+        p->res_size = 0;
+
+        if (p->name_table) {
+            avahi_hashmap_free(p->name_table);
+            p->name_table = NULL;
+        }
+    }
+
+    return (int) b->n_received;
+}
+
+static int recv_slot_check(AvahiRecvSlot *slot) {
+    assert(slot);
+
+    /* Corrupt packets are read with zero size (See rhbz #607297) */
+    if (slot->packet->size <= 0)
+        return -1;
+
+    if (slot->msg.msg_flags & MSG_TRUNC) {
+        avahi_log_debug("Dropping truncated packet.");
+        return -1;
+    }
+
+    return 0;
+}
+
+int avahi_recv_dns_packets_ipv4(int fd, AvahiRecvBatch *b) {
+    unsigned i;
+
+    assert(fd >= 0);
+    assert(b);
+
+    if (recv_batch(fd, b) < 0)
+        return -1;
+
+    for (i = 0; i < b->n_received; i++) {
+        AvahiRecvSlot *slot = &b->slots[i];
+
+        if (recv_slot_check(slot) < 0)
+            continue;
+
+        if (slot->name.in.sin_addr.s_addr == INADDR_ANY)
+            /* Linux 2.4 behaves very strangely sometimes! */
+            continue;
+
+        slot->src_address.proto = slot->dst_address.proto = AVAHI_PROTO_INET;
+        avahi_address_from_sockaddr(&slot->name.sa, &slot->src_address);
+        slot->src_port = avahi_port_from_sockaddr(&slot->name.sa);
+
+        ipv4_parse_cmsg(&slot->msg, &slot->dst_address.data.ipv4, &slot->iface, &slot->ttl);
+
+        slot->valid = 1;
+    }
+
+    return (int) b->n_received;
+}
+
+int avahi_recv_dns_packets_ipv6(int fd, AvahiRecvBatch *b) {
+    unsigned i;
+
+    assert(fd >= 0);
+    assert(b);
+
+    if (recv_batch(fd, b) < 0)
+        return -1;
+
+    for (i = 0; i < b->n_received; i++) {
+        AvahiRecvSlot *slot = &b->slots[i];
+
+        if (recv_slot_check(slot) < 0)
+            continue;
+
+        slot->src_address.proto = slot->dst_address.proto = AVAHI_PROTO_INET6;
+        avahi_address_from_sockaddr(&slot->name.sa, &slot->src_address);
+        slot->src_port = avahi_port_from_sockaddr(&slot->name.sa);
+
+        slot->iface = AVAHI_IF_UNSPEC;
+        ipv6_parse_cmsg(&slot->msg, &slot->dst_address.data.ipv6, &slot->iface, &slot->ttl);
+
+        slot->valid = 1;
+    }
+
+    return (int) b->n_received;
+}
+
+AvahiDnsPacket *avahi_recv_batch_get(
+        AvahiRecvBatch *b,
+        unsigned idx,
+        AvahiAddress *ret_src_address,
+        uint16_t *ret_src_port,
+        AvahiAddress *ret_dst_address,
+        AvahiIfIndex *ret_iface,
+        uint8_t *ret_ttl) {
+
+    AvahiRecvSlot *slot;
+
+    assert(b);
+    assert(idx < b->n_received);
+
+    slot = &b->slots[idx];
+
+    if (!slot->valid)
+        return NULL;
+
+    if (ret_src_address)
+        *ret_src_address = slot->src_address;
+    if (ret_src_port)
+        *ret_src_port = slot->src_port;
+    if (ret_dst_address)
+        *ret_dst_address = slot->dst_address;
+    if (ret_iface)
+        *ret_iface = slot->iface;
+    if (ret_ttl)
+        *ret_ttl = slot->ttl;
+
+    return slot->packet;
+}
+
 int avahi_open_unicast_socket_ipv4(void) {
     struct sockaddr_in local;
     int fd = -1;
@@ -38,8 +38,44 @@ int avahi_open_unicast_socket_ipv6(void);
 int avahi_send_dns_packet_ipv4(int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv4Address *src_address, const AvahiIPv4Address *dst_address, uint16_t dst_port);
 int avahi_send_dns_packet_ipv6(int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv6Address *src_address, const AvahiIPv6Address *dst_address, uint16_t dst_port);
 
-AvahiDnsPacket *avahi_recv_dns_packet_ipv4(int fd, AvahiIPv4Address *ret_src_address, uint16_t *ret_src_port, AvahiIPv4Address *ret_dst_address, AvahiIfIndex *ret_iface, uint8_t *ret_ttl);
-AvahiDnsPacket *avahi_recv_dns_packet_ipv6(int fd, AvahiIPv6Address *ret_src_address, uint16_t *ret_src_port, AvahiIPv6Address *ret_dst_address, AvahiIfIndex *ret_iface, uint8_t *ret_ttl);
+/* Collects outgoing packets, possibly for different sockets, and
+ * sends them with as few system calls as possible when flushed. The
+ * packets are copied, so they may be modified or freed right after
+ * they have been queued. A full queue is flushed automatically. */
+typedef struct AvahiSendQueue AvahiSendQueue;
+
+#define AVAHI_SEND_QUEUE_MAX 256
+
+AvahiSendQueue *avahi_send_queue_new(unsigned n);
+void avahi_send_queue_free(AvahiSendQueue *q);
+
+int avahi_send_queue_push_ipv4(AvahiSendQueue *q, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv4Address *src_address, const AvahiIPv4Address *dst_address, uint16_t dst_port);
+int avahi_send_queue_push_ipv6(AvahiSendQueue *q, int fd, AvahiIfIndex iface, AvahiDnsPacket *p, const AvahiIPv6Address *src_address, const AvahiIPv6Address *dst_address, uint16_t dst_port);
+
+unsigned avahi_send_queue_length(AvahiSendQueue *q);
+void avahi_send_queue_flush(AvahiSendQueue *q);
+
+/* A ring of maximum size packet buffers that datagrams are read
+ * into. The buffers are reused for every read, hence truncation is
+ * detected with MSG_TRUNC instead of sizing each packet with FIONREAD
+ * beforehand. */
+typedef struct AvahiRecvBatch AvahiRecvBatch;
+
+#define AVAHI_RECV_BATCH_MAX 256
+
+AvahiRecvBatch *avahi_recv_batch_new(unsigned n);
+void avahi_recv_batch_free(AvahiRecvBatch *b);
+
+/* Read up to n datagrams into the batch. Returns the number of
+ * datagrams read or -1 if none could be read. */
+int avahi_recv_dns_packets_ipv4(int fd, AvahiRecvBatch *b);
+int avahi_recv_dns_packets_ipv6(int fd, AvahiRecvBatch *b);
+
+/* Return the idx-th datagram of the last read, or NULL if it has
+ * been dropped. The packet is owned by the batch and only valid until
+ * the next read, anything that needs to keep it around longer has to
+ * copy it. */
+AvahiDnsPacket *avahi_recv_batch_get(AvahiRecvBatch *b, unsigned idx, AvahiAddress *ret_src_address, uint16_t *ret_src_port, AvahiAddress *ret_dst_address, AvahiIfIndex *ret_iface, uint8_t *ret_ttl);
 
 int avahi_mdns_mcast_join_ipv4(int fd, const AvahiIPv4Address *local_address, int iface, int join);
 int avahi_mdns_mcast_join_ipv6(int fd, const AvahiIPv6Address *local_address, int iface, int join);
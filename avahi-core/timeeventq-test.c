@@ -23,9 +23,11 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <avahi-common/timeval.h>
 #include <avahi-common/simple-watch.h>
+#include <avahi-common/gccmacro.h>
 
 #include "timeeventq.h"
 #include "log.h"
@@ -35,6 +37,172 @@
 
 static AvahiTimeEventQueue *q = NULL;
 
+/* A poll API that only remembers the timeout, and a clock that only
+ * moves when we say so, for checking when the queue wants to be woken
+ * up without actually waiting */
+
+struct AvahiTimeout {
+    struct timeval expiry;
+    int enabled;
+    AvahiTimeoutCallback callback;
+    void *userdata;
+};
+
+static AvahiTimeout fake_timeout;
+static struct timeval fake_now;
+
+static void fake_clock(struct timeval *tv) {
+    *tv = fake_now;
+}
+
+static AvahiTimeout* fake_timeout_new(AVAHI_GCC_UNUSED const AvahiPoll *api, const struct timeval *tv, AvahiTimeoutCallback cb, void *userdata) {
+    fake_timeout.enabled = !!tv;
+    if (tv)
+        fake_timeout.expiry = *tv;
+    fake_timeout.callback = cb;
+    fake_timeout.userdata = userdata;
+
+    return &fake_timeout;
+}
+
+static void fake_timeout_update(AvahiTimeout *t, const struct timeval *tv) {
+    t->enabled = !!tv;
+    if (tv)
+        t->expiry = *tv;
+}
+
+static void fake_timeout_free(AvahiTimeout *t) {
+    t->enabled = 0;
+}
+
+static AvahiTimeEventQueue *fake_queue_new(AvahiPoll *api, AvahiTimeEventQueueType type) {
+    AvahiTimeEventQueue *fq;
+
+    memset(api, 0, sizeof(*api));
+    api->timeout_new = fake_timeout_new;
+    api->timeout_update = fake_timeout_update;
+    api->timeout_free = fake_timeout_free;
+
+    fq = avahi_time_event_queue_new(api, type);
+    assert(fq);
+    avahi_time_event_queue_set_clock(fq, fake_clock);
+
+    return fq;
+}
+
+static struct timeval *fake_elapse(struct timeval *tv, unsigned msec) {
+    *tv = fake_now;
+    return avahi_timeval_add(tv, (AvahiUsec) msec * 1000);
+}
+
+/* Move the clock forward and run the timeout if it has expired */
+static void fake_advance(unsigned msec) {
+    avahi_timeval_add(&fake_now, (AvahiUsec) msec * 1000);
+
+    if (fake_timeout.enabled && avahi_timeval_compare(&fake_now, &fake_timeout.expiry) >= 0) {
+        fake_timeout.enabled = 0;
+        fake_timeout.callback(&fake_timeout, fake_timeout.userdata);
+    }
+}
+
+static int fake_timeout_in(unsigned msec) {
+    struct timeval tv;
+
+    return fake_timeout.enabled && avahi_timeval_compare(&fake_timeout.expiry, fake_elapse(&tv, msec)) <= 0;
+}
+
+static void count_callback(AvahiTimeEvent *e, void* userdata) {
+    unsigned *n = userdata;
+
+    (*n)++;
+    avahi_time_event_free(e);
+}
+
+/* The slack allows running events early, but never late */
+static void check_slack(AvahiTimeEventQueueType type) {
+    AvahiTimeEventQueue *fq;
+    AvahiPoll api;
+    struct timeval tv;
+    unsigned n_a = 0, n_b = 0, n_c = 0;
+
+    fake_now.tv_sec = 1000000;
+    fake_now.tv_usec = 0;
+
+    fq = fake_queue_new(&api, type);
+    avahi_time_event_queue_set_slack(fq, 50000);
+
+    avahi_time_event_new(fq, fake_elapse(&tv, 10), count_callback, &n_a);
+    avahi_time_event_new(fq, fake_elapse(&tv, 30), count_callback, &n_b);
+    assert(fake_timeout_in(10));
+
+    fake_advance(10);
+    assert(n_a == 1 && n_b == 1);
+
+    /* Scheduled for right now, after the wakeup that ran the other
+     * events early */
+    avahi_time_event_new(fq, fake_elapse(&tv, 0), count_callback, &n_c);
+    assert(fake_timeout_in(1));
+
+    fake_advance(1);
+    assert(n_c == 1);
+    assert(!fake_timeout.enabled);
+
+    avahi_time_event_queue_free(fq);
+}
+
+/* Events scheduled after the clock has been stepped backwards must
+ * run on time, not when the clock has caught up again */
+static void check_step(AvahiTimeEventQueueType type) {
+    AvahiTimeEventQueue *fq;
+    AvahiTimeEvent *e;
+    AvahiPoll api;
+    struct timeval tv;
+    unsigned n_a = 0, n_b = 0, n_c = 0, n_d = 0;
+
+    fake_now.tv_sec = 1000000;
+    fake_now.tv_usec = 0;
+
+    fq = fake_queue_new(&api, type);
+
+    avahi_time_event_new(fq, fake_elapse(&tv, 10), count_callback, &n_a);
+    e = avahi_time_event_new(fq, fake_elapse(&tv, 60000), count_callback, &n_b);
+    fake_advance(10);
+    assert(n_a == 1);
+
+    fake_now.tv_sec -= 10;
+
+    avahi_time_event_new(fq, fake_elapse(&tv, 100), count_callback, &n_c);
+    assert(fake_timeout_in(100));
+
+    fake_advance(100);
+    assert(n_c == 1);
+
+    /* An event from before the step that is rescheduled */
+    avahi_time_event_update(e, fake_elapse(&tv, 50));
+    assert(fake_timeout_in(50));
+
+    fake_advance(50);
+    assert(n_b == 1);
+    assert(!fake_timeout.enabled);
+
+    /* A wakeup right after another step must not run anything */
+    e = avahi_time_event_new(fq, fake_elapse(&tv, 20), count_callback, &n_d);
+    fake_now.tv_sec -= 10;
+    fake_timeout.callback(&fake_timeout, fake_timeout.userdata);
+    assert(n_d == 0);
+
+    avahi_time_event_update(e, fake_elapse(&tv, 20));
+    assert(fake_timeout_in(20));
+
+    fake_advance(20);
+    assert(n_d == 1);
+
+    if (type == AVAHI_TIME_EVENT_QUEUE_WHEEL)
+        assert(avahi_time_event_queue_get_stats(fq)->n_rebases == 2);
+
+    avahi_time_event_queue_free(fq);
+}
+
 static void callback(AvahiTimeEvent*e, void* userdata) {
     struct timeval tv = {0, 0};
     assert(e);
@@ -43,13 +211,22 @@ static void callback(AvahiTimeEvent*e, void* userdata) {
     avahi_time_event_update(e, &tv);
 }
 
-int main(AVAHI_GCC_UNUSED int argc, AVAHI_GCC_UNUSED char *argv[]) {
+int main(int argc, char *argv[]) {
     struct timeval tv;
     AvahiSimplePoll *s;
+    AvahiTimeEventQueueType type = AVAHI_TIME_EVENT_QUEUE_PRIOQ;
+
+    if (argc > 1 && strcmp(argv[1], "wheel") == 0)
+        type = AVAHI_TIME_EVENT_QUEUE_WHEEL;
+
+    check_slack(AVAHI_TIME_EVENT_QUEUE_PRIOQ);
+    check_slack(AVAHI_TIME_EVENT_QUEUE_WHEEL);
+    check_step(AVAHI_TIME_EVENT_QUEUE_PRIOQ);
+    check_step(AVAHI_TIME_EVENT_QUEUE_WHEEL);
 
     s = avahi_simple_poll_new();
 
-    q = avahi_time_event_queue_new(avahi_simple_poll_get(s));
+    q = avahi_time_event_queue_new(avahi_simple_poll_get(s), type);
 
     avahi_time_event_new(q, avahi_elapse_time(&tv, 5000, 100), callback, INT_TO_POINTER(1));
     avahi_time_event_new(q, avahi_elapse_time(&tv, 5000, 100), callback, INT_TO_POINTER(2));
@@ -23,26 +23,79 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <inttypes.h>
 
 #include <avahi-common/timeval.h>
 #include <avahi-common/malloc.h>
+#include <avahi-common/llist.h>
 
 #include "timeeventq.h"
 #include "log.h"
 
+/* The timing wheel consists of WHEEL_LEVELS levels of WHEEL_SLOTS
+ * slots each. A slot on level n covers WHEEL_SLOTS^n ticks. With 1ms
+ * ticks and six levels of 64 slots we cover a little more than two
+ * years, events further in the future are parked in the last slot of
+ * the top level and cascaded again. */
+#define WHEEL_TICK_USEC 1000
+#define WHEEL_BITS 6 /* The occupied[] bitmaps need one bit per slot */
+#define WHEEL_SLOTS (1U << WHEEL_BITS)
+#define WHEEL_MASK ((uint64_t) WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 6
+
+/* Pseudo level for events that are currently being dispatched */
+#define WHEEL_LEVEL_DUE WHEEL_LEVELS
+
+#define WHEEL_TICK_NEVER UINT64_MAX
+
+/* Don't run more than this many events per main loop wakeup, so that
+ * we don't starve the sockets. If there are more events due we return
+ * to the main loop and continue right away. */
+#define AVAHI_TIME_EVENT_BATCH_MAX 500
+
 struct AvahiTimeEvent {
     AvahiTimeEventQueue *queue;
-    AvahiPrioQueueNode *node;
+    AvahiPrioQueueNode node;
     struct timeval expiry;
     struct timeval last_run;
     AvahiTimeEventCallback callback;
     void* userdata;
+
+    /* Only used by the timing wheel */
+    uint64_t tick;
+    unsigned wheel_level, wheel_slot;
+    AVAHI_LLIST_FIELDS(AvahiTimeEvent, wheel);
 };
 
+typedef struct AvahiTimeWheel {
+    /* The next tick that has not been processed yet */
+    uint64_t current;
+
+    /* Cached result of wheel_next_tick(), or WHEEL_TICK_NEVER if
+     * unknown */
+    uint64_t next;
+    int next_valid;
+
+    /* One bit per non-empty slot */
+    uint64_t occupied[WHEEL_LEVELS];
+
+    AVAHI_LLIST_HEAD(AvahiTimeEvent, slots[WHEEL_LEVELS][WHEEL_SLOTS]);
+    AVAHI_LLIST_HEAD(AvahiTimeEvent, due);
+
+    unsigned n_events;
+} AvahiTimeWheel;
+
 struct AvahiTimeEventQueue {
     const AvahiPoll *poll_api;
     AvahiPrioQueue *prioq;
+    AvahiTimeWheel *wheel;
     AvahiTimeout *timeout;
+    AvahiPool *event_pool;
+
+    AvahiUsec slack;
+    AvahiTimeEventQueueStats stats;
+
+    AvahiTimeEventQueueClock clock;
 };
 
 static int compare(const void* _a, const void* _b) {
@@ -57,48 +110,435 @@ static int compare(const void* _a, const void* _b) {
     return avahi_timeval_compare(&a->last_run, &b->last_run);
 }
 
+static uint64_t timeval_to_tick(const struct timeval *tv, int round_up) {
+    uint64_t usec = (uint64_t) tv->tv_sec * 1000000 + (uint64_t) tv->tv_usec;
+
+    return round_up ? (usec + WHEEL_TICK_USEC - 1) / WHEEL_TICK_USEC : usec / WHEEL_TICK_USEC;
+}
+
+static struct timeval *tick_to_timeval(uint64_t tick, struct timeval *tv) {
+    tv->tv_sec = (time_t) (tick * WHEEL_TICK_USEC / 1000000);
+    tv->tv_usec = (suseconds_t) (tick * WHEEL_TICK_USEC % 1000000);
+    return tv;
+}
+
+static void get_time(AvahiTimeEventQueue *q, struct timeval *tv) {
+    if (q->clock)
+        q->clock(tv);
+    else
+        gettimeofday(tv, NULL);
+}
+
+static uint64_t now_tick(AvahiTimeEventQueue *q) {
+    struct timeval now;
+
+    get_time(q, &now);
+    return timeval_to_tick(&now, 0);
+}
+
+/* Return the index of the first set bit in x, starting at bit i and
+ * wrapping around. x must not be 0. */
+static unsigned first_bit_from(uint64_t x, unsigned i) {
+    unsigned n = 0, b;
+
+    assert(x);
+    assert(i < WHEEL_SLOTS);
+
+    if (i > 0)
+        x = (x >> i) | (x << (WHEEL_SLOTS - i));
+
+    for (b = WHEEL_SLOTS/2; b > 0; b /= 2)
+        if (!(x & (((uint64_t) 1 << b) - 1))) {
+            x >>= b;
+            n += b;
+        }
+
+    return (n + i) & WHEEL_MASK;
+}
+
+/* The tick at which a slot has to be processed: for level 0 that's
+ * the tick the events in it are due, for the upper levels that's the
+ * tick at which they are cascaded down. */
+static uint64_t wheel_slot_tick(AvahiTimeWheel *w, unsigned level, unsigned slot) {
+    unsigned shift = level * WHEEL_BITS;
+    uint64_t span = (uint64_t) 1 << shift, t;
+    unsigned idx;
+
+    /* The first level boundary not before the current tick */
+    t = (w->current + span - 1) & ~(span - 1);
+    idx = (unsigned) ((t >> shift) & WHEEL_MASK);
+
+    return t + (((uint64_t) slot - idx) & WHEEL_MASK) * span;
+}
+
+static uint64_t wheel_next_tick(AvahiTimeWheel *w) {
+    unsigned level;
+
+    if (w->next_valid)
+        return w->next;
+
+    w->next = WHEEL_TICK_NEVER;
+
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        unsigned shift = level * WHEEL_BITS, slot;
+        uint64_t t;
+
+        if (!w->occupied[level])
+            continue;
+
+        t = (w->current + ((uint64_t) 1 << shift) - 1) >> shift;
+        slot = first_bit_from(w->occupied[level], (unsigned) (t & WHEEL_MASK));
+
+        if ((t = wheel_slot_tick(w, level, slot)) < w->next)
+            w->next = t;
+    }
+
+    w->next_valid = 1;
+    return w->next;
+}
+
+static AvahiTimeEvent** wheel_list(AvahiTimeWheel *w, AvahiTimeEvent *e) {
+    if (e->wheel_level == WHEEL_LEVEL_DUE)
+        return &w->due;
+
+    return &w->slots[e->wheel_level][e->wheel_slot];
+}
+
+static void wheel_insert(AvahiTimeWheel *w, AvahiTimeEvent *e) {
+    uint64_t t, delta;
+    unsigned level;
+
+    /* Events that are already due are processed with the next tick */
+    t = e->tick > w->current ? e->tick : w->current;
+    delta = t - w->current;
+
+    for (level = 0; level < WHEEL_LEVELS-1; level++)
+        if (delta < ((uint64_t) 1 << ((level+1) * WHEEL_BITS)))
+            break;
+
+    if (delta >= ((uint64_t) 1 << (WHEEL_LEVELS * WHEEL_BITS)))
+        t = w->current + ((uint64_t) 1 << (WHEEL_LEVELS * WHEEL_BITS)) - 1;
+
+    e->wheel_level = level;
+    e->wheel_slot = (unsigned) ((t >> (level * WHEEL_BITS)) & WHEEL_MASK);
+
+    AVAHI_LLIST_PREPEND(AvahiTimeEvent, wheel, w->slots[level][e->wheel_slot], e);
+    w->occupied[level] |= (uint64_t) 1 << e->wheel_slot;
+
+    if (w->next_valid && (t = wheel_slot_tick(w, level, e->wheel_slot)) < w->next)
+        w->next = t;
+}
+
+static void wheel_remove(AvahiTimeWheel *w, AvahiTimeEvent *e) {
+    AvahiTimeEvent **head;
+
+    head = wheel_list(w, e);
+    AVAHI_LLIST_REMOVE(AvahiTimeEvent, wheel, *head, e);
+
+    if (e->wheel_level != WHEEL_LEVEL_DUE && !*head) {
+        w->occupied[e->wheel_level] &= ~((uint64_t) 1 << e->wheel_slot);
+        w->next_valid = 0;
+    }
+}
+
+static void wheel_cascade(AvahiTimeWheel *w, unsigned level, unsigned slot) {
+    AvahiTimeEvent *e;
+
+    while ((e = w->slots[level][slot])) {
+        wheel_remove(w, e);
+        wheel_insert(w, e);
+    }
+}
+
+/* Move the wheel to a different position and redistribute all pending
+ * events relative to it. The events keep their absolute expiry. */
+static void wheel_rebase(AvahiTimeWheel *w, uint64_t tick) {
+    AVAHI_LLIST_HEAD(AvahiTimeEvent, pending);
+    AvahiTimeEvent *e;
+    unsigned level, slot;
+
+    AVAHI_LLIST_HEAD_INIT(AvahiTimeEvent, pending);
+
+    for (level = 0; level < WHEEL_LEVELS; level++)
+        while (w->occupied[level]) {
+            slot = first_bit_from(w->occupied[level], 0);
+
+            while ((e = w->slots[level][slot])) {
+                wheel_remove(w, e);
+                AVAHI_LLIST_PREPEND(AvahiTimeEvent, wheel, pending, e);
+            }
+        }
+
+    w->current = tick;
+    w->next_valid = 0;
+
+    while ((e = pending)) {
+        AVAHI_LLIST_REMOVE(AvahiTimeEvent, wheel, pending, e);
+        wheel_insert(w, e);
+    }
+}
+
+/* Bring the wheel position in line with the clock. It never runs more
+ * than one tick ahead of the current time, so if it does the clock has
+ * been stepped backwards, and new events would stall until the clock
+ * catches up again. */
+static void wheel_sync(AvahiTimeEventQueue *q, uint64_t n) {
+    AvahiTimeWheel *w = q->wheel;
+
+    if (n + 1 < w->current) {
+        avahi_log_debug(__FILE__": Clock has been stepped backwards, rebasing timing wheel.");
+        q->stats.n_rebases++;
+        wheel_rebase(w, n);
+
+    } else if (w->n_events <= 0 && n > w->current) {
+        /* Don't let new events start from a stale position if the
+         * wheel has been idle for a while */
+        w->current = n;
+        w->next_valid = 0;
+    }
+}
+
+/* Run all events in the level 0 slot of a tick, which must be less
+ * than WHEEL_SLOTS ticks ahead. Returns the number of events run. */
+static unsigned wheel_run_slot(AvahiTimeEventQueue *q, uint64_t tick, const struct timeval *now) {
+    AvahiTimeWheel *w = q->wheel;
+    AvahiTimeEvent *e;
+    unsigned slot, n = 0;
+
+    assert(!w->due);
+
+    /* Move the due events to a separate list, so that events added
+     * by the callbacks don't end up in the slot we are processing */
+    slot = (unsigned) (tick & WHEEL_MASK);
+    w->due = w->slots[0][slot];
+    w->slots[0][slot] = NULL;
+    w->occupied[0] &= ~((uint64_t) 1 << slot);
+    w->next_valid = 0;
+
+    for (e = w->due; e; e = e->wheel_next)
+        e->wheel_level = WHEEL_LEVEL_DUE;
+
+    while ((e = w->due)) {
+        wheel_remove(w, e);
+
+        /* Requeue the event, it is up to the callback to reschedule
+         * or free it */
+        e->last_run = *now;
+        wheel_insert(w, e);
+
+        if (avahi_timeval_compare(now, &e->expiry) < 0)
+            q->stats.n_events_early++;
+
+        assert(e->callback);
+        e->callback(e, e->userdata);
+        n++;
+    }
+
+    return n;
+}
+
+/* Process a single tick: cascade the upper levels and run all events
+ * in the level 0 slot. Returns the number of events run. */
+static unsigned wheel_run_tick(AvahiTimeEventQueue *q, uint64_t tick, const struct timeval *now) {
+    AvahiTimeWheel *w = q->wheel;
+    unsigned level;
+
+    assert(tick >= w->current);
+
+    w->current = tick;
+    w->next_valid = 0;
+
+    for (level = WHEEL_LEVELS-1; level > 0; level--)
+        if (!(tick & (((uint64_t) 1 << (level * WHEEL_BITS)) - 1)))
+            wheel_cascade(w, level, (unsigned) ((tick >> (level * WHEEL_BITS)) & WHEEL_MASK));
+
+    w->current = tick + 1;
+
+    return wheel_run_slot(q, tick, now);
+}
+
+static AvahiTimeWheel* wheel_new(AvahiTimeEventQueue *q) {
+    AvahiTimeWheel *w;
+
+    if (!(w = avahi_new0(AvahiTimeWheel, 1)))
+        return NULL;
+
+    w->current = now_tick(q);
+    w->next = WHEEL_TICK_NEVER;
+    w->next_valid = 1;
+
+    return w;
+}
+
 static AvahiTimeEvent* time_event_queue_root(AvahiTimeEventQueue *q) {
+    AvahiPrioQueueNode *n;
     assert(q);
 
-    return q->prioq->root ? q->prioq->root->data : NULL;
+    if (q->wheel) {
+        unsigned level, slot;
+
+        for (level = 0; level < WHEEL_LEVELS; level++)
+            if (q->wheel->occupied[level]) {
+                slot = first_bit_from(q->wheel->occupied[level], 0);
+                return q->wheel->slots[level][slot];
+            }
+
+        return q->wheel->due;
+    }
+
+    return (n = avahi_prio_queue_root(q->prioq)) ? n->data : NULL;
 }
 
 static void update_timeout(AvahiTimeEventQueue *q) {
     AvahiTimeEvent *e;
     assert(q);
 
+    if (q->wheel) {
+        uint64_t t;
+        struct timeval tv;
+
+        if ((t = wheel_next_tick(q->wheel)) != WHEEL_TICK_NEVER)
+            q->poll_api->timeout_update(q->timeout, tick_to_timeval(t, &tv));
+        else
+            q->poll_api->timeout_update(q->timeout, NULL);
+
+        return;
+    }
+
     if ((e = time_event_queue_root(q)))
         q->poll_api->timeout_update(q->timeout, &e->expiry);
     else
         q->poll_api->timeout_update(q->timeout, NULL);
 }
 
+static void batch_done(AvahiTimeEventQueue *q, unsigned n) {
+    q->stats.n_wakeups++;
+    q->stats.n_events += n;
+
+    if (n > q->stats.n_events_per_wakeup_max)
+        q->stats.n_events_per_wakeup_max = n;
+}
+
+static void wheel_expiration_event(AvahiTimeEventQueue *q) {
+    AvahiTimeWheel *w = q->wheel;
+    struct timeval now, deadline;
+    uint64_t t, c, d, nt;
+    unsigned n = 0;
+    int run = 0;
+
+    get_time(q, &now);
+    nt = timeval_to_tick(&now, 0);
+    deadline = now;
+    avahi_timeval_add(&deadline, q->slack);
+    d = timeval_to_tick(&deadline, 0);
+
+    wheel_sync(q, nt);
+
+    /* Run everything that is due in one go, tick by tick */
+    while ((t = wheel_next_tick(w)) <= nt) {
+
+        if (n >= AVAHI_TIME_EVENT_BATCH_MAX) {
+            q->stats.n_batches_limited++;
+            goto finish;
+        }
+
+        n += wheel_run_tick(q, t, &now);
+        run = 1;
+
+        /* A callback noticed that the clock has been stepped
+         * backwards, so our idea of now is stale */
+        if (w->current <= t)
+            goto finish;
+    }
+
+    /* Nothing is scheduled up to now, so we may skip ahead */
+    if (w->current <= nt) {
+        w->current = nt + 1;
+        w->next_valid = 0;
+    }
+
+    /* Run the events that are due within the slack time early. The
+     * wheel is never moved ahead of the current time for this, so
+     * that events which are scheduled for right now afterwards aren't
+     * held back until the end of the slack. Only the level 0 slots
+     * are looked at, events further away run on time. */
+    c = w->current;
+    for (t = c; t <= d && t < c + WHEEL_SLOTS && w->current == c; t++) {
+
+        if (!(w->occupied[0] & ((uint64_t) 1 << (t & WHEEL_MASK))))
+            continue;
+
+        if (n >= AVAHI_TIME_EVENT_BATCH_MAX) {
+            q->stats.n_batches_limited++;
+            break;
+        }
+
+        n += wheel_run_slot(q, t, &now);
+        run = 1;
+    }
+
+finish:
+
+    if (!run)
+        avahi_log_debug(__FILE__": Strange, expiration_event() called, but nothing really happened.");
+
+    batch_done(q, n);
+    update_timeout(q);
+}
+
 static void expiration_event(AVAHI_GCC_UNUSED AvahiTimeout *timeout, void *userdata) {
     AvahiTimeEventQueue *q = userdata;
     AvahiTimeEvent *e;
+    struct timeval now, deadline;
+    unsigned n = 0;
 
-    if ((e = time_event_queue_root(q))) {
-        struct timeval now;
+    if (q->wheel) {
+        wheel_expiration_event(q);
+        return;
+    }
 
-        gettimeofday(&now, NULL);
+    get_time(q, &now);
+    deadline = now;
+    avahi_timeval_add(&deadline, q->slack);
+
+    /* Run all events that are due, plus those that would be due
+     * within the slack time */
+    while ((e = time_event_queue_root(q))) {
 
         /* Check if expired */
-        if (avahi_timeval_compare(&now, &e->expiry) >= 0) {
+        if (avahi_timeval_compare(&deadline, &e->expiry) < 0)
+            break;
+
+        /* Events that have already been run in this batch have been
+         * moved behind all other events with the same expiry time. If
+         * we encounter one again it was neither freed nor
+         * rescheduled to a later time, so leave it for the next
+         * iteration to avoid looping endlessly. */
+        if (n > 0 && avahi_timeval_compare(&e->last_run, &now) == 0)
+            break;
+
+        if (n >= AVAHI_TIME_EVENT_BATCH_MAX) {
+            q->stats.n_batches_limited++;
+            break;
+        }
 
-            /* Make sure to move the entry away from the front */
-            e->last_run = now;
-            avahi_prio_queue_shuffle(q->prioq, e->node);
+        if (avahi_timeval_compare(&now, &e->expiry) < 0)
+            q->stats.n_events_early++;
 
-            /* Run it */
-            assert(e->callback);
-            e->callback(e, e->userdata);
+        /* Make sure to move the entry away from the front */
+        e->last_run = now;
+        avahi_prio_queue_shuffle(q->prioq, &e->node);
 
-            update_timeout(q);
-            return;
-        }
+        /* Run it */
+        assert(e->callback);
+        e->callback(e, e->userdata);
+        n++;
     }
 
-    avahi_log_debug(__FILE__": Strange, expiration_event() called, but nothing really happened.");
+    if (n <= 0)
+        avahi_log_debug(__FILE__": Strange, expiration_event() called, but nothing really happened.");
+
+    batch_done(q, n);
     update_timeout(q);
 }
 
@@ -114,19 +554,28 @@ static void fix_expiry_time(AvahiTimeEvent *e) {
         e->expiry = now;
 }
 
-AvahiTimeEventQueue* avahi_time_event_queue_new(const AvahiPoll *poll_api) {
+AvahiTimeEventQueue* avahi_time_event_queue_new(const AvahiPoll *poll_api, AvahiTimeEventQueueType type) {
     AvahiTimeEventQueue *q;
 
-    if (!(q = avahi_new(AvahiTimeEventQueue, 1))) {
+    if (!(q = avahi_new0(AvahiTimeEventQueue, 1))) {
         avahi_log_error(__FILE__": Out of memory");
         goto oom;
     }
 
     q->poll_api = poll_api;
+    q->slack = 0;
 
-    if (!(q->prioq = avahi_prio_queue_new(compare)))
+    if (!(q->event_pool = avahi_pool_new("time-event", sizeof(AvahiTimeEvent), 0)))
         goto oom;
 
+    if (type == AVAHI_TIME_EVENT_QUEUE_WHEEL) {
+        if (!(q->wheel = wheel_new(q)))
+            goto oom;
+    } else {
+        if (!(q->prioq = avahi_prio_queue_new(compare)))
+            goto oom;
+    }
+
     if (!(q->timeout = poll_api->timeout_new(poll_api, NULL, expiration_event, q)))
         goto oom;
 
@@ -138,6 +587,10 @@ oom:
         if (q->prioq)
             avahi_prio_queue_free(q->prioq);
 
+        if (q->event_pool)
+            avahi_pool_free(q->event_pool);
+
+        avahi_free(q->wheel);
         avahi_free(q);
     }
 
@@ -151,13 +604,49 @@ void avahi_time_event_queue_free(AvahiTimeEventQueue *q) {
 
     while ((e = time_event_queue_root(q)))
         avahi_time_event_free(e);
-    avahi_prio_queue_free(q->prioq);
+
+    if (q->prioq)
+        avahi_prio_queue_free(q->prioq);
+    avahi_free(q->wheel);
 
     q->poll_api->timeout_free(q->timeout);
 
+    avahi_pool_free(q->event_pool);
     avahi_free(q);
 }
 
+void avahi_time_event_queue_set_slack(AvahiTimeEventQueue *q, AvahiUsec slack) {
+    assert(q);
+
+    q->slack = slack;
+}
+
+void avahi_time_event_queue_set_clock(AvahiTimeEventQueue *q, AvahiTimeEventQueueClock clock) {
+    assert(q);
+
+    q->clock = clock;
+
+    /* Start over from the position of the new clock */
+    if (q->wheel) {
+        assert(q->wheel->n_events == 0);
+        q->wheel->current = now_tick(q);
+        q->wheel->next_valid = 0;
+    }
+}
+
+const AvahiTimeEventQueueStats* avahi_time_event_queue_get_stats(AvahiTimeEventQueue *q) {
+    assert(q);
+
+    return &q->stats;
+}
+
+void avahi_time_event_queue_get_pool_stats(AvahiTimeEventQueue *q, AvahiPoolStats *stats) {
+    assert(q);
+    assert(stats);
+
+    avahi_pool_get_stats(q->event_pool, stats);
+}
+
 AvahiTimeEvent* avahi_time_event_new(
     AvahiTimeEventQueue *q,
     const struct timeval *timeval,
@@ -170,7 +659,7 @@ AvahiTimeEvent* avahi_time_event_new(
     assert(callback);
     assert(userdata);
 
-    if (!(e = avahi_new(AvahiTimeEvent, 1))) {
+    if (!(e = avahi_pool_alloc(q->event_pool))) {
         avahi_log_error(__FILE__": Out of memory");
         return NULL; /* OOM */
     }
@@ -191,8 +680,15 @@ AvahiTimeEvent* avahi_time_event_new(
     e->last_run.tv_sec = 0;
     e->last_run.tv_usec = 0;
 
-    if (!(e->node = avahi_prio_queue_put(q->prioq, e))) {
-        avahi_free(e);
+    if (q->wheel) {
+        wheel_sync(q, now_tick(q));
+
+        e->tick = timeval_to_tick(&e->expiry, 1);
+        wheel_insert(q->wheel, e);
+        q->wheel->n_events++;
+
+    } else if (avahi_prio_queue_link(q->prioq, &e->node, e) < 0) {
+        avahi_pool_release(q->event_pool, e);
         return NULL;
     }
 
@@ -206,8 +702,13 @@ void avahi_time_event_free(AvahiTimeEvent *e) {
 
     q = e->queue;
 
-    avahi_prio_queue_remove(q->prioq, e->node);
-    avahi_free(e);
+    if (q->wheel) {
+        wheel_remove(q->wheel, e);
+        q->wheel->n_events--;
+    } else
+        avahi_prio_queue_unlink(q->prioq, &e->node);
+
+    avahi_pool_release(q->event_pool, e);
 
     update_timeout(q);
 }
@@ -218,8 +719,14 @@ void avahi_time_event_update(AvahiTimeEvent *e, const struct timeval *timeval) {
 
     e->expiry = *timeval;
     fix_expiry_time(e);
-    avahi_prio_queue_shuffle(e->queue->prioq, e->node);
+
+    if (e->queue->wheel) {
+        wheel_remove(e->queue->wheel, e);
+        wheel_sync(e->queue, now_tick(e->queue));
+        e->tick = timeval_to_tick(&e->expiry, 1);
+        wheel_insert(e->queue->wheel, e);
+    } else
+        avahi_prio_queue_shuffle(e->queue->prioq, &e->node);
 
     update_timeout(e->queue);
 }
-
@@ -26,14 +26,45 @@ typedef struct AvahiTimeEventQueue AvahiTimeEventQueue;
 typedef struct AvahiTimeEvent AvahiTimeEvent;
 
 #include <avahi-common/watch.h>
+#include <avahi-common/timeval.h>
+#include <avahi-common/pool.h>
 
 #include "prioq.h"
 
 typedef void (*AvahiTimeEventCallback)(AvahiTimeEvent *e, void* userdata);
 
-AvahiTimeEventQueue* avahi_time_event_queue_new(const AvahiPoll *poll_api);
+typedef enum AvahiTimeEventQueueType {
+    AVAHI_TIME_EVENT_QUEUE_PRIOQ, /* Priority queue, one event per wakeup */
+    AVAHI_TIME_EVENT_QUEUE_WHEEL  /* Hierarchical timing wheel, all events due within a tick per wakeup */
+} AvahiTimeEventQueueType;
+
+AvahiTimeEventQueue* avahi_time_event_queue_new(const AvahiPoll *poll_api, AvahiTimeEventQueueType type);
 void avahi_time_event_queue_free(AvahiTimeEventQueue *q);
 
+/* Run events that are due within the next slack usecs together with
+ * those that are due already, instead of waking up again for them */
+void avahi_time_event_queue_set_slack(AvahiTimeEventQueue *q, AvahiUsec slack);
+
+/* Use a different clock than gettimeofday(), for testing. Passing
+ * NULL switches back to gettimeofday(). Must be called before any
+ * events are added. */
+typedef void (*AvahiTimeEventQueueClock)(struct timeval *tv);
+void avahi_time_event_queue_set_clock(AvahiTimeEventQueue *q, AvahiTimeEventQueueClock clock);
+
+typedef struct AvahiTimeEventQueueStats {
+    unsigned n_wakeups;                /* Number of times the main loop woke us up */
+    unsigned n_events;                 /* Number of events run */
+    unsigned n_events_early;           /* Number of events run ahead of time because of the slack */
+    unsigned n_events_per_wakeup_max;  /* Largest number of events run in a single wakeup */
+    unsigned n_batches_limited;        /* Number of wakeups that left due events for the next one */
+    unsigned n_rebases;                /* Number of times the timing wheel followed a backwards clock step */
+} AvahiTimeEventQueueStats;
+
+const AvahiTimeEventQueueStats* avahi_time_event_queue_get_stats(AvahiTimeEventQueue *q);
+
+/* Return allocation statistics of the pool the time events are taken from */
+void avahi_time_event_queue_get_pool_stats(AvahiTimeEventQueue *q, AvahiPoolStats *stats);
+
 AvahiTimeEvent* avahi_time_event_new(
     AvahiTimeEventQueue *q,
     const struct timeval *timeval,
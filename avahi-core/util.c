@@ -26,6 +26,9 @@
 #include <stdlib.h>
 #include <assert.h>
 #include <ctype.h>
+#include <time.h>
+
+#include <sys/time.h>
 
 #include <avahi-common/malloc.h>
 #include "util.h"
@@ -118,3 +121,19 @@ char *avahi_strdown(char *s) {
 
     return s;
 }
+
+uint64_t avahi_monotonic_msec(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t) ts.tv_sec * 1000 + (uint64_t) ts.tv_nsec / 1000000;
+#endif
+
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (uint64_t) tv.tv_sec * 1000 + (uint64_t) tv.tv_usec / 1000;
+    }
+}
@@ -36,6 +36,10 @@ char *avahi_strup(char *s);
 /** Change every character in the string to lower case (ASCII), return a pointer to the string */
 char *avahi_strdown(char *s);
 
+/** Return the current time in milliseconds on a clock that is not
+ * affected by changes of the system time */
+uint64_t avahi_monotonic_msec(void);
+
 AVAHI_C_DECL_END
 
 #endif
@@ -559,6 +559,8 @@ static void handle_packet(AvahiWideAreaLookupEngine *e, AvahiDnsPacket *p) {
     assert(e);
     assert(p);
 
+    p->key_table = e->server->key_table;
+
     /* Some superficial validity tests */
     if (avahi_dns_packet_check_valid(p) < 0 || avahi_dns_packet_is_query(p)) {
         avahi_log_warn(__FILE__": Ignoring invalid response for wide area datagram.");
@@ -626,25 +628,31 @@ finish:
 static void socket_event(AVAHI_GCC_UNUSED AvahiWatch *w, int fd, AVAHI_GCC_UNUSED AvahiWatchEvent events, void *userdata) {
     AvahiWideAreaLookup *l = userdata;
     AvahiWideAreaLookupEngine *e = l->engine;
-    AvahiDnsPacket *p = NULL;
+    int n, i;
 
     assert(l);
     assert(e);
     assert(l->fd == fd);
 
     if (l->proto == AVAHI_PROTO_INET)
-        p = avahi_recv_dns_packet_ipv4(l->fd, NULL, NULL, NULL, NULL, NULL);
+        n = avahi_recv_dns_packets_ipv4(l->fd, e->server->recv_batch);
     else {
         assert(l->proto == AVAHI_PROTO_INET6);
 
-        p = avahi_recv_dns_packet_ipv6(l->fd, NULL, NULL, NULL, NULL, NULL);
+        n = avahi_recv_dns_packets_ipv6(l->fd, e->server->recv_batch);
     }
 
-    if (p) {
-        handle_packet(e, p);
-        avahi_dns_packet_free(p);
-        avahi_cleanup_dead_entries(e->server);
+    if (n <= 0)
+        return;
+
+    for (i = 0; i < n; i++) {
+        AvahiDnsPacket *p;
+
+        if ((p = avahi_recv_batch_get(e->server->recv_batch, (unsigned) i, NULL, NULL, NULL, NULL, NULL)))
+            handle_packet(e, p);
     }
+
+    avahi_cleanup_dead_entries(e->server);
 }
 
 AvahiWideAreaLookupEngine *avahi_wide_area_engine_new(AvahiServer *s) {
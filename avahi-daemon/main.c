@@ -126,6 +126,7 @@ typedef struct {
 
     int disable_user_service_publishing;
     int publish_resolv_conf;
+    int cache_snapshot;
     char ** publish_dns_servers;
     int debug;
 
@@ -672,6 +673,12 @@ static int load_config_file(DaemonConfig *c) {
                     c->server_config.use_iff_running = is_yes(p->value);
                 else if (strcasecmp(p->key, "disallow-other-stacks") == 0)
                     c->server_config.disallow_other_stacks = is_yes(p->value);
+                else if (strcasecmp(p->key, "use-timer-wheel") == 0)
+                    c->server_config.use_timer_wheel = is_yes(p->value);
+                else if (strcasecmp(p->key, "share-cache-records") == 0)
+                    c->server_config.share_cache_records = is_yes(p->value);
+                else if (strcasecmp(p->key, "cache-snapshot") == 0)
+                    c->cache_snapshot = is_yes(p->value);
                 else if (strcasecmp(p->key, "host-name-from-machine-id") == 0) {
                     if (*(p->value) == 'y' || *(p->value) == 'Y') {
                         char *machine_id = get_machine_id();
@@ -737,6 +744,36 @@ static int load_config_file(DaemonConfig *c) {
 
                     c->server_config.ratelimit_burst = k;
 
+                } else if (strcasecmp(p->key, "timer-slack-usec") == 0) {
+                    AvahiUsec k;
+
+                    if (parse_usec(p->value, &k) < 0) {
+                        avahi_log_error("Invalid timer-slack-usec setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.timer_slack = k;
+
+                } else if (strcasecmp(p->key, "receive-batch-size") == 0) {
+                    unsigned k;
+
+                    if (parse_unsigned(p->value, &k) < 0) {
+                        avahi_log_error("Invalid receive-batch-size setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.recv_batch_size = k;
+
+                } else if (strcasecmp(p->key, "send-batch-size") == 0) {
+                    unsigned k;
+
+                    if (parse_unsigned(p->value, &k) < 0) {
+                        avahi_log_error("Invalid send-batch-size setting %s", p->value);
+                        goto finish;
+                    }
+
+                    c->server_config.send_batch_size = k;
+
                 } else if (strcasecmp(p->key, "cache-entries-max") == 0) {
                     unsigned k;
 
@@ -1145,6 +1182,37 @@ static void ignore_signal(int sig)  {
     sigaction(sig, &sa, NULL);
 }
 
+#define CACHE_SNAPSHOT_FILE AVAHI_DAEMON_RUNTIME_DIR"/cache"
+
+static int cache_snapshot_fd = -1;
+
+static void open_cache_snapshot(void) {
+
+    /* We open the snapshot file before we chroot(), and keep it open
+     * to write it again when we shut down */
+    if ((cache_snapshot_fd = open(CACHE_SNAPSHOT_FILE, O_RDWR|O_CREAT|O_CLOEXEC, 0600)) < 0)
+        avahi_log_warn("Failed to open cache snapshot "CACHE_SNAPSHOT_FILE": %s", strerror(errno));
+}
+
+static void load_cache_snapshot(void) {
+    if (cache_snapshot_fd < 0)
+        return;
+
+    if (avahi_server_load_cache(avahi_server, cache_snapshot_fd) < 0)
+        avahi_log_warn("Failed to load cache snapshot: %s", avahi_strerror(avahi_server_errno(avahi_server)));
+}
+
+static void save_cache_snapshot(void) {
+    if (cache_snapshot_fd < 0)
+        return;
+
+    if (avahi_server && avahi_server_save_cache(avahi_server, cache_snapshot_fd) < 0)
+        avahi_log_warn("Failed to save cache snapshot: %s", avahi_strerror(avahi_server_errno(avahi_server)));
+
+    close(cache_snapshot_fd);
+    cache_snapshot_fd = -1;
+}
+
 static int run_server(DaemonConfig *c) {
     int r = -1;
     int error;
@@ -1207,6 +1275,9 @@ static int run_server(DaemonConfig *c) {
     }
 #endif
 
+    if (c->cache_snapshot)
+        open_cache_snapshot();
+
 #ifdef ENABLE_CHROOT
 
     if (config.drop_root && config.use_chroot) {
@@ -1267,6 +1338,8 @@ static int run_server(DaemonConfig *c) {
         goto finish;
     }
 
+    load_cache_snapshot();
+
     update_wide_area_servers();
     update_browse_domains();
 
@@ -1308,6 +1381,8 @@ finish:
         dbus_protocol_shutdown();
 #endif
 
+    save_cache_snapshot();
+
     if (avahi_server) {
         avahi_server_free(avahi_server);
         avahi_server = NULL;
@@ -1547,6 +1622,7 @@ int main(int argc, char *argv[]) {
     config.disable_user_service_publishing = 0;
     config.publish_dns_servers = NULL;
     config.publish_resolv_conf = 0;
+    config.cache_snapshot = 0;
     config.use_syslog = 0;
     config.debug = 0;
     config.rlimit_as_set = 0;